@@ -0,0 +1,90 @@
+/*
+    DagDB - A lightweight structured database system.
+    Copyright (C) 2012  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../src/base.h"
+#include "bench.h"
+
+/**
+ * Returns a monotonic timestamp in seconds.
+ */
+double bench_time() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * Returns the number of page faults of this process so far.
+ * When a database is freshly loaded, this counts the pages of the database that are touched.
+ */
+uint64_t bench_page_faults() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_minflt + usage.ru_majflt;
+}
+
+/**
+ * Scales the given problem size by the DAGDB_BENCH_SCALE environment variable.
+ * This allows the same benchmarks to be used for quick runs and for measurements on large databases.
+ */
+uint64_t bench_scale(uint64_t n) {
+	const char * scale = getenv("DAGDB_BENCH_SCALE");
+	if (!scale) return n;
+	double f = atof(scale);
+	if (f <= 0) return n;
+	return n * f < 1 ? 1 : n * f;
+}
+
+/**
+ * A small and fast pseudo random number generator (splitmix64).
+ */
+uint64_t bench_random(uint64_t * state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/**
+ * Prints the time per operation and the throughput of a measurement.
+ */
+void bench_report(const char * label, uint64_t operations, double seconds) {
+	printf("%-44s %10lu ops %10.1f ns/op %10.3f Mops/s\n", label, operations, seconds * 1e9 / operations, operations / seconds * 1e-6);
+}
+
+int bench_open_db() {
+	return bench_open_db_options(&dagdb_default_options);
+}
+
+/**
+ * Creates a fresh benchmark database that is opened with the given options.
+ */
+int bench_open_db_options(const dagdb_options * options) {
+	unlink(BENCH_FILENAME);
+	return dagdb_load_options(BENCH_FILENAME, options);
+}
+
+void bench_close_db() {
+	dagdb_unload();
+	unlink(BENCH_FILENAME);
+}
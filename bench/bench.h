@@ -0,0 +1,49 @@
+/*
+    DagDB - A lightweight structured database system.
+    Copyright (C) 2012  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAGDB_BENCH_H
+#define DAGDB_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../src/types.h"
+
+#define BENCH_FILENAME "bench.dagdb"
+
+/** A single benchmark. Lists of these are terminated by BENCH_INFO_NULL. */
+typedef struct {
+	const char * name;
+	void (*func)();
+} bench_info;
+#define BENCH_INFO_NULL { NULL, NULL }
+
+// Reporting
+#define BENCH_HEADER(...) { printf("\n== "); printf(__VA_ARGS__); printf(" ==\n"); }
+void bench_report(const char * label, uint64_t operations, double seconds);
+
+// Helper functions
+double   bench_time();
+uint64_t bench_page_faults();
+uint64_t bench_scale(uint64_t n);
+uint64_t bench_random(uint64_t * state);
+int      bench_open_db();
+int      bench_open_db_options(const dagdb_options * options);
+void     bench_close_db();
+
+#endif
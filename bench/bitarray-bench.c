@@ -0,0 +1,141 @@
+/*
+    DagDB - A lightweight structured database system.
+    Copyright (C) 2012  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "../src/bitarray.h"
+#include "bench.h"
+
+/** @file
+ * @brief Benchmarks of the word level bitarray primitives against loops that read a single bit at a time.
+ */
+
+/** Number of bits in the benchmarked bitarrays, which is about the size of a slab's bitmap. */
+#define BITS 4032
+
+/**
+ * Fills the bitarray with runs of set and unset bits, 
+ * where the unset runs have an average length of the given gap.
+ */
+static void fill_runs(dagdb_bitarray * b, uint64_t gap, uint64_t * state) {
+	memset(b, 0, DAGDB_BITARRAY_ARRAY_SIZE(BITS) * sizeof(dagdb_bitarray));
+	for (int_fast32_t i = 0; i < BITS;) {
+		int_fast32_t used = 1 + bench_random(state) % 16;
+		if (used > BITS - i) used = BITS - i;
+		dagdb_bitarray_mark(b, i, used);
+		i += used + bench_random(state) % (2 * gap);
+	}
+}
+
+static int_fast32_t slow_count(dagdb_bitarray * b) {
+	int_fast32_t count = 0;
+	for (int_fast32_t i = 0; i < BITS; i++) count += dagdb_bitarray_read(b, i) != 0;
+	return count;
+}
+
+static int_fast32_t slow_find_run(dagdb_bitarray * b, int_fast32_t run) {
+	int_fast32_t length = 0;
+	for (int_fast32_t i = 0; i < BITS; i++) {
+		if (dagdb_bitarray_read(b, i)) {
+			length = 0;
+		} else if (++length == run) {
+			return i + 1 - run;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Counts the set bits of a bitmap.
+ */
+static void bench_count() {
+	const uint64_t n = bench_scale(100000);
+	BENCH_HEADER("count the set bits of %d bits", BITS);
+	dagdb_bitarray b[DAGDB_BITARRAY_ARRAY_SIZE(BITS)];
+	uint64_t state = 1;
+	fill_runs(b, 8, &state);
+	int_fast32_t expect = dagdb_bitarray_count(b, 0, BITS);
+	uint64_t sum = 0;
+	double t0 = bench_time();
+	for (uint64_t j = 0; j < n; j++) sum += slow_count(b);
+	double t1 = bench_time();
+	for (uint64_t j = 0; j < n; j++) sum += dagdb_bitarray_count(b, 0, BITS);
+	double t2 = bench_time();
+	bench_report("count, bit at a time", n, t1 - t0);
+	bench_report("count, word at a time", n, t2 - t1);
+	if (sum != 2 * n * expect) printf("Counts differ\n");
+}
+
+/**
+ * Finds the first run of unset bits of a given length, in bitmaps of varying fragmentation.
+ */
+static void bench_find_run() {
+	const uint64_t n = bench_scale(20000);
+	const int_fast32_t run = 64;
+	static const uint64_t gaps[3] = {8, 32, 256};
+	BENCH_HEADER("find a run of %ld unset bits in %d bits", (long)run, BITS);
+	dagdb_bitarray b[DAGDB_BITARRAY_ARRAY_SIZE(BITS)];
+	for (int i = 0; i < 3; i++) {
+		uint64_t state = 2;
+		fill_runs(b, gaps[i], &state);
+		int_fast32_t expect = slow_find_run(b, run);
+		int64_t sum = 0;
+		double t0 = bench_time();
+		for (uint64_t j = 0; j < n; j++) sum += slow_find_run(b, run);
+		double t1 = bench_time();
+		for (uint64_t j = 0; j < n; j++) sum += dagdb_bitarray_find_run(b, 0, BITS, run, 0);
+		double t2 = bench_time();
+		char label[64];
+		snprintf(label, sizeof(label), "find_run, gaps ~%lu, bit at a time", gaps[i]);
+		bench_report(label, n, t1 - t0);
+		snprintf(label, sizeof(label), "find_run, gaps ~%lu, word at a time", gaps[i]);
+		bench_report(label, n, t2 - t1);
+		if (sum != 2 * (int64_t)n * expect) printf("Results differ\n");
+	}
+}
+
+/**
+ * Finds the next set bit in a sparse bitmap.
+ */
+static void bench_scan_next() {
+	const uint64_t n = bench_scale(100000);
+	BENCH_HEADER("scan for the next set bit in %d bits", BITS);
+	dagdb_bitarray b[DAGDB_BITARRAY_ARRAY_SIZE(BITS)];
+	memset(b, 0, sizeof(b));
+	dagdb_bitarray_mark(b, BITS - 1, 1);
+	int64_t sum = 0;
+	double t0 = bench_time();
+	for (uint64_t j = 0; j < n; j++) {
+		int_fast32_t i = 0;
+		while (i < BITS && !dagdb_bitarray_read(b, i)) i++;
+		sum += i;
+	}
+	double t1 = bench_time();
+	for (uint64_t j = 0; j < n; j++) sum += dagdb_bitarray_scan_next(b, 0, BITS, 1);
+	double t2 = bench_time();
+	bench_report("scan_next, bit at a time", n, t1 - t0);
+	bench_report("scan_next, word at a time", n, t2 - t1);
+	if (sum != 2 * (int64_t)n * (BITS - 1)) printf("Results differ\n");
+}
+
+bench_info bitarray_benches[] = {
+	{ "bitarray_count", bench_count },
+	{ "bitarray_find_run", bench_find_run },
+	{ "bitarray_scan_next", bench_scan_next },
+	BENCH_INFO_NULL,
+};
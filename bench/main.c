@@ -0,0 +1,49 @@
+/*
+    DagDB - A lightweight structured database system.
+    Copyright (C) 2012  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+
+/** @file
+ * @brief Entry point of the benchmarks.
+ * 
+ * Usage: dagdb_bench [filter]
+ * Only the benchmarks whose name contains filter are run.
+ * Problem sizes can be scaled with the DAGDB_BENCH_SCALE environment variable.
+ */
+
+extern bench_info mem_benches[];
+extern bench_info bitarray_benches[];
+
+static bench_info * benches[] = {
+	mem_benches,
+	bitarray_benches,
+	NULL,
+};
+
+int main(int argc, char ** argv) {
+	const char * filter = argc > 1 ? argv[1] : "";
+	printf("Benchmarking DAGDB\n");
+	for (int i=0; benches[i]; i++) {
+		for (bench_info * b = benches[i]; b->name; b++) {
+			if (strstr(b->name, filter)) b->func();
+		}
+	}
+	return 0;
+}
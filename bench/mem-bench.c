@@ -0,0 +1,1228 @@
+/*
+    DagDB - A lightweight structured database system.
+    Copyright (C) 2012  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// include the entire file being benchmarked.
+#include "../src/mem.c"
+
+#include <sys/stat.h>
+
+#include "../src/api.h"
+#include "bench.h"
+
+/**
+ * Fills the n given keys with random bytes.
+ */
+static void random_keys(uint8_t (*keys)[DAGDB_KEY_LENGTH], uint64_t n, uint64_t * state) {
+	for (uint64_t i=0; i<n; i++) {
+		for (int j=0; j<DAGDB_KEY_LENGTH; j+=4) {
+			uint32_t r = bench_random(state);
+			memcpy(keys[i] + j, &r, 4);
+		}
+	}
+}
+
+/**
+ * Inserts elements without data for keys from up to to in the root trie.
+ * @return 0 if successful.
+ */
+static int insert_keys(uint8_t (*keys)[DAGDB_KEY_LENGTH], uint64_t from, uint64_t to) {
+	dagdb_pointer root = dagdb_root();
+	for (uint64_t i=from; i<to; i++) {
+		dagdb_pointer e = dagdb_element_create(keys[i], 0, 0);
+		if (!e || dagdb_trie_insert(root, e) != 1) {
+			printf("Insert failed: %s\n", dagdb_last_error());
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Writes the elements from up to to, each a payload of the given size that starts with its index, 
+ * and stores their keys.
+ * @return 0 if successful.
+ */
+static int insert_payloads(uint8_t (*keys)[DAGDB_KEY_LENGTH], uint64_t from, uint64_t to, uint64_t payload) {
+	char data[payload];
+	memset(data, 0, payload);
+	for (uint64_t i=from; i<to; i++) {
+		memcpy(data, &i, sizeof(i));
+		dagdb_handle h = dagdb_write_bytes(payload, data);
+		if (!h) {
+			printf("Insert failed: %s\n", dagdb_last_error());
+			return -1;
+		}
+		dagdb_element_key(keys[i], h);
+	}
+	return 0;
+}
+
+/**
+ * Writes the n elements "<prefix> 0", "<prefix> 1", etc.
+ * @return 0 if successful.
+ */
+static int insert_names(dagdb_handle * element, uint64_t n, const char * prefix) {
+	char buf[32];
+	for (uint64_t i=0; i<n; i++) {
+		snprintf(buf, sizeof(buf), "%s %lu", prefix, i);
+		element[i] = dagdb_write_bytes(strlen(buf), buf);
+		if (!element[i]) {
+			printf("Insert failed: %s\n", dagdb_last_error());
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Looks up the given keys in the root trie.
+ * @return the number of keys that were found.
+ */
+static uint64_t find_keys(uint8_t (*keys)[DAGDB_KEY_LENGTH], uint64_t lookups) {
+	dagdb_pointer root = dagdb_root();
+	uint64_t found = 0;
+	for (uint64_t i=0; i<lookups; i++) {
+		found += dagdb_trie_find(root, keys[i]) != 0;
+	}
+	return found;
+}
+
+/**
+ * Looks up random keys out of the first n keys in the root trie.
+ * @return the number of keys that were found.
+ */
+static uint64_t find_random(uint8_t (*keys)[DAGDB_KEY_LENGTH], uint64_t n, uint64_t lookups, uint64_t * state) {
+	dagdb_pointer root = dagdb_root();
+	uint64_t found = 0;
+	for (uint64_t i=0; i<lookups; i++) {
+		found += dagdb_trie_find(root, keys[bench_random(state) % n]) != 0;
+	}
+	return found;
+}
+
+/**
+ * Reports lookups that did not find what they should.
+ */
+static void check_found(uint64_t found, uint64_t expected) {
+	if (found != expected) printf("Lookups failed: %lu found, %lu expected\n", found, expected);
+}
+
+/**
+ * Measures random lookups in the root trie of a database that has just been loaded.
+ * Fault-around is disabled, such that the number of minor page faults tells how many 
+ * pages of the file are touched by the lookups.
+ */
+static void find_cold(const char * label, uint8_t (*keys)[DAGDB_KEY_LENGTH], uint64_t n, uint64_t lookups) {
+	madvise(dagdb_file, dagdb_file_size, MADV_RANDOM);
+	uint64_t state = 7;
+	uint64_t faults = bench_page_faults();
+	double t0 = bench_time();
+	uint64_t found = find_random(keys, n, lookups, &state);
+	double t1 = bench_time();
+	faults = bench_page_faults() - faults;
+	bench_report(label, lookups, t1 - t0);
+	printf("  %lu page faults, file size %.1f MiB\n", faults, dagdb_database_size / 1048576.0);
+	check_found(found, lookups);
+}
+
+/**
+ * Computes the mean depth of the sampled root trie lookups of the statistics.
+ */
+static double mean_depth(const dagdb_statistics * stats) {
+	uint64_t depth = 0, samples = 0;
+	for (int i=0; i<DAGDB_STATS_DEPTH_BUCKETS; i++) {
+		depth += i * stats->trie_depth[i];
+		samples += stats->trie_depth[i];
+	}
+	return (double)depth / samples;
+}
+
+/**
+ * Measures root trie lookup latency while the database file grows.
+ * Each round adds a batch of elements with a sizeable payload and then
+ * performs random lookups of previously inserted elements.
+ * The latency should only depend on the trie depth, not on the file size.
+ */
+static void bench_find_while_growing() {
+	const uint64_t rounds = 8;
+	const uint64_t batch = bench_scale(16384);
+	const uint64_t lookups = bench_scale(200000);
+	const uint64_t payload = 512;
+	BENCH_HEADER("find latency vs. file size (%lu x %lu elements of %lub)", rounds, batch, payload);
+	
+	if (bench_open_db()) return;
+	uint8_t (*keys)[DAGDB_KEY_LENGTH] = malloc(rounds * batch * DAGDB_KEY_LENGTH);
+	uint64_t state = 42;
+	for (uint64_t n=batch; n<=rounds*batch; n+=batch) {
+		if (insert_payloads(keys, n - batch, n, payload)) break;
+		double t0 = bench_time();
+		uint64_t found = find_random(keys, n, lookups, &state);
+		double t1 = bench_time();
+		char label[64];
+		snprintf(label, sizeof(label), "find, file size %6.1f MiB", dagdb_database_size / 1048576.0);
+		bench_report(label, lookups, t1 - t0);
+		check_found(found, lookups);
+	}
+	free(keys);
+	bench_close_db();
+}
+
+/**
+ * Grows each of the n chunks in p from S*from to S*to bytes in steps of S.
+ * Uses either dagdb_realloc or malloc+copy+free.
+ */
+static double grow_chunks(dagdb_pointer * p, uint64_t n, int from, int to, int use_realloc) {
+	double t0 = bench_time();
+	for (int size=from; size<to; size++) {
+		for (uint64_t i=0; i<n; i++) {
+			if (use_realloc) {
+				p[i] = dagdb_realloc(p[i], size*S, (size+1)*S);
+			} else {
+				dagdb_pointer q = dagdb_malloc((size+1)*S);
+				memcpy(LOCATE(void, q), LOCATE(void, p[i]), size*S);
+				dagdb_free(p[i], size*S);
+				p[i] = q;
+			}
+		}
+	}
+	return bench_time() - t0;
+}
+
+/**
+ * Compares dagdb_realloc with malloc+copy+free.
+ * 'sparse' leaves a gap after each chunk, such that realloc can grow in place.
+ * 'dense' packs the chunks, such that most resizes must move the data.
+ */
+static void bench_realloc() {
+	const uint64_t n = bench_scale(20000);
+	const int from = 2, to = 16;
+	BENCH_HEADER("realloc vs. malloc+copy+free (%lu chunks, %lub to %lub)", n, from*S, to*S);
+	const char * label[2][2] = {
+		{"malloc+copy+free, dense", "realloc, dense"},
+		{"malloc+copy+free, sparse", "realloc, sparse"},
+	};
+	dagdb_pointer * p = malloc(n * sizeof(dagdb_pointer));
+	dagdb_pointer * gap = malloc(n * sizeof(dagdb_pointer));
+	for (int sparse=0; sparse<2; sparse++) {
+		for (int use_realloc=0; use_realloc<2; use_realloc++) {
+			if (bench_open_db()) return;
+			for (uint64_t i=0; i<n; i++) {
+				p[i] = dagdb_malloc(from*S);
+				if (sparse) gap[i] = dagdb_malloc(to*S);
+			}
+			if (sparse) {
+				for (uint64_t i=0; i<n; i++) dagdb_free(gap[i], to*S);
+			}
+			double t = grow_chunks(p, n, from, to, use_realloc);
+			bench_report(label[sparse][use_realloc], n * (to - from), t);
+			bench_close_db();
+		}
+	}
+	free(gap);
+	free(p);
+}
+
+/**
+ * Measures the import throughput of small elements for different file growth policies.
+ * Growing the file one slab at a time costs a syscall for every 32KiB of data.
+ */
+static void bench_import() {
+	const uint64_t n = bench_scale(500000);
+	const uint64_t payload = 40;
+	BENCH_HEADER("import of %lu elements of %lub", n, payload);
+	dagdb_options one_slab = dagdb_default_options;
+	one_slab.growth_min = SLAB_SIZE;
+	one_slab.growth_percent = 0;
+	const dagdb_options * policy[2] = {&one_slab, &dagdb_default_options};
+	const char * label[2] = {"one slab per step", "geometric growth"};
+	char data[payload];
+	memset(data, 0, payload);
+	for (int i=0; i<2; i++) {
+		if (bench_open_db_options(policy[i])) return;
+		dagdb_size count = dagdb_counter.growth_count;
+		double t0 = bench_time();
+		for (uint64_t j=0; j<n; j++) {
+			memcpy(data, &j, sizeof(j));
+			if (!dagdb_write_bytes(payload, data)) {
+				printf("Insert failed: %s\n", dagdb_last_error());
+				break;
+			}
+		}
+		double t1 = bench_time();
+		bench_report(label[i], n, t1 - t0);
+		printf("  %lu growth syscalls, file size %.1f MiB\n", dagdb_counter.growth_count - count, dagdb_file_size / 1048576.0);
+		bench_close_db();
+	}
+}
+
+/**
+ * Measures alternating allocation and release of a slab at the end of the file,
+ * with and without retaining the unused space.
+ */
+static void bench_churn_at_end() {
+	const uint64_t n = bench_scale(10000);
+	BENCH_HEADER("alternating malloc/free of a slab at the end of the file (%lu times)", n);
+	dagdb_options no_retention = dagdb_default_options;
+	no_retention.retention = 0;
+	const dagdb_options * policy[2] = {&no_retention, &dagdb_default_options};
+	const char * label[2] = {"truncate immediately", "retain unused space"};
+	for (int i=0; i<2; i++) {
+		if (bench_open_db_options(policy[i])) return;
+		double t0 = bench_time();
+		for (uint64_t j=0; j<n; j++) {
+			dagdb_pointer p = dagdb_malloc(SLAB_USEABLE_SPACE_SIZE - S);
+			dagdb_free(p, SLAB_USEABLE_SPACE_SIZE - S);
+		}
+		double t1 = bench_time();
+		bench_report(label[i], n, t1 - t0);
+		printf("  %lu truncations, %lu avoided\n", dagdb_counter.truncation_count, dagdb_counter.truncations_avoided);
+		bench_close_db();
+	}
+}
+
+/**
+ * Finds the free chunk list to allocate from by probing the lists one at a time.
+ * This is how dagdb_malloc worked before the header kept a mask of non-empty lists.
+ */
+static int_fast32_t chunk_lookup_linear(dagdb_size length) {
+	int_fast32_t id = alloc_chunk_id(length);
+	FreeMemoryChunk * m = LOCATE(FreeMemoryChunk, CHUNK_TABLE_LOCATION(0, id));
+	while (m->next < HEADER_SIZE && ++id < CHUNK_TABLE_SIZE) {
+		m = LOCATE(FreeMemoryChunk, CHUNK_TABLE_LOCATION(0, id));
+	}
+	return id;
+}
+
+/**
+ * Finds the free chunk list to allocate from using the header's chunk mask.
+ */
+static int_fast32_t chunk_lookup_mask(dagdb_size length) {
+	int_fast32_t id = alloc_chunk_id(length);
+	uint64_t mask = LOCATE(Header, 0)->chunk_mask[0] >> id;
+	return mask ? id + __builtin_ctzll(mask) : CHUNK_TABLE_SIZE;
+}
+
+/**
+ * Compares the free chunk list lookup using the chunk mask with linear probing.
+ * 'fresh' only has a single large free chunk, such that small requests have to probe many lists.
+ * 'churned' has free chunks of many sizes after random mallocs and frees.
+ */
+static void bench_chunk_lookup(const char * state_label) {
+	const uint64_t n = bench_scale(2000000);
+	volatile int_fast32_t sink = 0;
+	int_fast32_t (*lookup[2])(dagdb_size) = {chunk_lookup_linear, chunk_lookup_mask};
+	const char * label[2] = {"linear probe", "chunk mask"};
+	for (int k=0; k<2; k++) {
+		double t0 = bench_time();
+		for (uint64_t i=0; i<n; i++) {
+			sink += lookup[k]((2 + i % 15) * S);
+		}
+		double t1 = bench_time();
+		char text[64];
+		snprintf(text, sizeof(text), "list lookup, %s, %s", state_label, label[k]);
+		bench_report(text, n, t1 - t0);
+	}
+	(void)sink;
+}
+
+/**
+ * Allocates 1000 chunks of 2S to 16S and measures n times freeing a random one of these and allocating one 
+ * of random size in its place. With runtime_geometry, the allocator is called with the geometry of the database 
+ * instead of the constant one.
+ */
+static void churn_chunks(const char * label, uint64_t n, int runtime_geometry) {
+	const uint64_t live = 1000;
+	dagdb_pointer p[live];
+	dagdb_size size[live];
+	uint64_t state = 1;
+	for (uint64_t i=0; i<live; i++) {
+		size[i] = (2 + bench_random(&state) % 15) * S;
+		p[i] = dagdb_malloc(size[i]);
+	}
+	double t0 = bench_time();
+	if (runtime_geometry) {
+		for (uint64_t i=0; i<n; i++) {
+			uint64_t j = bench_random(&state) % live;
+			dagdb_free_slab(dagdb_slab, p[j], size[j]);
+			size[j] = (2 + bench_random(&state) % 15) * S;
+			p[j] = dagdb_malloc_slab(dagdb_slab, size[j], 0);
+		}
+	} else {
+		for (uint64_t i=0; i<n; i++) {
+			uint64_t j = bench_random(&state) % live;
+			dagdb_free(p[j], size[j]);
+			size[j] = (2 + bench_random(&state) % 15) * S;
+			p[j] = dagdb_malloc(size[j]);
+		}
+	}
+	double t1 = bench_time();
+	bench_report(label, n, t1 - t0);
+}
+
+/**
+ * Measures the malloc/free hot path for small chunks of random size.
+ */
+static void bench_malloc_free() {
+	const uint64_t n = bench_scale(2000000);
+	BENCH_HEADER("malloc/free of chunks of 2S to 16S (%lu operations)", n);
+	if (bench_open_db()) return;
+	bench_chunk_lookup("fresh");
+	churn_chunks("malloc+free", n, 0);
+	bench_chunk_lookup("churned");
+	bench_close_db();
+}
+
+/**
+ * Measures the malloc/free hot path for different slab sizes.
+ * For the default slab size, the allocator is also called with the geometry of the database instead of 
+ * the constant one, which shows what the constant folded path saves.
+ */
+static void bench_slab_size() {
+	const uint64_t n = bench_scale(2000000);
+	BENCH_HEADER("malloc/free of chunks of 2S to 16S for different slab sizes (%lu operations)", n);
+	const dagdb_size slab_size[4] = {DEFAULT_SLAB_SIZE, DEFAULT_SLAB_SIZE, MIN_SLAB_SIZE, 1<<21};
+	const char * label[4] = {"malloc+free, 32KiB slabs", "malloc+free, 32KiB slabs, runtime geometry", "malloc+free, 8KiB slabs", "malloc+free, 2MiB slabs"};
+	for (int k=0; k<4; k++) {
+		dagdb_options options = dagdb_default_options;
+		options.slab_size = slab_size[k];
+		if (bench_open_db_options(&options)) return;
+		churn_chunks(label[k], n, k == 1);
+		bench_close_db();
+	}
+}
+
+/**
+ * Measures root trie lookups with and without type segregated slabs.
+ * The database is reloaded before the lookups, see find_cold.
+ */
+static void bench_segregated_find() {
+	const uint64_t n = bench_scale(200000);
+	const uint64_t lookups = bench_scale(100000);
+	const uint64_t payload = 512;
+	BENCH_HEADER("find with mixed vs. type segregated slabs (%lu elements of %lub)", n, payload);
+	dagdb_options segregated = dagdb_default_options;
+	segregated.segregate_types = 1;
+	const dagdb_options * policy[2] = {&dagdb_default_options, &segregated};
+	const char * label[2] = {"find, mixed slabs", "find, segregated slabs"};
+	uint8_t (*keys)[DAGDB_KEY_LENGTH] = malloc(n * DAGDB_KEY_LENGTH);
+	for (int i=0; i<2; i++) {
+		if (bench_open_db_options(policy[i])) break;
+		if (insert_payloads(keys, 0, n, payload)) {
+			bench_close_db();
+			break;
+		}
+		dagdb_unload();
+		if (dagdb_load_options(BENCH_FILENAME, policy[i])) break;
+		find_cold(label[i], keys, n, lookups);
+		bench_close_db();
+	}
+	free(keys);
+}
+
+/**
+ * Measures releasing most of a database and the disk usage that remains.
+ * The eager variant clears the memory before freeing it, as dagdb_free used to do.
+ */
+static void bench_mass_free() {
+	const uint64_t n = bench_scale(400000);
+	const dagdb_size size = 16*S;
+	BENCH_HEADER("free 90%% of %lu chunks of %lub", n, size);
+	dagdb_options keep = dagdb_default_options;
+	keep.release_slabs = 0;
+	const dagdb_options * policy[3] = {&keep, &keep, &dagdb_default_options};
+	const char * label[3] = {"free, eager clear", "free", "free, release slabs"};
+	dagdb_pointer * p = malloc(n * sizeof(dagdb_pointer));
+	for (int i=0; i<3; i++) {
+		if (bench_open_db_options(policy[i])) break;
+		for (uint64_t j=0; j<n; j++) {
+			p[j] = dagdb_malloc(size);
+			memset(LOCATE(void, p[j]), 1, size);
+		}
+		struct stat before, after;
+		fstat(dagdb_database_fd, &before);
+		double t0 = bench_time();
+		// Keep the last tenth of the chunks, such that the file cannot be truncated.
+		for (uint64_t j=0; j<n - n / 10; j++) {
+			if (i == 0) memset(LOCATE(void, p[j]), 0, size);
+			dagdb_free(p[j], size);
+		}
+		double t1 = bench_time();
+		fstat(dagdb_database_fd, &after);
+		bench_report(label[i], n - n / 10, t1 - t0);
+		printf("  disk usage %.1f MiB -> %.1f MiB\n", before.st_blocks / 2048.0, after.st_blocks / 2048.0);
+		bench_close_db();
+	}
+	free(p);
+}
+
+/**
+ * Measures lookups in a database that is fragmented by churn, before and after compaction, see find_cold.
+ */
+static void bench_compact_find() {
+	const uint64_t n = bench_scale(200000);
+	const uint64_t lookups = bench_scale(100000);
+	const uint64_t payload = 64;
+	const char * compacted = "bench-compact.dagdb";
+	BENCH_HEADER("find before and after compaction (%lu elements of %lub)", n, payload);
+	uint8_t (*keys)[DAGDB_KEY_LENGTH] = malloc(n * DAGDB_KEY_LENGTH);
+	dagdb_pointer * garbage = malloc(n * sizeof(dagdb_pointer));
+	char data[payload];
+	memset(data, 0, payload);
+	if (bench_open_db()) goto done;
+	// Interleave the inserts with allocations that are mostly freed again, scattering the tries and elements.
+	uint64_t state = 3;
+	for (uint64_t j=0; j<n; j++) {
+		memcpy(data, &j, sizeof(j));
+		dagdb_handle h = dagdb_write_bytes(payload, data);
+		if (!h) {
+			printf("Insert failed: %s\n", dagdb_last_error());
+			goto done;
+		}
+		dagdb_element_key(keys[j], h);
+		garbage[j] = dagdb_malloc(S * (2 + bench_random(&state) % 30));
+	}
+	state = 3;
+	for (uint64_t j=0; j<n; j++) {
+		dagdb_size size = S * (2 + bench_random(&state) % 30);
+		if (j % 8) dagdb_free(garbage[j], size);
+	}
+	dagdb_unload();
+	unlink(compacted);
+	double t0 = bench_time();
+	if (dagdb_compact(BENCH_FILENAME, compacted)) {
+		printf("Compaction failed: %s\n", dagdb_last_error());
+		goto done;
+	}
+	bench_report("compact", n, bench_time() - t0);
+	
+	const char * file[2] = {BENCH_FILENAME, compacted};
+	const char * label[2] = {"find, fragmented", "find, compacted"};
+	for (int i=0; i<2; i++) {
+		if (dagdb_load(file[i])) break;
+		find_cold(label[i], keys, n, lookups);
+		dagdb_unload();
+	}
+	
+	done:
+	bench_close_db();
+	unlink(compacted);
+	free(keys);
+	free(garbage);
+}
+
+/**
+ * Measures lookups with the mapping options, starting with the database evicted from the page cache.
+ * The load time includes prefaulting the database if populate is set.
+ */
+static void bench_mapping_find() {
+	const uint64_t n = bench_scale(400000);
+	const uint64_t lookups = bench_scale(200000);
+	const uint64_t payload = 64;
+	BENCH_HEADER("find with mapping options, cold page cache (%lu elements of %lub)", n, payload);
+	uint8_t (*keys)[DAGDB_KEY_LENGTH] = malloc(n * DAGDB_KEY_LENGTH);
+	if (bench_open_db() || insert_payloads(keys, 0, n, payload)) goto done;
+	dagdb_unload();
+	
+	dagdb_options option[5];
+	const char * label[5] = {"find", "find, random", "find, huge pages", "find, populate", "find, populate+random+huge pages"};
+	for (int i=0; i<5; i++) option[i] = dagdb_default_options;
+	option[1].access_pattern = DAGDB_ACCESS_RANDOM;
+	option[2].huge_pages = 1;
+	option[3].populate = -1;
+	option[4].populate = -1;
+	option[4].access_pattern = DAGDB_ACCESS_RANDOM;
+	option[4].huge_pages = 1;
+	for (int i=0; i<5; i++) {
+		// Evict the database from the page cache.
+		int fd = open(BENCH_FILENAME, O_RDONLY);
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+		
+		double t0 = bench_time();
+		if (dagdb_load_options(BENCH_FILENAME, &option[i])) break;
+		double t1 = bench_time();
+		uint64_t state = 7;
+		uint64_t faults = bench_page_faults();
+		uint64_t found = find_random(keys, n, lookups, &state);
+		double t2 = bench_time();
+		faults = bench_page_faults() - faults;
+		bench_report(label[i], lookups, t2 - t1);
+		printf("  load %.1f ms, %lu page faults, file size %.1f MiB\n", (t1 - t0) * 1e3, faults, dagdb_database_size / 1048576.0);
+		check_found(found, lookups);
+		dagdb_unload();
+	}
+	
+	done:
+	bench_close_db();
+	free(keys);
+}
+
+/**
+ * Measures how many pages are touched when reading all fields of a record,
+ * in a database whose free chunk tables contain many small free ranges spread over the file.
+ * The database is reloaded before every record read and random access is advised,
+ * such that the number of minor page faults is the number of distinct pages touched by that read.
+ */
+static void bench_record_locality() {
+	const uint64_t holes = bench_scale(400000);
+	const uint64_t records = bench_scale(20000);
+	const uint64_t samples = bench_scale(1000);
+	const uint64_t keys = 64, values = 1024, fields = 8;
+	BENCH_HEADER("pages touched per record read (%lu records of %lu fields, %lu free ranges)", records, fields, holes / 2);
+	if (bench_open_db()) return;
+	
+	// Allocate small chunks and free every other one, such that allocations are served from all over the file.
+	uint64_t state = 7;
+	dagdb_pointer * chunk = malloc(holes * sizeof(dagdb_pointer));
+	dagdb_size * size = malloc(holes * sizeof(dagdb_size));
+	for (uint64_t i=0; i<holes; i++) {
+		size[i] = (2 + bench_random(&state) % 15) * S;
+		chunk[i] = dagdb_malloc(size[i]);
+	}
+	for (uint64_t i=0; i<holes; i+=2) dagdb_free(chunk[i], size[i]);
+	
+	// Create the records.
+	dagdb_handle key[keys], value[values];
+	dagdb_handle * record = malloc(records * sizeof(dagdb_handle));
+	dagdb_handle (*field)[fields] = malloc(records * sizeof(*field));
+	if (insert_names(key, keys, "field") || insert_names(value, values, "value")) goto done;
+	for (uint64_t i=0; i<records; i++) {
+		dagdb_record_entry entry[fields];
+		uint64_t first = bench_random(&state) % (keys - fields);
+		for (uint64_t j=0; j<fields; j++) {
+			entry[j].key = field[i][j] = key[first + j];
+			entry[j].value = value[bench_random(&state) % values];
+		}
+		record[i] = dagdb_write_record(fields, entry);
+		if (!record[i]) {
+			printf("Insert failed: %s\n", dagdb_last_error());
+			goto done;
+		}
+	}
+	printf("  file size %.1f MiB\n", dagdb_database_size / 1048576.0);
+	dagdb_unload();
+	
+	// Read the fields of random records.
+	dagdb_options options = dagdb_default_options;
+	options.access_pattern = DAGDB_ACCESS_RANDOM;
+	uint64_t pages = 0, found = 0;
+	double t = 0;
+	for (uint64_t i=0; i<samples; i++) {
+		uint64_t r = bench_random(&state) % records;
+		if (dagdb_load_options(BENCH_FILENAME, &options)) break;
+		uint64_t f0 = bench_page_faults();
+		double t0 = bench_time();
+		for (uint64_t j=0; j<fields; j++) {
+			found += dagdb_select(record[r], field[r][j]) != 0;
+		}
+		t += bench_time() - t0;
+		pages += bench_page_faults() - f0;
+		dagdb_unload();
+	}
+	bench_report("record read, cold mapping", samples, t);
+	printf("  %.2f pages touched per record read\n", (double)pages / samples);
+	check_found(found, samples * fields);
+	
+	done:
+	bench_close_db();
+	free(field);
+	free(record);
+	free(size);
+	free(chunk);
+}
+
+/**
+ * Measures the latency of selecting fields of wide records, and the bytes that the tries 
+ * and their kvpairs use per field. The records are read in random order from a warm mapping.
+ */
+static void bench_wide_records() {
+	const uint64_t records = bench_scale(100000);
+	const uint64_t lookups = bench_scale(2000000);
+	const uint64_t keys = 256, values = 4096, fields = 32;
+	BENCH_HEADER("field selection in wide records (%lu records of %lu fields)", records, fields);
+	if (bench_open_db()) return;
+	
+	dagdb_handle key[keys], value[values];
+	dagdb_handle * record = malloc(records * sizeof(dagdb_handle));
+	uint8_t * first = malloc(records);
+	if (insert_names(key, keys, "field") || insert_names(value, values, "value")) goto done;
+	dagdb_statistics before, after;
+	dagdb_stats(&before, 0);
+	uint64_t state = 3;
+	for (uint64_t i=0; i<records; i++) {
+		dagdb_record_entry entry[fields];
+		first[i] = bench_random(&state) % (keys - fields);
+		for (uint64_t j=0; j<fields; j++) {
+			entry[j].key = key[first[i] + j];
+			entry[j].value = value[bench_random(&state) % values];
+		}
+		record[i] = dagdb_write_record(fields, entry);
+		if (!record[i]) {
+			printf("Insert failed: %s\n", dagdb_last_error());
+			goto done;
+		}
+	}
+	dagdb_stats(&after, 0);
+	uint64_t bytes = 0;
+	for (int type=DAGDB_TYPE_TRIE; type<=DAGDB_TYPE_KVPAIR; type++) bytes += after.type_bytes[type] - before.type_bytes[type];
+	printf("  %.1f trie and kvpair bytes per field, including backrefs\n", (double)bytes / (records * fields));
+	
+	uint64_t found = 0;
+	double t0 = bench_time();
+	for (uint64_t i=0; i<lookups; i++) {
+		uint64_t r = bench_random(&state);
+		found += dagdb_select(record[r % records], key[first[r % records] + (r >> 32) % fields]) != 0;
+	}
+	bench_report("select", lookups, bench_time() - t0);
+	check_found(found, lookups);
+	
+	done:
+	bench_close_db();
+	free(first);
+	free(record);
+}
+
+/**
+ * Measures the shape of the root trie and the latency of lookups as it grows to 10M keys.
+ * Elements without data are inserted directly, such that the trie makes up most of the file.
+ * At every power of 10, the trie size per key, the mean number of nodes below the top of the 
+ * trie that a lookup traverses, and the latency of hits and misses are reported.
+ */
+static void bench_trie_shape() {
+	const uint64_t n = bench_scale(10000000);
+	const uint64_t lookups = bench_scale(1000000);
+	BENCH_HEADER("root trie shape and find latency (up to %lu keys)", n);
+	
+	if (bench_open_db()) return;
+	uint8_t (*keys)[DAGDB_KEY_LENGTH] = malloc(n * DAGDB_KEY_LENGTH);
+	uint8_t (*missing)[DAGDB_KEY_LENGTH] = malloc(lookups * DAGDB_KEY_LENGTH);
+	uint64_t state = 11;
+	random_keys(keys, n, &state);
+	uint64_t inserted = 0;
+	double insert_time = 0;
+	for (uint64_t m = 100000; ; m *= 10) {
+		if (m > n) m = n;
+		double t0 = bench_time();
+		if (insert_keys(keys, inserted, m)) goto done;
+		insert_time += bench_time() - t0;
+		inserted = m;
+		
+		dagdb_statistics stats;
+		dagdb_stats(&stats, 100000);
+		printf("%lu keys: %.1f trie bytes per key, mean depth %.2f\n", m, 
+			(double)stats.type_bytes[DAGDB_TYPE_TRIE] / m, mean_depth(&stats));
+		
+		uint64_t lookup_state = 5;
+		random_keys(missing, lookups, &lookup_state);
+		double t1 = bench_time();
+		uint64_t found = find_random(keys, m, lookups, &lookup_state);
+		double t2 = bench_time();
+		found += find_keys(missing, lookups);
+		double t3 = bench_time();
+		bench_report("find, hit", lookups, t2 - t1);
+		bench_report("find, miss", lookups, t3 - t2);
+		check_found(found, lookups);
+		if (m == n) break;
+	}
+	bench_report("insert", n, insert_time);
+	
+	done:
+	free(missing);
+	free(keys);
+	bench_close_db();
+}
+
+/**
+ * Measures the trie size per key and the latency of inserts and lookups for adversarial keys, 
+ * which come in pairs that share a prefix of the given number of bytes. 
+ */
+static void bench_trie_prefix() {
+	const uint64_t n = bench_scale(1000000);
+	const uint64_t lookups = bench_scale(1000000);
+	const int prefixes[] = {0, 8, 16, 19};
+	BENCH_HEADER("root trie with pairs of keys that share a prefix (%lu keys)", n);
+	uint8_t (*keys)[DAGDB_KEY_LENGTH] = malloc(n * DAGDB_KEY_LENGTH);
+	for (int p=0; p<4; p++) {
+		if (bench_open_db()) break;
+		uint64_t state = 13;
+		for (uint64_t i=0; i<n; i++) {
+			int first = i%2 ? prefixes[p] : 0;
+			if (i%2) memcpy(keys[i], keys[i-1], DAGDB_KEY_LENGTH);
+			for (int j=first; j<DAGDB_KEY_LENGTH; j++) keys[i][j] = bench_random(&state);
+			// Make sure the keys of a pair differ.
+			if (i%2) keys[i][DAGDB_KEY_LENGTH-1] = ~keys[i-1][DAGDB_KEY_LENGTH-1];
+		}
+		double t0 = bench_time();
+		if (insert_keys(keys, 0, n)) {
+			bench_close_db();
+			break;
+		}
+		double t1 = bench_time();
+		uint64_t found = find_random(keys, n, lookups, &state);
+		double t2 = bench_time();
+		dagdb_statistics stats;
+		dagdb_stats(&stats, 0);
+		printf("%d byte prefix: %.1f trie bytes per key\n", prefixes[p], (double)stats.type_bytes[DAGDB_TYPE_TRIE] / n);
+		bench_report("insert", n, t1 - t0);
+		bench_report("find, hit", lookups, t2 - t1);
+		check_found(found, lookups);
+		bench_close_db();
+	}
+	free(keys);
+}
+
+/**
+ * Measures whether the root trie returns to its steady state size, depth and lookup latency 
+ * under churn, where every round replaces all keys by removing a random key and inserting a new one.
+ * Removed keys are sampled from the live keys, which are kept in an array in which a removed key is 
+ * replaced by the new key.
+ */
+static void bench_trie_churn() {
+	const uint64_t n = bench_scale(1000000);
+	const uint64_t lookups = bench_scale(1000000);
+	const int rounds = 3;
+	BENCH_HEADER("root trie under churn (%lu keys, %d rounds replacing every key)", n, rounds);
+	if (bench_open_db()) return;
+	
+	uint8_t (*keys)[DAGDB_KEY_LENGTH] = malloc(n * DAGDB_KEY_LENGTH);
+	dagdb_pointer * el = malloc(n * sizeof(dagdb_pointer));
+	uint64_t state = 23;
+	dagdb_pointer root = dagdb_root();
+	for (int round=0; round<=rounds; round++) {
+		double t0 = bench_time();
+		for (uint64_t i=0; i<n; i++) {
+			uint64_t j = round ? bench_random(&state) % n : i;
+			if (round) {
+				if (dagdb_trie_remove(root, keys[j]) != 1) {
+					printf("Remove failed\n");
+					goto done;
+				}
+				dagdb_element_delete(el[j]);
+			}
+			random_keys(keys + j, 1, &state);
+			el[j] = dagdb_element_create(keys[j], 0, 0);
+			if (!el[j] || dagdb_trie_insert(root, el[j]) != 1) {
+				printf("Insert failed: %s\n", dagdb_last_error());
+				goto done;
+			}
+		}
+		double t1 = bench_time();
+		
+		dagdb_statistics stats;
+		dagdb_stats(&stats, 100000);
+		printf("round %d: %.1f trie bytes per key, mean depth %.2f\n", round, 
+			(double)stats.type_bytes[DAGDB_TYPE_TRIE] / n, mean_depth(&stats));
+		
+		double t2 = bench_time();
+		uint64_t found = find_random(keys, n, lookups, &state);
+		double t3 = bench_time();
+		bench_report(round ? "remove+insert" : "insert", n, t1 - t0);
+		bench_report("find, hit", lookups, t3 - t2);
+		check_found(found, lookups);
+	}
+	
+	done:
+	free(el);
+	free(keys);
+	bench_close_db();
+}
+
+/**
+ * Measures the throughput of random root trie lookups when several lookups are kept in flight by 
+ * dagdb_trie_find_many, compared to dagdb_trie_find, and that of dagdb_find_bytes_batch, which also 
+ * hashes the byte arrays, compared to dagdb_find_bytes.
+ */
+static void bench_find_batch() {
+	const uint64_t n = bench_scale(2000000);
+	const uint64_t lookups = bench_scale(2000000);
+	const uint64_t batch = 256;
+	BENCH_HEADER("batched lookups (%lu elements)", n);
+	if (bench_open_db()) return;
+	
+	dagdb_handle * element = malloc(n * sizeof(dagdb_handle));
+	uint8_t (*keys)[DAGDB_KEY_LENGTH] = malloc(lookups * DAGDB_KEY_LENGTH);
+	uint64_t * index = malloc(lookups * sizeof(uint64_t));
+	dagdb_pointer * result = malloc(lookups * sizeof(dagdb_pointer));
+	char buf[32];
+	if (insert_names(element, n, "key")) goto done;
+	uint64_t state = 29;
+	for (uint64_t i=0; i<lookups; i++) {
+		index[i] = bench_random(&state) % n;
+		dagdb_element_key(keys[i], element[index[i]]);
+	}
+	dagdb_pointer root = dagdb_root();
+	
+	double t0 = bench_time();
+	uint64_t found = find_keys(keys, lookups);
+	bench_report("find", lookups, bench_time() - t0);
+	check_found(found, lookups);
+	for (uint64_t k=1; k<=32; k*=2) {
+		// Lookups are passed in groups of k, such that k lookups are in flight.
+		double t1 = bench_time();
+		for (uint64_t i=0; i<lookups; i+=k) {
+			dagdb_trie_find_many(root, k < lookups - i ? k : lookups - i, (const dagdb_key*)keys + i, result + i);
+		}
+		double t2 = bench_time();
+		snprintf(buf, sizeof(buf), "find_many, %lu in flight", k);
+		bench_report(buf, lookups, t2 - t1);
+		found = 0;
+		for (uint64_t i=0; i<lookups; i++) found += result[i] == element[index[i]];
+		check_found(found, lookups);
+	}
+	
+	{
+		const uint64_t bytes_lookups = lookups / 4;
+		char (*data)[16] = malloc(batch * 16);
+		const char * data_pointer[batch];
+		uint64_t length[batch];
+		found = 0;
+		double t3 = bench_time();
+		for (uint64_t i=0; i<bytes_lookups; i++) {
+			snprintf(buf, sizeof(buf), "key %lu", index[i]);
+			found += dagdb_find_bytes(strlen(buf), buf) == element[index[i]];
+		}
+		double t4 = bench_time();
+		for (uint64_t i=0; i<bytes_lookups; i+=batch) {
+			uint64_t m = batch < bytes_lookups - i ? batch : bytes_lookups - i;
+			for (uint64_t j=0; j<m; j++) {
+				length[j] = snprintf(data[j], 16, "key %lu", index[i+j]);
+				data_pointer[j] = data[j];
+			}
+			dagdb_find_bytes_batch(m, length, data_pointer, result + i);
+		}
+		double t5 = bench_time();
+		for (uint64_t i=0; i<bytes_lookups; i++) found += result[i] == element[index[i]];
+		bench_report("find_bytes", bytes_lookups, t4 - t3);
+		snprintf(buf, sizeof(buf), "find_bytes_batch, %lu per call", batch);
+		bench_report(buf, bytes_lookups, t5 - t4);
+		check_found(found, 2*bytes_lookups);
+		free(data);
+	}
+	
+	done:
+	free(result);
+	free(index);
+	free(keys);
+	free(element);
+	bench_close_db();
+}
+
+/**
+ * Measures the bytes per element and the latency of writing and reading short byte arrays, 
+ * such as field names and small values. The elements are read in random order from a warm mapping.
+ */
+static void bench_small_bytes() {
+	const uint64_t n = bench_scale(1000000);
+	const uint64_t lookups = bench_scale(2000000);
+	BENCH_HEADER("short byte arrays (%lu elements)", n);
+	if (bench_open_db()) return;
+	
+	dagdb_handle * element = malloc(n * sizeof(dagdb_handle));
+	dagdb_statistics before, after;
+	dagdb_stats(&before, 0);
+	double t0 = bench_time();
+	if (insert_names(element, n, "value")) goto done;
+	double t1 = bench_time();
+	dagdb_stats(&after, 0);
+	uint64_t bytes = 0;
+	for (int type=DAGDB_TYPE_DATA; type<=DAGDB_TYPE_KVPAIR; type++) bytes += after.type_bytes[type] - before.type_bytes[type];
+	printf("  %.1f bytes per element, including root trie and backrefs\n", (double)bytes / n);
+	bench_report("write", n, t1 - t0);
+	
+	uint8_t buf[32];
+	uint64_t state = 17, read = 0;
+	double t2 = bench_time();
+	for (uint64_t i=0; i<lookups; i++) {
+		read += dagdb_bytes_read(buf, element[bench_random(&state) % n], 0, sizeof(buf));
+	}
+	bench_report("read", lookups, bench_time() - t2);
+	if (read < lookups * 7) printf("Reads failed: %lu bytes read\n", read);
+	
+	done:
+	bench_close_db();
+	free(element);
+}
+
+/**
+ * Measures the bytes stored per record and the import throughput of records of the form
+ * {name, city, age, joined}, where names are unique and the other values are shared between records.
+ * Records and field names are never used as values, so they do not need a backref.
+ */
+static void bench_import_records() {
+	const uint64_t n = bench_scale(200000);
+	const char * field_name[4] = {"name", "city", "age", "joined"};
+	const uint64_t distinct[4] = {n, 1000, 100, 5000};
+	BENCH_HEADER("import of %lu records of 4 fields", n);
+	if (bench_open_db()) return;
+	
+	dagdb_handle field[4];
+	for (int j=0; j<4; j++) field[j] = dagdb_write_bytes(strlen(field_name[j]), field_name[j]);
+	uint64_t state = 19;
+	char buf[32];
+	double t0 = bench_time();
+	for (uint64_t i=0; i<n; i++) {
+		dagdb_record_entry entry[4];
+		for (int j=0; j<4; j++) {
+			snprintf(buf, sizeof(buf), "%s %lu", field_name[j], j ? bench_random(&state) % distinct[j] : i);
+			entry[j].key = field[j];
+			entry[j].value = dagdb_write_bytes(strlen(buf), buf);
+			if (!entry[j].value) goto error;
+		}
+		if (!dagdb_write_record(4, entry)) goto error;
+	}
+	bench_report("import", n, bench_time() - t0);
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 0);
+	const char * type_name[4] = {"data", "element", "trie", "kvpair"};
+	uint64_t bytes = 0;
+	for (int type=DAGDB_TYPE_DATA; type<=DAGDB_TYPE_KVPAIR; type++) {
+		printf("  %.1f %s bytes per record\n", (double)stats.type_bytes[type] / n, type_name[type]);
+		bytes += stats.type_bytes[type];
+	}
+	printf("  %.1f bytes per record, file size %.1f MiB\n", (double)bytes / n, dagdb_file_size / 1048576.0);
+	bench_close_db();
+	return;
+	
+	error:
+	printf("Insert failed: %s\n", dagdb_last_error());
+	bench_close_db();
+}
+
+/**
+ * Inserts n random keys in a new root trie for each of the given options, and measures the latency 
+ * of the inserts and of lookups of present and missing keys, one at a time and 16 in flight.
+ * After the inserts, report is called to print the statistics that the options affect.
+ */
+static void bench_root_options(uint64_t n, uint64_t seed, int count, const dagdb_options * options, 
+		const char * const * label, void (*report)(uint64_t n)) {
+	const uint64_t lookups = bench_scale(2000000);
+	uint8_t (*keys)[DAGDB_KEY_LENGTH] = malloc(n * DAGDB_KEY_LENGTH);
+	uint8_t (*query)[DAGDB_KEY_LENGTH] = malloc(2 * lookups * DAGDB_KEY_LENGTH);
+	dagdb_pointer * result = malloc(lookups * sizeof(dagdb_pointer));
+	uint64_t state = seed;
+	random_keys(keys, n, &state);
+	// Hits, then misses.
+	for (uint64_t i=0; i<lookups; i++) memcpy(query[i], keys[bench_random(&state) % n], DAGDB_KEY_LENGTH);
+	random_keys(query + lookups, lookups, &state);
+	for (int k=0; k<count; k++) {
+		if (bench_open_db_options(&options[k])) break;
+		printf("%s:\n", label[k]);
+		double t0 = bench_time();
+		if (insert_keys(keys, 0, n)) {
+			bench_close_db();
+			break;
+		}
+		bench_report("  insert", n, bench_time() - t0);
+		report(n);
+		
+		dagdb_pointer root = dagdb_root();
+		const char * find_label[2] = {"  find hit", "  find miss"};
+		const char * many_label[2] = {"  find_many hit, 16 in flight", "  find_many miss, 16 in flight"};
+		for (int miss=0; miss<2; miss++) {
+			uint8_t (*q)[DAGDB_KEY_LENGTH] = query + miss * lookups;
+			double t1 = bench_time();
+			uint64_t found = find_keys(q, lookups);
+			double t2 = bench_time();
+			for (uint64_t i=0; i<lookups; i+=16) {
+				dagdb_trie_find_many(root, 16 < lookups - i ? 16 : lookups - i, (const dagdb_key*)q + i, result + i);
+			}
+			double t3 = bench_time();
+			for (uint64_t i=0; i<lookups; i++) found += result[i] != 0;
+			bench_report(find_label[miss], lookups, t2 - t1);
+			bench_report(many_label[miss], lookups, t3 - t2);
+			check_found(found, miss ? 0 : 2*lookups);
+		}
+		bench_close_db();
+	}
+	free(result);
+	free(query);
+	free(keys);
+}
+
+static void report_trie_shape(uint64_t n) {
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 100000);
+	printf("  %.1f trie bytes per key, mean depth %.2f\n", (double)stats.type_bytes[DAGDB_TYPE_TRIE] / n, mean_depth(&stats));
+}
+
+/**
+ * Measures the root trie with a top of 16 slots and with root tables of 8, 12 and 16 bits.
+ */
+static void bench_root_table() {
+	const uint64_t n = bench_scale(10000000);
+	BENCH_HEADER("root table (%lu keys)", n);
+	const char * label[4] = {"root table of 4 bits", "root table of 8 bits", "root table of 12 bits", "root table of 16 bits"};
+	dagdb_options options[4];
+	for (int k=0; k<4; k++) {
+		options[k] = dagdb_default_options;
+		options[k].root_table_bits = k ? 4 + 4*k : 0;
+	}
+	bench_root_options(n, 13, 4, options, label, report_trie_shape);
+}
+
+/**
+ * Measures the latency of root trie lookups of keys that are missing, and of keys that are present.
+ * Random missing keys mostly end at a node without a child for them. Near misses, which are the keys of 
+ * the trie with their last byte changed, all end at a leaf, where the fingerprint rejects them.
+ */
+static void bench_trie_misses() {
+	const uint64_t n = bench_scale(4000000);
+	const uint64_t lookups = bench_scale(2000000);
+	BENCH_HEADER("root trie misses (%lu keys)", n);
+	if (bench_open_db()) return;
+	uint8_t (*keys)[DAGDB_KEY_LENGTH] = malloc(n * DAGDB_KEY_LENGTH);
+	uint8_t (*query)[DAGDB_KEY_LENGTH] = malloc(3 * lookups * DAGDB_KEY_LENGTH);
+	uint64_t state = 17;
+	random_keys(keys, n, &state);
+	if (insert_keys(keys, 0, n)) goto done;
+	// Hits, random misses and near misses.
+	random_keys(query + lookups, lookups, &state);
+	for (uint64_t i=0; i<lookups; i++) {
+		memcpy(query[i], keys[bench_random(&state) % n], DAGDB_KEY_LENGTH);
+		memcpy(query[2*lookups + i], keys[bench_random(&state) % n], DAGDB_KEY_LENGTH);
+		query[2*lookups + i][DAGDB_KEY_LENGTH-1] ^= 0x5a;
+	}
+	const char * label[3] = {"find hit", "find random miss", "find near miss"};
+	for (int k=0; k<3; k++) {
+		double t0 = bench_time();
+		uint64_t found = find_keys(query + k*lookups, lookups);
+		bench_report(label[k], lookups, bench_time() - t0);
+		check_found(found, k ? 0 : lookups);
+	}
+	
+	done:
+	free(query);
+	free(keys);
+	bench_close_db();
+}
+
+static void report_filter(uint64_t n) {
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 0);
+	printf("  %.1f filter bits per key, %.3f%% false positives\n", 8.0 * stats.filter_bytes / n, 100 * stats.filter_false_positive_rate);
+}
+
+/**
+ * Measures the root trie without a filter and with filters of 5 and 10 bits per key.
+ * Most lookups of a missing key should then be rejected by the filter, at the cost of one more cache miss for a hit.
+ */
+static void bench_root_filter() {
+	const uint64_t n = bench_scale(4000000);
+	BENCH_HEADER("root filter (%lu keys)", n);
+	const char * label[3] = {"filter of 0 bits per key", "filter of 5 bits per key", "filter of 10 bits per key"};
+	dagdb_options options[3];
+	for (int k=0; k<3; k++) {
+		options[k] = dagdb_default_options;
+		options[k].filter_bits_per_key = 5*k;
+	}
+	bench_root_options(n, 19, 3, options, label, report_filter);
+}
+
+/**
+ * Measures the time that dagdb_load takes to build the hash index with different numbers of threads, its size, 
+ * and the latency of root trie lookups and of dagdb_find_bytes with and without it.
+ */
+static void bench_hash_index() {
+	const uint64_t n = bench_scale(4000000);
+	const uint64_t lookups = bench_scale(2000000);
+	const uint32_t threads[4] = {0, 1, 2, 4};
+	BENCH_HEADER("hash index (%lu elements)", n);
+	if (bench_open_db()) return;
+	
+	dagdb_handle * element = malloc(n * sizeof(dagdb_handle));
+	uint8_t (*query)[DAGDB_KEY_LENGTH] = malloc(2 * lookups * DAGDB_KEY_LENGTH);
+	uint64_t * index = malloc(lookups * sizeof(uint64_t));
+	char buf[32];
+	if (insert_names(element, n, "key")) goto done;
+	// Hits, then misses.
+	uint64_t state = 31;
+	for (uint64_t i=0; i<lookups; i++) {
+		index[i] = bench_random(&state) % n;
+		dagdb_element_key(query[i], element[index[i]]);
+	}
+	random_keys(query + lookups, lookups, &state);
+	dagdb_unload();
+	
+	for (int k=0; k<4; k++) {
+		dagdb_options options = dagdb_default_options;
+		options.index_threads = threads[k];
+		double t0 = bench_time();
+		if (dagdb_load_options(BENCH_FILENAME, &options)) {
+			printf("Load failed: %s\n", dagdb_last_error());
+			break;
+		}
+		double t1 = bench_time();
+		dagdb_statistics stats;
+		dagdb_stats(&stats, 0);
+		if (threads[k]) {
+			printf("index built by %u threads in %.1f ms, %.1f MiB per million elements\n", 
+				threads[k], (t1 - t0) * 1e3, stats.index_bytes / (n * 1e-6) / (1 << 20));
+		} else {
+			printf("no index, loaded in %.1f ms\n", (t1 - t0) * 1e3);
+		}
+		double t2 = bench_time();
+		uint64_t found = find_keys(query, lookups);
+		double t3 = bench_time();
+		found += find_keys(query + lookups, lookups);
+		double t4 = bench_time();
+		const uint64_t bytes_lookups = lookups / 4;
+		for (uint64_t i=0; i<bytes_lookups; i++) {
+			snprintf(buf, sizeof(buf), "key %lu", index[i]);
+			found += dagdb_find_bytes(strlen(buf), buf) != 0;
+		}
+		double t5 = bench_time();
+		bench_report("  find hit", lookups, t3 - t2);
+		bench_report("  find miss", lookups, t4 - t3);
+		bench_report("  find_bytes hit", bytes_lookups, t5 - t4);
+		check_found(found, lookups + bytes_lookups);
+		dagdb_unload();
+	}
+	
+	done:
+	free(index);
+	free(query);
+	free(element);
+	bench_close_db();
+}
+
+bench_info mem_benches[] = {
+	{ "mem_find_while_growing", bench_find_while_growing },
+	{ "mem_realloc", bench_realloc },
+	{ "mem_import", bench_import },
+	{ "mem_churn_at_end", bench_churn_at_end },
+	{ "mem_malloc_free", bench_malloc_free },
+	{ "mem_slab_size", bench_slab_size },
+	{ "mem_segregated_find", bench_segregated_find },
+	{ "mem_mass_free", bench_mass_free },
+	{ "mem_compact_find", bench_compact_find },
+	{ "mem_mapping_find", bench_mapping_find },
+	{ "mem_record_locality", bench_record_locality },
+	{ "mem_wide_records", bench_wide_records },
+	{ "mem_trie_shape", bench_trie_shape },
+	{ "mem_trie_prefix", bench_trie_prefix },
+	{ "mem_trie_churn", bench_trie_churn },
+	{ "mem_small_bytes", bench_small_bytes },
+	{ "mem_find_batch", bench_find_batch },
+	{ "mem_import_records", bench_import_records },
+	{ "mem_root_table", bench_root_table },
+	{ "mem_trie_misses", bench_trie_misses },
+	{ "mem_root_filter", bench_root_filter },
+	{ "mem_hash_index", bench_hash_index },
+	BENCH_INFO_NULL,
+};
@@ -0,0 +1,93 @@
+/*
+    DagDB - A lightweight structured database system.
+    Copyright (C) 2012  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// rigs
+#include "../src/base.h"
+#include "../src/error.h"
+
+static int rig_dagdb_malloc_typed=0;
+static int rigged_dagdb_malloc_typed=0;
+dagdb_pointer dagdb_malloc_typed(dagdb_size length, uint_fast32_t type);
+dagdb_pointer dagdb_malloc_typed_rigged(dagdb_size length, uint_fast32_t type) {
+	if (rig_dagdb_malloc_typed && type == DAGDB_TYPE_DATA) {
+		rigged_dagdb_malloc_typed++;
+		dagdb_errno = DAGDB_ERROR_OTHER;
+		return 0;
+	} else {
+		return dagdb_malloc_typed(length, type);
+	}
+}
+
+#define dagdb_malloc_typed dagdb_malloc_typed_rigged
+
+
+// include the entire file being tested.
+#include "../src/base.c"
+
+#include "../test/test.h"
+
+static void test_filter_rebuild() {
+	dagdb_unload();
+	unlink(DB_FILENAME);
+	dagdb_options options = dagdb_default_options;
+	options.filter_bits_per_key = 10;
+	int r = dagdb_load_options(DB_FILENAME, &options);
+	CU_ASSERT(r == 0);
+	dagdb_pointer root = dagdb_root();
+	uint8_t key[2][DAGDB_KEY_LENGTH];
+	memset(key, 0, sizeof(key));
+	key[1][0] = 1;
+	dagdb_pointer el[2];
+
+	// The first insert fails to create the filter, which leaves the database without one.
+	rig_dagdb_malloc_typed = 1;
+	el[0] = dagdb_element_create(key[0], 0, 0);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert(root, el[0]), 1);
+	EX_ASSERT_EQUAL_INT(rigged_dagdb_malloc_typed, 1);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->filter, 0);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->filter_bits_per_key, 0);
+
+	// Hence, later inserts do not try to build it again.
+	el[1] = dagdb_element_create(key[1], 0, 0);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert(root, el[1]), 1);
+	EX_ASSERT_EQUAL_INT(rigged_dagdb_malloc_typed, 1);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_find(root, key[0]), el[0]);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_find(root, key[1]), el[1]);
+
+	// Until the filter is rebuilt explicitly.
+	r = dagdb_filter_rebuild(10);
+	CU_ASSERT(r == -1);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->filter_bits_per_key, 0);
+	rig_dagdb_malloc_typed = 0;
+	r = dagdb_filter_rebuild(10);
+	CU_ASSERT(r == 0);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->filter_bits_per_key, 10);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->filter_keys, 2);
+	CU_ASSERT(!filter_rejects(root, key[0]));
+	CU_ASSERT(!filter_rejects(root, key[1]));
+}
+
+static CU_TestInfo tests[] = {
+  { "filter_rebuild_fail", test_filter_rebuild },
+  CU_TEST_INFO_NULL,
+};
+
+CU_SuiteInfo base_rt1_suites[] = {
+	{ "base-rt1",     open_new_db, close_db,   tests },
+	CU_SUITE_INFO_NULL,
+};
@@ -25,6 +25,7 @@
  */
 
 extern CU_SuiteInfo api_rt1_suites[];
+extern CU_SuiteInfo base_rt1_suites[];
 
 int main() {//int argc, char **argv) {
 	printf("Testing DAGDB\n");
@@ -33,6 +34,7 @@ int main() {//int argc, char **argv) {
 	CU_basic_set_mode(CU_BRM_NORMAL);
 	//CU_basic_set_mode(CU_BRM_VERBOSE);
 	CU_register_suites(api_rt1_suites);
+	CU_register_suites(base_rt1_suites);
 	CU_basic_run_tests();
 	int result = CU_get_number_of_tests_failed();
 	CU_cleanup_registry();
@@ -87,6 +87,26 @@ dagdb_handle dagdb_find_bytes(uint64_t length, const char* data) {
 	return dagdb_trie_find(dagdb_root(), h);
 }
 
+/** The number of keys that dagdb_find_bytes_batch hashes before looking them up together. */
+#define FIND_BATCH_SIZE 64
+
+/**
+ * Obtains references to the elements storing the given byte arrays, as dagdb_find_bytes does for each of them.
+ * The i-th byte array has length lengths[i] and is stored at data[i], its reference is stored in result[i].
+ * The lookups are performed together, such that the cache misses of different lookups overlap.
+ * @see dagdb_find_bytes
+ */
+void dagdb_find_bytes_batch(uint_fast32_t count, const uint64_t * lengths, const char * const * data, dagdb_handle * result) {
+	dagdb_hash h[FIND_BATCH_SIZE];
+	for (uint_fast32_t i=0; i<count; i+=FIND_BATCH_SIZE) {
+		uint_fast32_t n = count - i < FIND_BATCH_SIZE ? count - i : FIND_BATCH_SIZE;
+		for (uint_fast32_t j=0; j<n; j++) {
+			dagdb_data_hash(h[j], lengths[i+j], data[i+j]);
+		}
+		dagdb_trie_find_many(dagdb_root(), n, (const dagdb_key*)h, result + i);
+	}
+}
+
 /**
  * Obtains a reference to the element storing the given record.
  * Returns 0 if the record is not in the database.
@@ -113,15 +133,19 @@ dagdb_handle dagdb_write_bytes(uint64_t length, const char* data) {
 	if (r) return r;
 	
 	dagdb_handle dataptr = 0;
-	dagdb_handle backref = 0;
 	dagdb_handle element = 0;
 	
-	// Create data, backref and element.
-	dataptr = dagdb_data_create(length, data);
-	if (!dataptr) goto error;
-	backref = dagdb_trie_create();
-	if (!backref) goto error;
-	element = dagdb_element_create(h, dataptr, backref);
+	// Create data and element. Short byte arrays are stored in the element itself.
+	// The backref is created when the element is first referred to.
+	if (length > DAGDB_MAX_INLINE_LENGTH) {
+		dataptr = dagdb_data_create(length, data);
+		if (!dataptr) goto error;
+	}
+	if (dataptr) {
+		element = dagdb_element_create(h, dataptr, 0);
+	} else {
+		element = dagdb_element_create_inline(h, length, data, 0);
+	}
 	if (!element) goto error;
 	int res = dagdb_trie_insert(dagdb_root(), element);
 	if (res<0) goto error;
@@ -131,7 +155,6 @@ dagdb_handle dagdb_write_bytes(uint64_t length, const char* data) {
 	
 	error:
 	if (element) dagdb_element_delete(element);
-	if (backref) dagdb_trie_delete(backref);
 	if (dataptr) dagdb_data_delete(dataptr);
 	return 0;
 }
@@ -160,15 +183,13 @@ dagdb_handle dagdb_write_record(uint_fast32_t entries, dagdb_record_entry* items
 	if (r) return r;
 	
 	dagdb_handle record = 0;
-	dagdb_handle backref = 0;
 	dagdb_handle element = 0;
 
-	// Create the trie, backref and element
-	record = dagdb_trie_create();
+	// Create the trie and element.
+	// The element is placed close to its trie. Its backref is created when it is first referred to.
+	record = dagdb_trie_create_pairs(0);
 	if (!record) goto error;
-	backref = dagdb_trie_create();
-	if (!backref) goto error;
-	element = dagdb_element_create(h, record, backref);
+	element = dagdb_element_create(h, record, 0);
 	if (!element) goto error;
 	int res = dagdb_trie_insert(dagdb_root(), element);
 	if (res<0) goto error;
@@ -177,8 +198,8 @@ dagdb_handle dagdb_write_record(uint_fast32_t entries, dagdb_record_entry* items
 		// TODO: properly handle failures in here.
 		int res;
 		
-		// Obtain the backref trie of the i-th element being refered
-		dagdb_handle i_backref = dagdb_element_backref(items[i].value);
+		// Obtain the backref trie of the i-th element being refered, create it if this is the first reference.
+		dagdb_handle i_backref = dagdb_element_backref_obtain(items[i].value);
 		assert(i_backref > 0);
 		
 		// Obtain the hash of the i-th key
@@ -191,9 +212,8 @@ dagdb_handle dagdb_write_record(uint_fast32_t entries, dagdb_record_entry* items
 		if (i_kv>0) {
 			i_keytrie = dagdb_kvpair_value(i_kv);
 		} else {
-			i_keytrie = dagdb_trie_create();
-			i_kv = dagdb_kvpair_create(items[i].key, i_keytrie);
-			res = dagdb_trie_insert(i_backref, i_kv);
+			i_keytrie = dagdb_trie_create(i_backref);
+			res = dagdb_trie_insert_pair(i_backref, items[i].key, i_keytrie);
 			assert(res==1);
 		}
 		
@@ -202,8 +222,7 @@ dagdb_handle dagdb_write_record(uint_fast32_t entries, dagdb_record_entry* items
 		assert(res==1);
 		
 		// Insert in our record trie
-		dagdb_handle kv = dagdb_kvpair_create(items[i].key, items[i].value);
-		res = dagdb_trie_insert(record, kv);
+		res = dagdb_trie_insert_pair(record, items[i].key, items[i].value);
 		assert(res==1);
 	}
 
@@ -212,7 +231,6 @@ dagdb_handle dagdb_write_record(uint_fast32_t entries, dagdb_record_entry* items
 
 	error:
 	if (element) dagdb_element_delete(element);
-	if (backref) dagdb_trie_delete(backref);
 	if (record) dagdb_trie_delete(record);
 	return 0;
 }
@@ -221,7 +239,7 @@ dagdb_handle_type dagdb_get_handle_type(dagdb_handle item) {
 	switch(dagdb_get_pointer_type(item)) {
 		case DAGDB_TYPE_ELEMENT:
 			switch(dagdb_get_pointer_type(dagdb_element_data(item))) {
-				case DAGDB_TYPE_DATA:
+				case DAGDB_TYPE_DATA: // Also for inline data, which has data pointer 0.
 					return DAGDB_HANDLE_BYTES;
 				case DAGDB_TYPE_TRIE:
 					return DAGDB_HANDLE_RECORD;
@@ -237,11 +255,14 @@ dagdb_handle_type dagdb_get_handle_type(dagdb_handle item) {
 
 uint64_t dagdb_bytes_length(dagdb_handle h) {
 	if (dagdb_get_pointer_type(h)!=DAGDB_TYPE_ELEMENT) return 0;
-	dagdb_pointer data = dagdb_element_data(h);
-	if (dagdb_get_pointer_type(data)!=DAGDB_TYPE_DATA) return 0;
-	return dagdb_data_length(data);
+	dagdb_size length;
+	if (!dagdb_element_bytes(h, &length)) return 0;
+	return length;
 }
 
+/** Reads of at least this many bytes ask the kernel to read the data ahead. */
+#define PREFETCH_SIZE (64*1024)
+
 /** Reads bytes from a bytes handle into the given buffer.
  * Will read at most max_size bytes, starting at the position given by offset.
  * If there are less than max_bytes, this will read until the end of the bytes element.
@@ -250,17 +271,23 @@ uint64_t dagdb_bytes_length(dagdb_handle h) {
  */
 uint64_t dagdb_bytes_read(uint8_t* buffer, dagdb_handle h, uint64_t offset, uint64_t max_size) {
 	if (dagdb_get_pointer_type(h)!=DAGDB_TYPE_ELEMENT) return 0;
-	dagdb_pointer data = dagdb_element_data(h);
-	if (dagdb_get_pointer_type(data)!=DAGDB_TYPE_DATA) return 0;
-	uint64_t length = dagdb_data_length(data);
+	dagdb_size length;
+	const uint8_t * bytes = dagdb_element_bytes(h, &length);
+	if (!bytes) return 0;
 	if (offset > length) return 0;
 	if (offset + max_size > length) 
 		max_size = length - offset;
-	memcpy(buffer, dagdb_data_access(data), max_size);
+	const uint8_t * source = bytes + offset;
+	// Large reads are read ahead, also when random access has been advised for the database.
+	if (max_size >= PREFETCH_SIZE) dagdb_prefetch(source, max_size);
+	memcpy(buffer, source, max_size);
 	return max_size;
 }
 
-/** Returns a handle to the backref of given element. */
+/** 
+ * Returns a handle to the backref of given element. 
+ * Returns 0 if no record refers to the element, which gives an empty iterator.
+ */
 dagdb_handle dagdb_back_reference(dagdb_handle element) {
 	if (dagdb_get_pointer_type(element)!=DAGDB_TYPE_ELEMENT) return 0;
 	dagdb_pointer backref = dagdb_element_backref(element);
@@ -19,6 +19,7 @@
 #ifndef DAGDB_API_H
 #define DAGDB_API_H
 #include <stdint.h>
+#include "types.h"
 
 typedef uint64_t dagdb_handle;
 
@@ -37,11 +38,18 @@ typedef enum {
 } dagdb_handle_type;
 
 int           dagdb_load(const char * database);
+int           dagdb_load_options(const char * database, const dagdb_options * options);
 void          dagdb_unload();
+int           dagdb_trim();
+void          dagdb_get_counters(dagdb_counters * counters);
+void          dagdb_stats(dagdb_statistics * stats, uint_fast32_t samples);
+int           dagdb_compact(const char * source, const char * destination);
+int           dagdb_filter_rebuild(uint32_t bits_per_key);
 
 dagdb_handle  dagdb_write_bytes(uint64_t length, const char * data);
 dagdb_handle  dagdb_write_record(uint_fast32_t entries, dagdb_record_entry * items);
 dagdb_handle  dagdb_find_bytes(uint64_t length, const char * data);
+void          dagdb_find_bytes_batch(uint_fast32_t count, const uint64_t * lengths, const char * const * data, dagdb_handle * result);
 dagdb_handle  dagdb_find_record(uint_fast32_t entries, dagdb_record_entry * items);
 
 dagdb_handle_type dagdb_get_handle_type(dagdb_handle item);
@@ -16,10 +16,15 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include "base.h"
 #include "error.h"
@@ -33,11 +38,13 @@ STATIC_ASSERT(DAGDB_TYPE_DATA    < S,pointer_size_too_small_to_contain_type_data
 STATIC_ASSERT(DAGDB_TYPE_ELEMENT < S,pointer_size_too_small_to_contain_type_element);
 STATIC_ASSERT(DAGDB_TYPE_TRIE    < S,pointer_size_too_small_to_contain_type_trie);
 STATIC_ASSERT(DAGDB_TYPE_KVPAIR  < S,pointer_size_too_small_to_contain_type_kvpair);
+STATIC_ASSERT(DAGDB_TRIE_PAIRS  < S && DAGDB_TRIE_PAIRS > DAGDB_TYPE_KVPAIR,invalid_trie_pairs_flag);
 /**
  * Obtains the type inormation of the given pointer.
+ * The DAGDB_TRIE_PAIRS flag is not part of the type.
  */
 inline dagdb_pointer_type dagdb_get_pointer_type(dagdb_pointer location) {
-	return location&DAGDB_TYPE_MASK;
+	return location&DAGDB_TYPE_MASK&~DAGDB_TRIE_PAIRS;
 }
 
 
@@ -102,61 +109,140 @@ const void *dagdb_data_access(dagdb_pointer location) {
 /**
  * Element
  * DAGDB_KEY_LENGTH bytes: key
- * 4 bytes: padding. (can be used to store information about this element.
- * S bytes: forward pointer (data or trie)
- * S bytes: pointer to backref. (trie)
- * TODO (low): for small data elements, embed data in this element.
+ * 4 bytes: flags and, for elements with inline data, its length.
+ * S bytes: pointer to backref. (trie, or 0 if nothing refers to this element yet)
+ * S bytes: forward pointer (data or trie), or up to DAGDB_MAX_INLINE_LENGTH bytes of inline data.
  */
 typedef struct {
 	/** The key used to store this element. */
 	unsigned char key[DAGDB_KEY_LENGTH];
-	/** 4 padding bytes. */
-	uint32_t dummy;
-	/** Pointer to the trie containing this element's back references. */
-	dagdb_pointer backref;
-	/** Pointer to the data contained in this element.
-	 * This can be either a data object or, in case of a record, a trie.
+	/** ELEMENT_INLINE if the data is embedded in this element, in which case the lower bits contain its length. */
+	uint32_t info;
+	/** Pointer to the trie containing this element's back references. 
+	 * This is 0 until the element is first referred to, see dagdb_element_backref_obtain. 
 	 */
-	dagdb_pointer data;
+	dagdb_pointer backref;
+	union {
+		/** Pointer to the data contained in this element.
+		 * This can be either a data object or, in case of a record, a trie.
+		 */
+		dagdb_pointer data;
+		/** The embedded data. Elements with more than S bytes of inline data are allocated larger. */
+		uint8_t bytes[S];
+	};
 } Element;
 
+/** Flag in Element::info that is set if the data of the element is stored inline. */
+#define ELEMENT_INLINE (1u<<31)
+/** Mask for the length of inline data in Element::info. */
+#define ELEMENT_LENGTH_MASK 0xffffu
+STATIC_ASSERT(DAGDB_MAX_INLINE_LENGTH <= ELEMENT_LENGTH_MASK, inline_length_does_not_fit_in_element_info);
+
+/** Returns the allocated size of an element with the given info. */
+static inline dagdb_size element_size(uint32_t info) {
+	if (!(info & ELEMENT_INLINE)) return sizeof(Element);
+	dagdb_size length = info & ELEMENT_LENGTH_MASK;
+	return offsetof(Element, bytes) + (length > S ? length : S);
+}
+
 /**
  * Allocates an element with specified key.
  * The data and backref pointers are copied into the element.
+ * If the data is a trie, as is the case for records, the element is placed close to it.
  * If memory allocation succeeds, a pointer to the element is returned.
  * Otherwise, this function returns 0.
  */
 dagdb_pointer dagdb_element_create(dagdb_key key, dagdb_pointer data, dagdb_pointer backref) {
-	dagdb_pointer r = dagdb_malloc(sizeof(Element));
+	dagdb_pointer hint = dagdb_get_pointer_type(data) == DAGDB_TYPE_TRIE ? data : 0;
+	dagdb_pointer r = dagdb_malloc_near(sizeof(Element), DAGDB_TYPE_ELEMENT, hint);
 	if (!r) return 0;
 	Element* e = LOCATE(Element, r);
 	memcpy(e->key, key, DAGDB_KEY_LENGTH);
+	e->info = 0;
 	e->data = data;
 	e->backref = backref;
 	return r | DAGDB_TYPE_ELEMENT;
 }
 
+/**
+ * Allocates an element with specified key that stores the given bytes inline, 
+ * such that reading them does not require following a pointer.
+ * The length must not exceed DAGDB_MAX_INLINE_LENGTH.
+ * If memory allocation succeeds, a pointer to the element is returned.
+ * Otherwise, this function returns 0.
+ */
+dagdb_pointer dagdb_element_create_inline(dagdb_key key, dagdb_size length, const void * data, dagdb_pointer backref) {
+	assert(length <= DAGDB_MAX_INLINE_LENGTH);
+	uint32_t info = ELEMENT_INLINE | length;
+	dagdb_pointer r = dagdb_malloc_typed(element_size(info), DAGDB_TYPE_ELEMENT);
+	if (!r) return 0;
+	Element* e = LOCATE(Element, r);
+	memcpy(e->key, key, DAGDB_KEY_LENGTH);
+	e->info = info;
+	e->backref = backref;
+	e->data = 0;
+	memcpy(e->bytes, data, length);
+	return r | DAGDB_TYPE_ELEMENT;
+}
+
 void dagdb_element_delete(dagdb_pointer location) {
 	assert(dagdb_get_pointer_type(location) == DAGDB_TYPE_ELEMENT);
-	dagdb_free(location, sizeof(Element));
+	Element* e = LOCATE(Element, location);
+	dagdb_free(location, element_size(e->info));
 }
 
 /**
  * Returns the data pointer of this element. 
  * This should be a pointer to data or the root of a trie.
+ * Elements that store their data inline return 0, use dagdb_element_bytes to access it.
  */
 dagdb_pointer dagdb_element_data(dagdb_pointer location) {
 	assert(dagdb_get_pointer_type(location) == DAGDB_TYPE_ELEMENT);
 	Element* e = LOCATE(Element, location);
+	if (e->info & ELEMENT_INLINE) return 0;
 	return e->data;
 }
 
+/**
+ * Returns the bytes stored in this element and stores their length in the given variable.
+ * Inline data is returned without following any pointers.
+ * Returns NULL if this element does not store bytes, which is the case for records.
+ */
+const void * dagdb_element_bytes(dagdb_pointer location, dagdb_size * length) {
+	assert(dagdb_get_pointer_type(location) == DAGDB_TYPE_ELEMENT);
+	Element* e = LOCATE(Element, location);
+	if (e->info & ELEMENT_INLINE) {
+		*length = e->info & ELEMENT_LENGTH_MASK;
+		return e->bytes;
+	}
+	if (dagdb_get_pointer_type(e->data) != DAGDB_TYPE_DATA) return NULL;
+	Data* d = LOCATE(Data, e->data);
+	*length = d->length;
+	return d->data;
+}
+
 dagdb_pointer dagdb_element_backref(dagdb_pointer location) {
 	assert(dagdb_get_pointer_type(location) == DAGDB_TYPE_ELEMENT);
 	Element* e = LOCATE(Element, location);
 	return e->backref;
 }
 
+/**
+ * Returns the backref of this element, creating it if it does not exist yet.
+ * The backref is not placed near the element, as the slab of an older element is usually full, 
+ * which makes searching the slabs near it slower than the allocation is worth.
+ * Returns 0 if the backref had to be created and memory allocation failed.
+ */
+dagdb_pointer dagdb_element_backref_obtain(dagdb_pointer location) {
+	assert(dagdb_get_pointer_type(location) == DAGDB_TYPE_ELEMENT);
+	dagdb_pointer backref = LOCATE(Element, location)->backref;
+	if (backref) return backref;
+	backref = dagdb_trie_create_pairs(0);
+	if (!backref) return 0;
+	LOCATE(Element, location)->backref = backref;
+	return backref;
+}
+
 void dagdb_element_key(uint8_t * key, dagdb_pointer location)
 {
 	assert(dagdb_get_pointer_type(location) == DAGDB_TYPE_ELEMENT);
@@ -172,37 +258,29 @@ void dagdb_element_key(uint8_t * key, dagdb_pointer location)
  * KV Pair
  * S bytes: Key (element)
  * S bytes: Value (element or trie)
- * TODO (med): Remove this (and embed them in the tries)
+ *
+ * Pairs are embedded in the slots of tries that map keys to values, see dagdb_trie_create_pairs.
+ * A pointer to a pair refers to its slot, hence it is only valid until that trie is modified.
  */
 typedef struct  {
-	/** The key, tag or field name. */
+	/** The key, tag or field name, which carries the fingerprint of its key, see leaf_element. */
 	dagdb_pointer key;
 	/** The data that is stored under given key. */
 	dagdb_pointer value;
 } KVPair;
 
-/**
- * Returns 0 if memory allocation fails.
- */
-dagdb_pointer dagdb_kvpair_create(dagdb_pointer key, dagdb_pointer value) {
-	assert(dagdb_get_pointer_type(key) == DAGDB_TYPE_ELEMENT);
-	dagdb_pointer r = dagdb_malloc(sizeof(KVPair));
-	if (!r) return 0;
-	KVPair*  p = LOCATE(KVPair, r);
-	p->key = key;
-	p->value = value;
-	return r | DAGDB_TYPE_KVPAIR;
-}
+/** Masks the bits of the element in the slot of a leaf that hold the fingerprint of its key. */
+#define FINGERPRINT_MASK (~0ULL << DAGDB_POINTER_BITS)
 
-void dagdb_kvpair_delete(dagdb_pointer location) {
-	assert(dagdb_get_pointer_type(location) == DAGDB_TYPE_KVPAIR);
-	dagdb_free(location, 2 * S);
+/** Returns the element in the slot of a leaf, without the fingerprint of its key. */
+static inline dagdb_pointer leaf_element(dagdb_pointer slot) {
+	return slot & ~FINGERPRINT_MASK;
 }
 
 dagdb_pointer dagdb_kvpair_key(dagdb_pointer location) {
 	assert(dagdb_get_pointer_type(location) == DAGDB_TYPE_KVPAIR);
 	KVPair*  p = LOCATE(KVPair, location);
-	return p->key;
+	return leaf_element(p->key);
 }
 
 dagdb_pointer dagdb_kvpair_value(dagdb_pointer location) {
@@ -221,56 +299,272 @@ dagdb_pointer dagdb_kvpair_value(dagdb_pointer location) {
  */
 typedef uint8_t * key;
 
-/** 
+/**
  * The trie
- * 16 * S bytes: Pointers (trie or element)
- * 
+ * 16 * w * S bytes: Slots (node, element or kvpair)
+ *
  * The elements of a map are stored in a special kind of tree, known as a trie.
  * Leave nodes store the keys and their associated values. (element or kvpair)
- * Parent nodes store up to 2^4 = 16 pointers to child nodes.
- * 
- * Let x be a key that is stored below node n. 
- * Let k denote the level of the node. For the root node k=0, for its child nodes k=1.
- * Then the k-th 4 bits of key x denotes the index of the pointer to the child node that stores x.
- * 
- * TODO (low): make tries much more space efficient. 
- *             Instead of 16, support 256 child nodes. With the help of a bitmap, 
- *             we can limit the storage requirement to only the non-null pointers.
- *             This alternative requires realloc to be implemented.
- * TODO (low): embed kv-pairs into tries.
- *             The current implementation stores a single pointer to a pair of pointers.
- *             Embedding the two pointers into the trie would prevent one IO and reduce memory usage of kvpairs by one third.
- * TODO (low): make tries implicit (with a single pointer to its location) to allow realloc operations.
- * 
+ * The top of the trie stores up to 2^4 = 16 slots for its children.
+ * The top has a fixed size, such that the pointer to the trie, which is stored in the header,
+ * an element or a kvpair, never changes. Below the top, the trie consists of bitmap compressed
+ * nodes, each of which has up to 2^8 = 256 children.
+ *
+ * A slot consists of w pointers. In a set of elements w = 1 and a slot holds a node or an element.
+ * In a trie that maps keys to values, which is marked by DAGDB_TRIE_PAIRS, w = 2 and a slot holds
+ * either a node followed by 0, or a kvpair. Hence the pairs are embedded in the trie and are found
+ * without following another pointer.
+ *
+ * Let x be a key that is stored below the top. The first 4 bits of x denote the index of the slot
+ * of the child that stores x. Each node splits on a pair of nibbles, the i-th and (i+1)-th 4 bits 
+ * of x for some odd i, which combined into a byte denote the child of the node that stores x.
+ * The former 4 bits are the most significant half of the byte, such that the entries are in the
+ * same order as if each level would split on 4 bits.
+ *
+ * The trie is path compressed: a node stores i, which is the first pair of nibbles in which the keys below
+ * it differ. The nibbles between the parent and the node are skipped, instead of being split on by a chain 
+ * of nodes with a single child. As the skipped nibbles are not stored, they are checked by comparing the 
+ * whole key with that of the leaf that a lookup ends at.
+ *
+ * The top of the root trie can be a larger table, whose slots are selected by the first n nibbles of the key, 
+ * see dagdb_options::root_table_bits. The nodes below it split on the pairs of nibbles that follow, hence 
+ * at indices i for which i-n is even. For even n, such a pair is a single byte of the key.
+ *
+ * The element in the slot of a leaf carries a fingerprint of its key in the bits above DAGDB_POINTER_BITS.
+ * A lookup compares it with the fingerprint of the requested key, such that most keys that are not in 
+ * the trie are rejected without loading the element.
+ */
+
+/** The number of pointers in a slot of the given trie. */
+#define SLOT_WIDTH(trie) ((trie) & DAGDB_TRIE_PAIRS ? 2 : 1)
+
+/** The number of slots in the top of a trie whose slots are selected by the given number of nibbles. */
+#define TOP_SLOTS(nibbles) (1ULL << 4*(nibbles))
+
+/** The allocated size of the top of a trie with slots of w pointers that are selected by the given number of nibbles. */
+#define TOP_SIZE_NIBBLES(nibbles,w) (TOP_SLOTS(nibbles)*(w)*S)
+
+/** The allocated size of the top of a trie with slots of w pointers. */
+#define TOP_SIZE(w) TOP_SIZE_NIBBLES(1,w)
+
+/**
+ * Returns the number of leading nibbles of a key that select its slot in the top of the given trie.
+ * This is 1, except for the root trie of a database with a root table.
+ */
+static inline uint_fast32_t top_nibbles(dagdb_pointer trie) {
+	const Header * h = LOCATE(Header, 0);
+	return trie == h->root ? h->root_nibbles : 1;
+}
+
+/**
+ * Bitmap compressed trie node
+ * S bytes: index
+ * 4 * S bytes: bitmap
+ * n * w * S bytes: Slots (node, element or kvpair)
+ *
+ * Only the non-null children of a node are stored, in the order of the byte that indexes them.
+ * The bitmap tells which of the 256 children are present, hence n is its population count.
+ * Nodes are resized with dagdb_realloc when children are added or removed, which can move them.
+ * Therefore a node must only be referenced by its parent, whose pointer is updated accordingly.
  */
 typedef struct {
-	/** Splits up entries of the trie based on the next nibble of their key. */
-	dagdb_pointer entry[16];
-} Trie;
+	/** The index of the first of the two nibbles this node splits on. This is odd, except below root tables of an even number of nibbles. */
+	dagdb_size index;
+	/** Bit i is set if the child for byte i is present. */
+	uint64_t bitmap[4];
+	/** The slots of the children that are present. Their number is the population count of the bitmap. */
+	dagdb_pointer entry[];
+} Node;
+STATIC_ASSERT(sizeof(Node)==5*S,invalid_node_size);
+
+/** The allocated size of a node with n children in slots of w pointers. */
+#define NODE_SIZE(n,w) (sizeof(Node) + (n)*(w)*S)
+
+/**
+ * Allocates an empty top of a trie with slots of w pointers that are selected by the given number of nibbles, 
+ * close to the given hint.
+ */
+static dagdb_pointer dagdb_trie_create_top(dagdb_pointer hint, uint_fast32_t nibbles, uint_fast32_t w)
+{
+	dagdb_pointer r = dagdb_malloc_near(TOP_SIZE_NIBBLES(nibbles, w), DAGDB_TYPE_TRIE, hint);
+	if (!r) return 0;
+	memset(LOCATE(void, r), 0, TOP_SIZE_NIBBLES(nibbles, w));
+	return r | DAGDB_TYPE_TRIE;
+}
 
 /**
+ * Allocates an empty set of elements close to the given hint, which is usually the structure that will point to it, or 0.
  * Returns 0 if memory allocation fails.
+ * @see dagdb_malloc_near
  */
-dagdb_pointer dagdb_trie_create()
+dagdb_pointer dagdb_trie_create(dagdb_pointer hint)
 {
-	dagdb_pointer r = dagdb_malloc(sizeof(Trie));
-	memset(LOCATE(void, r), 0, sizeof(Trie));
+	return dagdb_trie_create_top(hint, 1, 1);
+}
+
+/**
+ * Allocates an empty trie that maps keys to values close to the given hint, which is usually the structure 
+ * that will point to it, or 0. Its pairs are added with dagdb_trie_insert_pair.
+ * Returns 0 if memory allocation fails.
+ * @see dagdb_malloc_near
+ */
+dagdb_pointer dagdb_trie_create_pairs(dagdb_pointer hint)
+{
+	dagdb_pointer r = dagdb_trie_create_top(hint, 1, 2);
+	return r ? r | DAGDB_TRIE_PAIRS : 0;
+}
+
+/**
+ * Counts the bits that are set in each byte of v.
+ */
+static inline uint64_t popcount_bytes(uint64_t v) {
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	return (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+}
+
+/**
+ * Counts the bits that are set in the four given words.
+ * Unless the compiler may use a popcount instruction (see DAGDB_POPCNT in CMakeLists.txt),
+ * __builtin_popcountl becomes a library call,
+ * which is avoided here, as this is on the critical path of every trie lookup.
+ */
+static inline uint_fast32_t popcount4(uint64_t a, uint64_t b, uint64_t c, uint64_t d) {
+#ifdef __POPCNT__
+	return __builtin_popcountl(a) + __builtin_popcountl(b) + __builtin_popcountl(c) + __builtin_popcountl(d);
+#else
+	// A byte of the sum of the byte counts is at most 32, hence these can be added before summing the bytes.
+	// The total can be 256, hence the bytes are summed in pairs first, such that it is summed in 16 bits.
+	uint64_t v = popcount_bytes(a) + popcount_bytes(b) + popcount_bytes(c) + popcount_bytes(d);
+	v = (v & 0x00ff00ff00ff00ffULL) + ((v >> 8) & 0x00ff00ff00ff00ffULL);
+	return (v * 0x0001000100010001ULL) >> 48;
+#endif
+}
+
+/**
+ * Returns the number of children of the given node.
+ */
+static inline uint_fast32_t node_count(const Node * n) {
+	return popcount4(n->bitmap[0], n->bitmap[1], n->bitmap[2], n->bitmap[3]);
+}
+
+/**
+ * Returns whether the given node has a child for byte b.
+ */
+static inline int node_has(const Node * n, uint_fast32_t b) {
+	return (n->bitmap[b>>6] >> (b&63)) & 1;
+}
+
+/**
+ * Returns the index in the entry array of the child for byte b,
+ * which is where it is or would be stored.
+ */
+static inline uint_fast32_t node_index(const Node * n, uint_fast32_t b) {
+	// The nodes near the top of a large trie are full, for which no population count is needed.
+	if (~(n->bitmap[0] & n->bitmap[1] & n->bitmap[2] & n->bitmap[3]) == 0) return b;
+	// Mask the bits from b onward without branching, as b is unpredictable.
+	uint64_t w = b>>6;
+	uint64_t below = (1ULL << (b&63)) - 1;
+	uint64_t mask[4];
+	for (uint64_t i=0; i<4; i++) {
+		mask[i] = -(uint64_t)(i < w) | (below & -(uint64_t)(i == w));
+	}
+	return popcount4(n->bitmap[0] & mask[0], n->bitmap[1] & mask[1], n->bitmap[2] & mask[2], n->bitmap[3] & mask[3]);
+}
+
+/**
+ * Allocates a node that splits on the nibbles at the given index and the next, with room for the given 
+ * number of children in slots of w pointers, close to the given hint.
+ * Its bitmap is cleared, the children must be filled in by the caller.
+ * Returns 0 if memory allocation fails.
+ */
+static dagdb_pointer dagdb_node_create(dagdb_pointer hint, uint_fast32_t index, uint_fast32_t count, uint_fast32_t w)
+{
+	assert(index < 2*DAGDB_KEY_LENGTH);
+	dagdb_pointer r = dagdb_malloc_near(NODE_SIZE(count, w), DAGDB_TYPE_TRIE, hint);
 	if (!r) return 0;
+	Node * n = LOCATE(Node, r);
+	memset(n, 0, sizeof(Node));
+	n->index = index;
 	return r | DAGDB_TYPE_TRIE;
 }
 
+/**
+ * Recursively removes this node, which has slots of w pointers.
+ */
+static void dagdb_node_delete(dagdb_pointer location, uint_fast32_t w)
+{
+	Node* n = LOCATE(Node, location);
+	uint_fast32_t count = node_count(n);
+	for(uint_fast32_t i=0; i<count; i++) {
+		if (dagdb_get_pointer_type(n->entry[i*w]) == DAGDB_TYPE_TRIE)
+			dagdb_node_delete(n->entry[i*w], w);
+	}
+	dagdb_free(location, NODE_SIZE(count, w));
+}
+
+/**
+ * Adds the given slot of w pointers as child for byte b to the node that slot refers to.
+ * The node is enlarged, and slot is updated if it moves.
+ * Returns 0 on success and -1 if memory allocation fails, in which case the node is left untouched.
+ */
+static int dagdb_node_insert(dagdb_pointer * slot, uint_fast32_t b, const dagdb_pointer * leaf, uint_fast32_t w)
+{
+	Node * n = LOCATE(Node, *slot);
+	assert(!node_has(n, b));
+	uint_fast32_t count = node_count(n);
+	uint_fast32_t index = node_index(n, b);
+	dagdb_pointer r = dagdb_realloc(*slot, NODE_SIZE(count, w), NODE_SIZE(count+1, w));
+	if (!r) return -1;
+	*slot = r;
+	n = LOCATE(Node, r);
+	memmove(n->entry + (index + 1)*w, n->entry + index*w, (count - index) * w * S);
+	memcpy(n->entry + index*w, leaf, w * S);
+	n->bitmap[b>>6] |= 1ULL << (b&63);
+	return 0;
+}
+
+/**
+ * Removes the child for byte b from the node with slots of w pointers that slot refers to.
+ * The node is shrunk in place. If only one child remains, the node no longer splits anything,
+ * so it is freed and the remaining child, being either a leaf or a node that splits on a later index,
+ * takes its place in slot. Hence, every node keeps having at least two children.
+ */
+static void dagdb_node_erase(dagdb_pointer * slot, uint_fast32_t b, uint_fast32_t w)
+{
+	Node * n = LOCATE(Node, *slot);
+	assert(node_has(n, b));
+	uint_fast32_t count = node_count(n);
+	uint_fast32_t index = node_index(n, b);
+	assert(count >= 2);
+	if (count == 2) {
+		dagdb_pointer node = *slot;
+		memcpy(slot, n->entry + (1 - index)*w, w * S);
+		dagdb_free(node, NODE_SIZE(2, w));
+		return;
+	}
+	memmove(n->entry + index*w, n->entry + (index + 1)*w, (count - index - 1) * w * S);
+	n->bitmap[b>>6] &= ~(1ULL << (b&63));
+	dagdb_pointer r = dagdb_realloc(*slot, NODE_SIZE(count, w), NODE_SIZE(count-1, w));
+	assert(r == *slot);
+	(void)r;
+}
+
 /**
  * Recursively removes this try.
+ * The pairs of a trie that maps keys to values are removed with it, their values are not.
  */
 void dagdb_trie_delete(dagdb_pointer location)
 {
 	assert(dagdb_get_pointer_type(location) == DAGDB_TYPE_TRIE);
-	Trie* t = LOCATE(Trie, location);
-	for(uint_fast32_t i=0; i<16; i++) {
-		if (dagdb_get_pointer_type(t->entry[i]) == DAGDB_TYPE_TRIE)
-			dagdb_trie_delete(t->entry[i]);
+	uint_fast32_t w = SLOT_WIDTH(location);
+	uint_fast32_t nibbles = top_nibbles(location);
+	dagdb_pointer * top = LOCATE(dagdb_pointer, location);
+	for(uint_fast32_t i=0; i<TOP_SLOTS(nibbles); i++) {
+		if (dagdb_get_pointer_type(top[i*w]) == DAGDB_TYPE_TRIE)
+			dagdb_node_delete(top[i*w], w);
 	}
-	dagdb_free(location, sizeof(Trie));
+	dagdb_free(location, TOP_SIZE_NIBBLES(nibbles, w));
 }
 
 static uint_fast32_t nibble(const uint8_t * key, uint_fast32_t index) {
@@ -282,149 +576,652 @@ static uint_fast32_t nibble(const uint8_t * key, uint_fast32_t index) {
 }
 
 /**
- * Retrieves the key from an Element or from the key part of the KVPair.
+ * Returns the index of the slot in a top whose slots are selected by the given number of nibbles of the key.
+ * The nibbles are combined in the order of the trie, such that the slots are in the order of iteration.
  */
-static key obtain_key(dagdb_pointer pointer) {
-	// Obtain the key.
-	if (dagdb_get_pointer_type(pointer) == DAGDB_TYPE_KVPAIR) {
-		assert(pointer>=HEADER_SIZE);
-		KVPair* kv = LOCATE(KVPair,pointer);
-		pointer = kv->key;
+static inline uint_fast32_t top_index(const uint8_t * key, uint_fast32_t nibbles) {
+	uint_fast32_t r = nibble(key, 0);
+	for (uint_fast32_t i=1; i<nibbles; i++) r = r << 4 | nibble(key, i);
+	return r;
+}
+
+/**
+ * Returns the byte that a node splits on, which consists of the nibbles at the given index and the next.
+ * At odd indices, these are the upper half of a byte of the key followed by the lower half of the next byte. 
+ * For the last nibble of the key, the lower half of this byte is 0.
+ * At even indices, which only occur below root tables of an even number of nibbles, this is a byte of the key
+ * with its halves swapped.
+ */
+static inline uint_fast32_t split_byte(const uint8_t * key, uint_fast32_t index) {
+	assert(index < 2*DAGDB_KEY_LENGTH);
+	uint_fast32_t r = key[index>>1];
+	if (!(index&1)) return (r << 4 | r >> 4) & 0xff;
+	r &= 0xf0;
+	if (index + 1 < 2*DAGDB_KEY_LENGTH) r |= key[(index>>1) + 1] & 0x0f;
+	return r;
+}
+
+/**
+ * Returns the index of the pair of nibbles that contains the nibble with the given index, 
+ * in a trie whose top is selected by the given number of nibbles.
+ */
+static inline uint_fast32_t pair_index(uint_fast32_t d, uint_fast32_t nibbles) {
+	assert(d >= nibbles);
+	return d - ((d - nibbles) & 1);
+}
+
+/**
+ * Returns the index of the first nibble in which the given keys differ, or 2*DAGDB_KEY_LENGTH if they are equal.
+ */
+static uint_fast32_t first_difference(const uint8_t * a, const uint8_t * b) {
+	for (uint_fast32_t j=0; j<DAGDB_KEY_LENGTH; j++) {
+		uint8_t x = a[j] ^ b[j];
+		if (x) return 2*j + ((x & 0xf) ? 0 : 1);
 	}
+	return 2*DAGDB_KEY_LENGTH;
+}
+
+/**
+ * Returns the fingerprint of the given key, in the bits that it occupies in the slot of a leaf.
+ * It is folded from the last 8 bytes of the key, which the nodes above a leaf rarely split on.
+ */
+static inline dagdb_pointer fingerprint(const uint8_t * key) {
+	uint64_t x;
+	memcpy(&x, key + DAGDB_KEY_LENGTH - sizeof(x), sizeof(x));
+	x ^= x >> 32;
+	x ^= x >> 16;
+	return x << DAGDB_POINTER_BITS;
+}
+
+/**
+ * Retrieves the key from an Element, which is either the element in a slot or the key of a kvpair.
+ */
+static key obtain_key(dagdb_pointer pointer) {
+	pointer = leaf_element(pointer);
 	assert(pointer>=HEADER_SIZE);
 	assert(dagdb_get_pointer_type(pointer) == DAGDB_TYPE_ELEMENT);
 	Element* e = LOCATE(Element,pointer);
 	return e->key;
 }
 
+/**
+ * Returns the pointer that refers to the leaf in the given slot of a trie with slots of w pointers.
+ * This is the element itself, or the embedded kvpair.
+ */
+static inline dagdb_pointer leaf_pointer(dagdb_pointer * slot, uint_fast32_t w) {
+	if (w == 1) return leaf_element(*slot);
+	return ((uint8_t*)slot - (uint8_t*)dagdb_file) | DAGDB_TYPE_KVPAIR;
+}
+
+/**
+ * The filter
+ * filter_blocks * FILTER_BLOCK_SIZE bytes: blocks of FILTER_BLOCK_WORDS words.
+ *
+ * The keys in the root trie can be summarized by a blocked Bloom filter, see dagdb_options::filter_bits_per_key.
+ * The hash of a key selects a block, in which it sets one bit in each word. Hence, a lookup of a key that is 
+ * not in the root trie is mostly rejected after reading a single cache line. Removing a key leaves its bits set, 
+ * as these might be shared with other keys. The filter is rebuilt from the root trie once more keys have been 
+ * added to it than it has room for, which also clears the bits of the keys that were removed, see dagdb_filter_rebuild.
+ */
+
+/** The number of 64 bit words in a block of the filter. */
+#define FILTER_BLOCK_WORDS (FILTER_BLOCK_SIZE / sizeof(uint64_t))
+
+/** Odd multipliers that select the bit in each word of a block from the lower half of the hash of a key. */
+static const uint32_t filter_salt[FILTER_BLOCK_WORDS] = {
+	0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d, 0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31,
+};
+
+/** Returns the hash of a key that is used by the filter. All bytes of the key contribute to it. */
+static inline uint64_t filter_hash(const uint8_t * key) {
+	uint64_t a, b, c;
+	memcpy(&a, key, sizeof(a));
+	memcpy(&b, key + sizeof(a), sizeof(b));
+	memcpy(&c, key + DAGDB_KEY_LENGTH - sizeof(c), sizeof(c));
+	uint64_t x = a * 0x9e3779b97f4a7c15ULL ^ b * 0xbf58476d1ce4e5b9ULL ^ c * 0x94d049bb133111ebULL;
+	return x ^ x >> 31;
+}
+
+/** Returns the block of the filter that is selected by the upper half of the given hash. */
+static inline uint64_t * filter_block(const Header * h, uint64_t hash) {
+	return LOCATE(uint64_t, h->filter) + ((hash >> 32) & (h->filter_blocks - 1)) * FILTER_BLOCK_WORDS;
+}
+
+/** Returns the bit that the given hash sets in the i-th word of its block. */
+static inline uint64_t filter_bit(uint64_t hash, uint_fast32_t i) {
+	return 1ULL << ((uint32_t)hash * filter_salt[i] >> 26);
+}
+
+/** Returns whether the bits of the given hash are set in the given block. */
+static inline int filter_has(const uint64_t * block, uint64_t hash) {
+	uint64_t missing = 0;
+	for (uint_fast32_t i=0; i<FILTER_BLOCK_WORDS; i++) missing |= filter_bit(hash, i) & ~block[i];
+	return missing == 0;
+}
+
+/** Sets the bits of the given key in the filter. */
+static inline void filter_add(const Header * h, const uint8_t * key) {
+	uint64_t hash = filter_hash(key);
+	uint64_t * block = filter_block(h, hash);
+	for (uint_fast32_t i=0; i<FILTER_BLOCK_WORDS; i++) block[i] |= filter_bit(hash, i);
+}
+
+/** Returns whether the given trie is the root trie and its filter shows that the given key is not in it. */
+static inline int filter_rejects(dagdb_pointer trie, const uint8_t * key) {
+	const Header * h = LOCATE(Header, 0);
+	if (trie != h->root || !h->filter) return 0;
+	uint64_t hash = filter_hash(key);
+	return !filter_has(filter_block(h, hash), hash);
+}
+
+/**
+ * The hash index
+ * INDEX_SHARDS shards, each an open addressing table of (mask + 1) slots in anonymous memory.
+ *
+ * The keys in the root trie can be indexed in memory when the database is loaded, see dagdb_options::index_threads. 
+ * The shard of a key is selected by its first nibble, which also selects the slot in the top of the root trie, 
+ * such that the shards can be built in parallel from disjoint parts of the trie. Within a shard, keys are placed 
+ * by the bytes that follow, using linear probing. A slot holds the element together with the fingerprint of its key, 
+ * as in the leaves of the trie, hence other keys in the probed slots rarely require reading their element. 
+ * Removals move the entries that follow back, instead of leaving tombstones.
+ */
+
+/** The number of shards of the hash index, one for each value of the first nibble of a key. */
+#define INDEX_SHARDS 16
+/** The number of slots of an empty shard. */
+#define INDEX_MIN_SLOTS 64
+
+STATIC_ASSERT(DAGDB_MAX_INDEX_THREADS <= INDEX_SHARDS, more_index_threads_than_shards);
+
+typedef struct {
+	dagdb_pointer * slot;
+	uint64_t mask;
+	uint64_t count;
+} IndexShard;
+
+/** The shards of the hash index, which are only used if dagdb_index_active is set. */
+static IndexShard dagdb_index[INDEX_SHARDS];
+static int dagdb_index_active;
+
+/** Returns the shard of the hash index that holds the given key. */
+static inline IndexShard * index_shard(const uint8_t * key) {
+	return dagdb_index + nibble(key, 0);
+}
+
+/** Returns the position of the given key in its shard, before it is reduced to the size of the shard. */
+static inline uint64_t index_position(const uint8_t * key) {
+	uint64_t r;
+	memcpy(&r, key + 1, sizeof(r));
+	return r;
+}
+
+/** Returns the slot of the given shard that holds the given key, or the empty slot where it would be added. */
+static inline dagdb_pointer * index_slot(const IndexShard * s, const uint8_t * key) {
+	dagdb_pointer fp = fingerprint(key);
+	for (uint64_t i = index_position(key);; i++) {
+		dagdb_pointer * slot = s->slot + (i & s->mask);
+		if (*slot == 0) return slot;
+		if ((*slot & FINGERPRINT_MASK) == fp && memcmp(key, obtain_key(*slot), DAGDB_KEY_LENGTH) == 0) return slot;
+	}
+}
+
+/** Stores the given entry, which consists of an element and the fingerprint of the given key, in an empty slot of the given shard. */
+static inline void index_place(IndexShard * s, dagdb_pointer entry, const uint8_t * key) {
+	uint64_t i = index_position(key);
+	while (s->slot[i & s->mask]) i++;
+	s->slot[i & s->mask] = entry;
+	s->count++;
+}
+
+/**
+ * Allocates the given number of slots for a shard of the hash index, moving its entries into these.
+ * Returns 0 on success, or -1 if memory allocation failed. This does not report the error, as it is 
+ * called by the threads that build the hash index.
+ */
+static int index_resize(IndexShard * s, uint64_t slots) {
+	IndexShard r = {calloc(slots, sizeof(dagdb_pointer)), slots - 1, 0};
+	if (!r.slot) return -1;
+	if (s->slot) {
+		for (uint64_t i = 0; i <= s->mask; i++) {
+			if (s->slot[i]) index_place(&r, s->slot[i], obtain_key(s->slot[i]));
+		}
+		free(s->slot);
+	}
+	*s = r;
+	return 0;
+}
+
+/** Returns the element with the given key in the hash index, or 0 if there is none. */
+static inline dagdb_pointer index_find(const uint8_t * key) {
+	return leaf_element(*index_slot(index_shard(key), key));
+}
+
+/**
+ * Adds the given element, whose key is not in the hash index, doubling its shard when it becomes 3/4 full.
+ * Returns 0 on success, or -1 if memory allocation failed.
+ */
+static int index_add(dagdb_pointer element) {
+	key k = obtain_key(element);
+	IndexShard * s = index_shard(k);
+	if (4 * (s->count + 1) > 3 * (s->mask + 1) && index_resize(s, 2 * (s->mask + 1))) return -1;
+	index_place(s, element | fingerprint(k), k);
+	return 0;
+}
+
+/** Returns the size of the hash index in memory, or 0 if there is none. */
+static dagdb_size dagdb_index_bytes() {
+	if (!dagdb_index_active) return 0;
+	dagdb_size r = 0;
+	for (uint_fast32_t i = 0; i < INDEX_SHARDS; i++) r += (dagdb_index[i].mask + 1) * sizeof(dagdb_pointer);
+	return r;
+}
+
+/**
+ * Removes the given key from the hash index. Each following entry of the same cluster is moved back into the 
+ * emptied slot, unless that slot precedes the slot it hashes to.
+ */
+static void index_remove(const uint8_t * key) {
+	IndexShard * s = index_shard(key);
+	uint64_t i = index_slot(s, key) - s->slot;
+	assert(s->slot[i]);
+	for (uint64_t j = i + 1; s->slot[j & s->mask]; j++) {
+		dagdb_pointer entry = s->slot[j & s->mask];
+		uint64_t home = index_position(obtain_key(entry));
+		if (((j - home) & s->mask) >= ((j - i) & s->mask)) {
+			s->slot[i & s->mask] = entry;
+			i = j;
+		}
+	}
+	s->slot[i & s->mask] = 0;
+	s->count--;
+}
+
+/**
+ * Returns the expected fraction of keys that are not in the root trie, whose lookup passes its filter, or 1 if there is no filter.
+ * Such a key selects a block at random, and passes it if each of the bits it selects in the words of that block are set.
+ */
+static double dagdb_filter_false_positive_rate() {
+	const Header * h = LOCATE(Header, 0);
+	if (!h->filter) return 1;
+	const uint64_t * word = LOCATE(uint64_t, h->filter);
+	double sum = 0;
+	for (dagdb_size b = 0; b < h->filter_blocks; b++) {
+		double p = 1;
+		for (uint_fast32_t i = 0; i < FILTER_BLOCK_WORDS; i++) {
+			p *= popcount4(*word++, 0, 0, 0) / 64.0;
+		}
+		sum += p;
+	}
+	return sum / h->filter_blocks;
+}
+
 /**
  * Retrieves the pointer associated with the given key.
+ * In a set this is the element, in a trie that maps keys to values this is the embedded kvpair.
  * If no value is associated, then 0 is returned.
  */
 dagdb_pointer dagdb_trie_find(dagdb_pointer trie, dagdb_key k)
 {
 	assert(trie>=HEADER_SIZE);
 	assert(dagdb_get_pointer_type(trie) == DAGDB_TYPE_TRIE);
-	
+	if (dagdb_index_active && trie == LOCATE(Header, 0)->root) return index_find(k);
+	if (filter_rejects(trie, k)) return 0;
+
 	// Traverse the trie.
-	for(uint_fast32_t i=0;i<2*DAGDB_KEY_LENGTH;i++) {
-		Trie* t = LOCATE(Trie, trie);
-		int_fast32_t n = nibble(k, i);
-		if (t->entry[n]==0) { 
+	uint_fast32_t w = SLOT_WIDTH(trie);
+	dagdb_pointer * slot = LOCATE(dagdb_pointer, trie) + top_index(k, top_nibbles(trie))*w;
+	while (dagdb_get_pointer_type(*slot) == DAGDB_TYPE_TRIE) {
+		Node* n = LOCATE(Node, *slot);
+		uint_fast32_t b = split_byte(k, n->index);
+		if (!node_has(n, b)) {
 			// Spot is empty, so return null pointer
 			return 0;
 		}
-		if (dagdb_get_pointer_type(t->entry[n]) == DAGDB_TYPE_TRIE) {
-			// Descend into the already existing sub-trie
-			trie = t->entry[n];
-		} else {
-			// Check if the element here has the same key.
-			key l = obtain_key(t->entry[n]);
-			int_fast32_t same = memcmp(k,l,DAGDB_KEY_LENGTH);
-			if (same == 0) return t->entry[n];
-			
-			// The key's differ, so the requested key is not in this trie.
-			return 0;
+		// Descend into the child.
+		slot = n->entry + node_index(n, b)*w;
+	}
+	if (*slot==0) return 0;
+
+	// A leaf with another fingerprint has another key.
+	if ((*slot & FINGERPRINT_MASK) != fingerprint(k)) return 0;
+
+	// Check if the element here has the same key.
+	key l = obtain_key(*slot);
+	int_fast32_t same = memcmp(k,l,DAGDB_KEY_LENGTH);
+	if (same == 0) return leaf_pointer(slot, w);
+
+	// The key's differ, so the requested key is not in this trie.
+	return 0;
+}
+
+/** The number of lookups that dagdb_trie_find_many keeps in flight. */
+#define FIND_MANY_WIDTH 16
+
+/** The load that a lookup of dagdb_trie_find_many waits for, which has been prefetched. */
+typedef enum {
+	FIND_FILTER, // The block of the root filter for the requested key.
+	FIND_SLOT, // The slot in the top or in a node.
+	FIND_NODE, // The index and bitmap of the node referred to by the slot.
+	FIND_LEAF, // The key of the element in the slot, which has the fingerprint of the requested key.
+} FindStage;
+
+/** The state of a lookup of dagdb_trie_find_many. */
+typedef struct {
+	FindStage stage;
+	dagdb_size i;
+	dagdb_pointer * slot;
+} FindState;
+
+/**
+ * Starts the lookup of the i-th key by prefetching its slot in the top of the trie, 
+ * or its block of the filter if the trie has one.
+ */
+static inline void find_start(FindState * s, dagdb_pointer * top, uint_fast32_t nibbles, int filtered, dagdb_key k, dagdb_size i, uint_fast32_t w) {
+	s->i = i;
+	s->slot = top + top_index(k, nibbles)*w;
+	if (filtered) {
+		s->stage = FIND_FILTER;
+		__builtin_prefetch(filter_block(LOCATE(Header, 0), filter_hash(k)));
+	} else {
+		s->stage = FIND_SLOT;
+		__builtin_prefetch(s->slot);
+	}
+}
+
+/**
+ * Performs the lookups of dagdb_trie_find for the given keys, storing the results in the given array.
+ * Each lookup is a chain of dependent loads, which all miss the cache if the trie is large. Hence, up to 
+ * FIND_MANY_WIDTH lookups are interleaved: every step of a lookup prefetches what its next step reads, 
+ * after which the other lookups are advanced while that load is in flight.
+ * Lookups in the hash index prefetch the slot of the key that is FIND_MANY_WIDTH keys ahead instead.
+ */
+void dagdb_trie_find_many(dagdb_pointer trie, dagdb_size count, const dagdb_key * keys, dagdb_pointer * results)
+{
+	assert(trie>=HEADER_SIZE);
+	assert(dagdb_get_pointer_type(trie) == DAGDB_TYPE_TRIE);
+	if (dagdb_index_active && trie == LOCATE(Header, 0)->root) {
+		for (dagdb_size i = 0; i < count; i++) {
+			if (i + FIND_MANY_WIDTH < count) {
+				const uint8_t * k = keys[i + FIND_MANY_WIDTH];
+				const IndexShard * s = index_shard(k);
+				__builtin_prefetch(s->slot + (index_position(k) & s->mask));
+			}
+			results[i] = index_find(keys[i]);
 		}
+		return;
+	}
+
+	uint_fast32_t w = SLOT_WIDTH(trie);
+	uint_fast32_t nibbles = top_nibbles(trie);
+	dagdb_pointer * top = LOCATE(dagdb_pointer, trie);
+	const Header * h = LOCATE(Header, 0);
+	int filtered = trie == h->root && h->filter;
+	FindState state[FIND_MANY_WIDTH];
+	uint_fast32_t active = 0;
+	dagdb_size next = 0;
+	while (active < FIND_MANY_WIDTH && next < count) {
+		find_start(&state[active++], top, nibbles, filtered, keys[next], next, w);
+		next++;
+	}
+	uint_fast32_t j = 0;
+	while (active) {
+		FindState * s = &state[j];
+		const uint8_t * k = keys[s->i];
+		dagdb_pointer p = s->stage == FIND_FILTER ? 0 : *s->slot;
+		int done = 0;
+		switch (s->stage) {
+			case FIND_FILTER: {
+				uint64_t hash = filter_hash(k);
+				if (filter_has(filter_block(h, hash), hash)) {
+					__builtin_prefetch(s->slot);
+					s->stage = FIND_SLOT;
+				} else {
+					results[s->i] = 0;
+					done = 1;
+				}
+				break;
+			}
+			case FIND_SLOT:
+				if (dagdb_get_pointer_type(p) == DAGDB_TYPE_TRIE) {
+					__builtin_prefetch(LOCATE(Node, p));
+					s->stage = FIND_NODE;
+				} else if (p && (p & FINGERPRINT_MASK) == fingerprint(k)) {
+					__builtin_prefetch(obtain_key(p));
+					s->stage = FIND_LEAF;
+				} else {
+					results[s->i] = 0;
+					done = 1;
+				}
+				break;
+			case FIND_NODE: {
+				Node* n = LOCATE(Node, p);
+				uint_fast32_t b = split_byte(k, n->index);
+				if (node_has(n, b)) {
+					s->slot = n->entry + node_index(n, b)*w;
+					__builtin_prefetch(s->slot);
+					s->stage = FIND_SLOT;
+				} else {
+					results[s->i] = 0;
+					done = 1;
+				}
+				break;
+			}
+			case FIND_LEAF:
+				results[s->i] = memcmp(k, obtain_key(p), DAGDB_KEY_LENGTH) ? 0 : leaf_pointer(s->slot, w);
+				done = 1;
+				break;
+		}
+		if (done) {
+			if (next < count) {
+				// Reuse the state for the next key.
+				find_start(s, top, nibbles, filtered, keys[next], next, w);
+				next++;
+			} else {
+				// Move the last lookup into this state.
+				*s = state[--active];
+				if (j == active) j = 0;
+				continue;
+			}
+		}
+		if (++j == active) j = 0;
 	}
-	UNREACHABLE;
 }
 
 /**
- * Inserts the given pointer into the trie.
- * The pointer must be an Element or KVPair.
- * Returns 1 if the element is indeed added to the trie.
- * Returns 0 if the element was already in the trie.
- * Returns -1 if the element is not in the trie and an error occured
- * while trying to add it.
+ * Inserts the given leaf, which consists of as many pointers as a slot of the trie, into the trie.
+ * @see dagdb_trie_insert
  */
-int dagdb_trie_insert(dagdb_pointer trie, dagdb_pointer pointer)
+static int dagdb_trie_insert_leaf(dagdb_pointer trie, const dagdb_pointer * leaf)
 {
 	assert(trie>=HEADER_SIZE);
-	assert(pointer>=HEADER_SIZE);
 	assert(dagdb_get_pointer_type(trie) == DAGDB_TYPE_TRIE);
-	
-	key k = obtain_key(pointer);
-	
-	// Traverse the trie.
-	for(uint_fast32_t i=0;i<2*DAGDB_KEY_LENGTH;i++) {
-		Trie* t = LOCATE(Trie, trie);
-		int_fast32_t n = nibble(k, i);
-		if (t->entry[n]==0) { 
+
+	uint_fast32_t w = SLOT_WIDTH(trie);
+	uint_fast32_t nibbles = top_nibbles(trie);
+	assert(leaf_element(leaf[0]) == leaf[0]);
+	key k = obtain_key(leaf[0]);
+	// The element is stored together with the fingerprint of its key.
+	const dagdb_pointer tagged[2] = {leaf[0] | fingerprint(k), w == 2 ? leaf[1] : 0};
+	leaf = tagged;
+	dagdb_pointer * top = LOCATE(dagdb_pointer, trie) + top_index(k, nibbles)*w;
+	if (*top == 0) {
+		// Spot is empty, so we can insert it here.
+		memcpy(top, leaf, w * S);
+		return 1;
+	}
+
+	// Descend along the key. As long as no nibbles were skipped, the key equals the keys below the 
+	// current node up to the nibbles it splits on, hence it can be inserted without comparing keys.
+	// The first node below the top splits on the nibbles after it.
+	dagdb_pointer * slot = top;
+	uint_fast32_t unskipped = nibbles;
+	while (dagdb_get_pointer_type(*slot) == DAGDB_TYPE_TRIE) {
+		Node* n = LOCATE(Node, *slot);
+		uint_fast32_t b = split_byte(k, n->index);
+		if (!node_has(n, b)) {
+			if (n->index != unskipped) break;
 			// Spot is empty, so we can insert it here.
-			t->entry[n] = pointer;
+			if (dagdb_node_insert(slot, b, leaf, w)) {
+				// An error occured. Use dagdb_last_error() to obtain the reason.
+				return -1;
+			}
 			return 1;
 		}
-		if (dagdb_get_pointer_type(t->entry[n]) == DAGDB_TYPE_TRIE) {
-			// Descend into the already existing sub-trie
-			trie = t->entry[n];
-		} else {
-			// Check if the element here has the same key.
-			key l = obtain_key(t->entry[n]);
-			int_fast32_t same = memcmp(k,l,DAGDB_KEY_LENGTH);
-			if (same == 0) return 0;
-			
-			// Create new tries until we have a differing nibble
-			int_fast32_t m = nibble(l,i);
-			while (n == m) {
-				dagdb_pointer newtrie = dagdb_trie_create();
-				if (!newtrie) {
-					// An error occured. Use dagdb_last_error() to obtain the reason.
-					return -1;
-				}
-				Trie*  t2 = LOCATE(Trie, newtrie);
-				i++;
-				
-				// Push the existing element's pointer into the new trie.
-				m = nibble(l,i);
-				t2->entry[m] = t->entry[n];
-				t->entry[n] = newtrie;
-				n = nibble(k,i);
-				t = t2;
+		// Descend into the child.
+		unskipped = n->index == unskipped ? unskipped + 2 : 0;
+		slot = n->entry + node_index(n, b)*w;
+	}
+
+	// Find a leaf that shares the longest prefix with the key. Where the key has no child in a node, 
+	// any child will do, as it differs from all keys below that node in the byte the node splits on.
+	dagdb_pointer p = *slot;
+	while (dagdb_get_pointer_type(p) == DAGDB_TYPE_TRIE) {
+		p = LOCATE(Node, p)->entry[0];
+	}
+
+	// Check if the element here has the same key.
+	key l = obtain_key(p);
+	uint_fast32_t d = first_difference(k, l);
+	if (d == 2*DAGDB_KEY_LENGTH) return 0;
+	// The index of the pair of nibbles that contains the first difference.
+	uint_fast32_t index = pair_index(d, nibbles);
+
+	// Descend to where the key leaves the path to that leaf, keeping track of the slot that 
+	// refers to the current node, as nodes can move when they are enlarged.
+	dagdb_pointer parent = trie;
+	slot = top;
+	while (dagdb_get_pointer_type(*slot) == DAGDB_TYPE_TRIE) {
+		Node* n = LOCATE(Node, *slot);
+		if (n->index > index) break;
+		uint_fast32_t b = split_byte(k, n->index);
+		if (n->index == index) {
+			// Spot is empty, so we can insert it here.
+			assert(!node_has(n, b));
+			if (dagdb_node_insert(slot, b, leaf, w)) {
+				// An error occured. Use dagdb_last_error() to obtain the reason.
+				return -1;
 			}
-			t->entry[n] = pointer;
 			return 1;
 		}
+		// Descend into the child.
+		assert(node_has(n, b));
+		parent = *slot;
+		slot = n->entry + node_index(n, b)*w;
+	}
+
+	// Create a node that splits the leaf or node in this slot from the new leaf.
+	// It is placed close to its parent. Root tables of more than two nibbles are stored in an extent, 
+	// which cannot serve as a hint, hence the node is then placed close to its first child.
+	uint_fast32_t a = split_byte(l, index);
+	uint_fast32_t b = split_byte(k, index);
+	assert(a != b);
+	dagdb_pointer hint = parent != trie || nibbles <= 2 ? parent : 0;
+	dagdb_pointer newnode = dagdb_node_create(hint, index, 2, w);
+	if (!newnode) {
+		// An error occured. Use dagdb_last_error() to obtain the reason.
+		return -1;
+	}
+	Node* n = LOCATE(Node, newnode);
+	n->bitmap[a>>6] |= 1ULL << (a&63);
+	n->bitmap[b>>6] |= 1ULL << (b&63);
+	memcpy(n->entry + (a > b)*w, slot, w * S);
+	memcpy(n->entry + (a < b)*w, leaf, w * S);
+	memset(slot, 0, w * S);
+	*slot = newnode;
+	return 1;
+}
+
+/**
+ * Inserts the given element into the set.
+ * Returns 1 if the element is indeed added to the trie.
+ * Returns 0 if the element was already in the trie.
+ * Returns -1 if the element is not in the trie and an error occured
+ * while trying to add it.
+ * The key of an element that is added to the root trie is also added to its filter. The filter is rebuilt 
+ * when it is full. If that fails, the filter is dropped, see dagdb_filter_rebuild.
+ * The element is also added to the hash index. If that fails, the hash index is dropped.
+ */
+int dagdb_trie_insert(dagdb_pointer trie, dagdb_pointer pointer)
+{
+	assert(pointer>=HEADER_SIZE);
+	assert(!(trie & DAGDB_TRIE_PAIRS));
+	int r = dagdb_trie_insert_leaf(trie, &pointer);
+	Header * h = LOCATE(Header, 0);
+	if (r == 1 && trie == h->root && dagdb_index_active && index_add(pointer)) {
+		// Lookups walk the trie again.
+		dagdb_index_free();
+	}
+	if (r == 1 && trie == h->root && h->filter_bits_per_key) {
+		if (h->filter && h->filter_keys < h->filter_blocks * FILTER_BLOCK_SIZE * 8 / h->filter_bits_per_key) {
+			filter_add(h, obtain_key(pointer));
+			h->filter_keys++;
+		} else if (dagdb_filter_rebuild(h->filter_bits_per_key)) {
+			// The new filter, which would include the element, could not be built.
+			// The database continues without one, such that lookups walk the trie.
+			assert(LOCATE(Header, 0)->filter_bits_per_key == 0);
+		}
 	}
-	UNREACHABLE;
+	return r;
+}
+
+/**
+ * Embeds the pair of given key element and value into the trie that maps keys to values.
+ * The return value is that of dagdb_trie_insert. If the key was already in the trie, its value is not changed.
+ */
+int dagdb_trie_insert_pair(dagdb_pointer trie, dagdb_pointer key, dagdb_pointer value)
+{
+	assert(key>=HEADER_SIZE);
+	assert(trie & DAGDB_TRIE_PAIRS);
+	dagdb_pointer leaf[2] = {key, value};
+	return dagdb_trie_insert_leaf(trie, leaf);
 }
 
 /**
  * Erases the value associated with the given key in this trie.
  * If no value is associated, then this function will do nothing.
  * Returns 1 if the key-value pair is erased from the trie, and 0 otherwise.
- * TODO: remove trie if empty.
+ * A node that is left with a single child is replaced by that child, see dagdb_node_erase.
+ * The bits of a key that is removed from the root trie remain set in its filter until it is rebuilt.
+ * The key is removed from the hash index.
  */
 int dagdb_trie_remove(dagdb_pointer trie, dagdb_key k)
 {
 	assert(trie>=HEADER_SIZE);
 	assert(dagdb_get_pointer_type(trie) == DAGDB_TYPE_TRIE);
-	
-	// Traverse the trie.
-	for(uint_fast32_t i=0;i<2*DAGDB_KEY_LENGTH;i++) {
-		Trie* t = LOCATE(Trie, trie);
-		int_fast32_t n = nibble(k, i);
-		if (t->entry[n]==0) { 
-			// Spot is empty, so return null pointer
-			return 0;
-		}
-		if (dagdb_get_pointer_type(t->entry[n]) == DAGDB_TYPE_TRIE) {
-			// Descend into the already existing sub-trie
-			trie = t->entry[n];
-		} else {
-			// Check if the element here has the same key.
-			key l = obtain_key(t->entry[n]);
-			int_fast32_t same = memcmp(k,l,DAGDB_KEY_LENGTH);
-			if (same == 0) {
-				t->entry[n] = 0;
-				return 1;
-			}
-			
-			// The key's differ, so the requested key is not in this trie.
+
+	// Traverse the trie, keeping track of the slot that refers to the node containing the current slot.
+	uint_fast32_t w = SLOT_WIDTH(trie);
+	dagdb_pointer * parent = NULL;
+	dagdb_pointer * slot = LOCATE(dagdb_pointer, trie) + top_index(k, top_nibbles(trie))*w;
+	uint_fast32_t b = 0;
+	while (dagdb_get_pointer_type(*slot) == DAGDB_TYPE_TRIE) {
+		Node* n = LOCATE(Node, *slot);
+		b = split_byte(k, n->index);
+		if (!node_has(n, b)) {
+			// Spot is empty, so there is nothing to remove.
 			return 0;
 		}
+		// Descend into the child.
+		parent = slot;
+		slot = n->entry + node_index(n, b)*w;
+	}
+	if (*slot == 0) return 0;
+
+	// Check if the element here has the same key.
+	if ((*slot & FINGERPRINT_MASK) != fingerprint(k)) return 0;
+	key l = obtain_key(*slot);
+	int_fast32_t same = memcmp(k,l,DAGDB_KEY_LENGTH);
+	if (same != 0) {
+		// The key's differ, so the requested key is not in this trie.
+		return 0;
+	}
+	if (dagdb_index_active && trie == LOCATE(Header, 0)->root) index_remove(k);
+	if (parent) {
+		dagdb_node_erase(parent, b, w);
+	} else {
+		memset(slot, 0, w * S);
 	}
-	UNREACHABLE;
+	return 1;
 }
 
 dagdb_pointer dagdb_root()
@@ -432,41 +1229,103 @@ dagdb_pointer dagdb_root()
 	Header*  h = LOCATE(Header, 0);
 	// Lazily create root trie.
 	if (h->root==0) {
-		// Create the root trie.
-		h->root=dagdb_trie_create();
+		// Create the root trie, with a table as top if the database was created with one.
+		h->root=dagdb_trie_create_top(0, h->root_nibbles, 1);
 	}
 	assert(h->root>=HEADER_SIZE);
 	assert(dagdb_get_pointer_type(h->root) == DAGDB_TYPE_TRIE);
 	return h->root;
 }
 
+/**
+ * Returns the number of nodes that are traversed below the top of the trie when looking up the given key.
+ */
+static uint_fast32_t dagdb_trie_depth(dagdb_pointer trie, dagdb_key k)
+{
+	uint_fast32_t depth = 0;
+	uint_fast32_t w = SLOT_WIDTH(trie);
+	dagdb_pointer p = LOCATE(dagdb_pointer, trie)[top_index(k, top_nibbles(trie))*w];
+	while (dagdb_get_pointer_type(p) == DAGDB_TYPE_TRIE) {
+		depth++;
+		Node* n = LOCATE(Node, p);
+		uint_fast32_t b = split_byte(k, n->index);
+		if (!node_has(n, b)) break;
+		p = n->entry[node_index(n, b)*w];
+	}
+	return depth;
+}
+
+STATIC_ASSERT(DAGDB_STATS_DEPTH_BUCKETS > DAGDB_KEY_LENGTH, depth_histogram_too_small);
+
+/**
+ * Collects statistics about the storage of the database.
+ * The trie depth histogram is obtained by looking up the given number of pseudo-random keys in the root trie.
+ * The keys are the same for each call, such that the results of different databases can be compared.
+ */
+void dagdb_stats(dagdb_statistics * stats, uint_fast32_t samples)
+{
+	dagdb_memory_stats(stats);
+	const Header * h = LOCATE(Header, 0);
+	stats->filter_bits_per_key = h->filter_bits_per_key;
+	stats->filter_bytes = h->filter_blocks * FILTER_BLOCK_SIZE;
+	stats->filter_keys = h->filter_keys;
+	stats->filter_false_positive_rate = dagdb_filter_false_positive_rate();
+	stats->index_bytes = dagdb_index_bytes();
+	memset(stats->trie_depth, 0, sizeof(stats->trie_depth));
+	dagdb_pointer root = h->root;
+	if (root == 0) return;
+	uint64_t state = 0;
+	for(uint_fast32_t s=0; s<samples; s++) {
+		// Generate a key using splitmix64.
+		uint8_t k[DAGDB_KEY_LENGTH];
+		for(uint_fast32_t j=0; j<DAGDB_KEY_LENGTH; j+=sizeof(uint64_t)) {
+			uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			z ^= z >> 31;
+			memcpy(k + j, &z, DAGDB_KEY_LENGTH - j < sizeof(z) ? DAGDB_KEY_LENGTH - j : sizeof(z));
+		}
+		stats->trie_depth[dagdb_trie_depth(root, k)]++;
+	}
+}
+
 
 ///////////////
 // Iterators //
 ///////////////
 
+/**
+ * Maximum depth of the iterator stack: the top of the trie, followed by a node for every two nibbles of the key.
+ */
+#define ITERATOR_DEPTH (DAGDB_KEY_LENGTH+1)
+
 struct dagdb_iterator {
 	int32_t depth;
-	int32_t location[DAGDB_KEY_LENGTH*2];
-	dagdb_pointer tries[DAGDB_KEY_LENGTH*2];
+	int32_t location[ITERATOR_DEPTH];
+	dagdb_pointer tries[ITERATOR_DEPTH];
 };
 
 typedef uint64_t dagdb_handle;
 typedef struct dagdb_iterator dagdb_iterator;
 
-/** Creates an iterator for the given record, map or set. */
+/** 
+ * Creates an iterator for the given record, map or set. 
+ * Handle 0, which is returned for the backref of an element that nothing refers to, gives an empty iterator.
+ */
 dagdb_iterator* dagdb_iterator_create(dagdb_handle src) {
 	if (dagdb_get_pointer_type(src) == DAGDB_TYPE_ELEMENT) {
 		src = dagdb_element_data(src); // Record
+		if (!src) return NULL; // Inline bytes.
 	}
 	if (
+		src != 0 && // Empty backref.
 		dagdb_get_pointer_type(src) != DAGDB_TYPE_TRIE // Backref or set.
 	) return NULL;
 	dagdb_iterator * r = (dagdb_iterator*)malloc(sizeof(dagdb_iterator));
 	
 	if (!r) return NULL;
 	r->location[0] = -1;
-	r->depth=0;
+	r->depth = src ? 0 : -1;
 	r->tries[0] = src;
 	return r;
 }
@@ -476,6 +1335,24 @@ void dagdb_iterator_destroy(dagdb_iterator * it) {
 	free(it);
 }
 
+/**
+ * Returns the slot the iterator currently points to.
+ * At depth 0 this is a slot of the top of the trie, otherwise one of a node.
+ */
+static dagdb_pointer * dagdb_iterator_slot(dagdb_iterator * it) {
+	assert(it->depth>=0);
+	assert(it->depth<ITERATOR_DEPTH);
+	assert(it->location[it->depth]>=0);
+	uint_fast32_t w = SLOT_WIDTH(it->tries[0]);
+	if (it->depth == 0) {
+		assert((uint_fast32_t)it->location[0]<TOP_SLOTS(top_nibbles(it->tries[0])));
+		return LOCATE(dagdb_pointer, it->tries[0]) + it->location[0]*w;
+	}
+	Node* n = LOCATE(Node, it->tries[it->depth]);
+	assert((uint_fast32_t)it->location[it->depth]<node_count(n));
+	return n->entry + it->location[it->depth]*w;
+}
+
 /**
  * Advances the iterator pointer. 
  * 
@@ -487,28 +1364,28 @@ void dagdb_iterator_destroy(dagdb_iterator * it) {
  */
 int dagdb_iterator_advance(dagdb_iterator * it) {
 	assert(it);
+	if (it->depth<0) return 0; // Empty or exhausted.
 	advance:
 	assert(it->depth>=0);
-	assert(it->depth<DAGDB_KEY_LENGTH*2);
+	assert(it->depth<ITERATOR_DEPTH);
 	it->location[it->depth]++;
 	assert(it->location[it->depth]>=0);
-	if (it->location[it->depth]>=16) {
+	int32_t count = it->depth ? node_count(LOCATE(Node, it->tries[it->depth])) : TOP_SLOTS(top_nibbles(it->tries[0]));
+	if (it->location[it->depth]>=count) {
 		// Current trie exhausted, pop one from the stack and continue.
-		assert(it->location[it->depth]==16);
+		assert(it->location[it->depth]==count);
 		it->depth--;
 		if (it->depth<0) return 0;
 		goto advance; // at most it->depth times.
 	}
-	assert(it->depth>=0);
-	assert(it->depth<DAGDB_KEY_LENGTH*2);
-	Trie* t = LOCATE(Trie, it->tries[it->depth]);
-	dagdb_pointer ptr = t->entry[it->location[it->depth]] ;
+	dagdb_pointer ptr = *dagdb_iterator_slot(it);
 	// Check if filled.
 	if (ptr==0) goto advance;
 	// Check if another tries
 	if (dagdb_get_pointer_type(ptr)==DAGDB_TYPE_TRIE) {
 		// Descend 
 		it->depth++;
+		assert(it->depth<ITERATOR_DEPTH);
 		it->location[it->depth]=-1;
 		it->tries[it->depth]=ptr;
 		goto advance;
@@ -517,30 +1394,544 @@ int dagdb_iterator_advance(dagdb_iterator * it) {
 	return -1;
 }
 
+/** Returns the element in the current slot, or the key of the pair in it. */
 dagdb_handle dagdb_iterator_key(dagdb_iterator * it) {
 	assert(it);
-	assert(it->depth>=0);
-	assert(it->depth<DAGDB_KEY_LENGTH*2);
-	assert(it->location[it->depth]>=0);
-	assert(it->location[it->depth]<16);
-	Trie* t = LOCATE(Trie, it->tries[it->depth]);
-	dagdb_pointer ptr = t->entry[it->location[it->depth]] ;
-	assert(dagdb_get_pointer_type(ptr)!=DAGDB_TYPE_TRIE);
-	assert(dagdb_get_pointer_type(ptr)!=DAGDB_TYPE_DATA);
-	if (dagdb_get_pointer_type(ptr)==DAGDB_TYPE_KVPAIR) return dagdb_kvpair_key(ptr);
+	dagdb_pointer ptr = leaf_element(dagdb_iterator_slot(it)[0]);
+	assert(dagdb_get_pointer_type(ptr)==DAGDB_TYPE_ELEMENT);
 	return ptr;
 }
 
+/** Returns the element in the current slot, or the value of the pair in it. */
 dagdb_handle dagdb_iterator_value(dagdb_iterator * it) {
 	assert(it);
-	assert(it->depth>=0);
-	assert(it->depth<DAGDB_KEY_LENGTH*2);
-	assert(it->location[it->depth]>=0);
-	assert(it->location[it->depth]<16);
-	Trie* t = LOCATE(Trie, it->tries[it->depth]);
-	dagdb_pointer ptr = t->entry[it->location[it->depth]] ;
-	assert(dagdb_get_pointer_type(ptr)!=DAGDB_TYPE_TRIE);
-	assert(dagdb_get_pointer_type(ptr)!=DAGDB_TYPE_DATA);
-	if (dagdb_get_pointer_type(ptr)==DAGDB_TYPE_KVPAIR) return dagdb_kvpair_value(ptr);
-	return ptr;
+	uint_fast32_t w = SLOT_WIDTH(it->tries[0]);
+	dagdb_pointer * slot = dagdb_iterator_slot(it);
+	return w == 1 ? leaf_element(slot[0]) : slot[1];
+}
+
+/////////////////
+// Root filter //
+/////////////////
+
+/** The number of keys a newly built filter has room for at least. */
+#define FILTER_MIN_KEYS 4096
+
+/**
+ * Rebuilds the filter of the root trie with the given number of bits per key, which is stored in the database.
+ * The new filter has room for at least twice the number of keys in the root trie, such that it is rebuilt 
+ * after that number has doubled. The bits of keys that were removed are cleared. 
+ * If the given number of bits is 0, the filter is removed instead.
+ * Returns 0 on success, or -1 in case of an error, after which the database has no filter
+ * until this function succeeds.
+ */
+int dagdb_filter_rebuild(uint32_t bits_per_key) {
+	if (bits_per_key > DAGDB_MAX_FILTER_BITS_PER_KEY) {
+		dagdb_errno = DAGDB_ERROR_BAD_ARGUMENT;
+		dagdb_report("Invalid filter size of %u bits per key", bits_per_key);
+		return -1;
+	}
+	Header * h = LOCATE(Header, 0);
+	if (h->filter) dagdb_free(h->filter, h->filter_blocks * FILTER_BLOCK_SIZE);
+	h->filter = 0;
+	h->filter_blocks = 0;
+	h->filter_keys = 0;
+	h->filter_bits_per_key = 0;
+	if (bits_per_key == 0) return 0;
+
+	// Count the keys in the root trie.
+	dagdb_pointer root = dagdb_root();
+	dagdb_size count = 0;
+	dagdb_iterator * it = dagdb_iterator_create(root);
+	if (!it) goto oom;
+	while (dagdb_iterator_advance(it)) count++;
+	dagdb_iterator_destroy(it);
+
+	// Allocate a power of two number of blocks.
+	dagdb_size keys = 2 * count > FILTER_MIN_KEYS ? 2 * count : FILTER_MIN_KEYS;
+	dagdb_size blocks = FILTER_MIN_BLOCKS;
+	while (blocks * FILTER_BLOCK_SIZE * 8 < keys * bits_per_key) blocks *= 2;
+	dagdb_pointer filter = dagdb_malloc_typed(blocks * FILTER_BLOCK_SIZE, DAGDB_TYPE_DATA);
+	if (!filter) return -1;
+	memset(LOCATE(void, filter), 0, blocks * FILTER_BLOCK_SIZE);
+	h = LOCATE(Header, 0);
+
+	// Add the keys.
+	it = dagdb_iterator_create(root);
+	if (!it) {
+		dagdb_free(filter, blocks * FILTER_BLOCK_SIZE);
+		goto oom;
+	}
+	h->filter = filter;
+	h->filter_blocks = blocks;
+	while (dagdb_iterator_advance(it)) {
+		filter_add(h, LOCATE(Element, dagdb_iterator_key(it))->key);
+	}
+	dagdb_iterator_destroy(it);
+	h->filter_keys = count;
+	h->filter_bits_per_key = bits_per_key;
+	return 0;
+
+	oom:
+	dagdb_errno = DAGDB_ERROR_OTHER;
+	dagdb_report_p("Cannot allocate iterator");
+	return -1;
+}
+
+////////////////
+// Hash index //
+////////////////
+
+/** The state that is shared by the threads that build the hash index. */
+typedef struct {
+	dagdb_pointer root;
+	uint_fast32_t nibbles;
+	uint32_t next_shard;
+	uint32_t failed;
+} IndexBuild;
+
+/** Returns the number of leaves in the given slot of the root trie. Only the nodes are read. */
+static uint64_t index_count(dagdb_pointer p) {
+	if (dagdb_get_pointer_type(p) != DAGDB_TYPE_TRIE) return p != 0;
+	Node * n = LOCATE(Node, p);
+	uint64_t r = 0;
+	for (uint_fast32_t i = 0; i < node_count(n); i++) r += index_count(n->entry[i]);
+	return r;
+}
+
+/** Adds the leaves in the given slot of the root trie to the given shard, which has room for them. */
+static void index_fill(IndexShard * s, dagdb_pointer p) {
+	if (dagdb_get_pointer_type(p) == DAGDB_TYPE_TRIE) {
+		Node * n = LOCATE(Node, p);
+		for (uint_fast32_t i = 0; i < node_count(n); i++) index_fill(s, n->entry[i]);
+	} else if (p) {
+		// The leaf already carries the fingerprint of its key.
+		index_place(s, p, obtain_key(p));
+	}
+}
+
+/**
+ * Builds the shards of the hash index that are claimed from the given build, until none are left. 
+ * The keys of a shard are in the slots of the top of the root trie that start with its nibble.
+ */
+static void * index_build_shards(void * arg) {
+	IndexBuild * b = arg;
+	uint_fast32_t i;
+	while ((i = __sync_fetch_and_add(&b->next_shard, 1)) < INDEX_SHARDS) {
+		IndexShard * s = dagdb_index + i;
+		uint_fast32_t slots = TOP_SLOTS(b->nibbles) / INDEX_SHARDS;
+		const dagdb_pointer * top = b->root ? LOCATE(dagdb_pointer, b->root) + i * slots : NULL;
+		uint64_t count = 0;
+		for (uint_fast32_t j = 0; top && j < slots; j++) count += index_count(top[j]);
+		uint64_t size = INDEX_MIN_SLOTS;
+		while (4 * count > 3 * size) size *= 2;
+		if (index_resize(s, size)) {
+			__sync_fetch_and_or(&b->failed, 1);
+			continue;
+		}
+		for (uint_fast32_t j = 0; top && j < slots; j++) index_fill(s, top[j]);
+	}
+	return NULL;
+}
+
+/**
+ * Builds the hash index of the keys in the root trie using the given number of threads, including the calling thread.
+ * The threads claim the shards one by one, such that these are balanced if the shards differ in size.
+ * Returns 0 on success, or -1 in case of an error, after which there is no hash index.
+ * @see dagdb_options::index_threads
+ */
+int dagdb_index_build(uint32_t threads) {
+	assert(threads >= 1 && threads <= DAGDB_MAX_INDEX_THREADS);
+	dagdb_index_free();
+	const Header * h = LOCATE(Header, 0);
+	IndexBuild b = {h->root, h->root_nibbles, 0, 0};
+	pthread_t thread[DAGDB_MAX_INDEX_THREADS];
+	uint32_t started = 0;
+	while (started + 1 < threads && !pthread_create(&thread[started], NULL, index_build_shards, &b)) started++;
+	// If fewer threads could be started, the remaining shards are built by this thread.
+	index_build_shards(&b);
+	for (uint32_t t = 0; t < started; t++) pthread_join(thread[t], NULL);
+	if (b.failed) {
+		dagdb_index_free();
+		dagdb_errno = DAGDB_ERROR_OTHER;
+		dagdb_report("Cannot allocate hash index");
+		return -1;
+	}
+	dagdb_index_active = 1;
+	return 0;
+}
+
+/** Releases the memory of the hash index, after which lookups in the root trie walk the trie. */
+void dagdb_index_free() {
+	for (uint_fast32_t i = 0; i < INDEX_SHARDS; i++) free(dagdb_index[i].slot);
+	memset(dagdb_index, 0, sizeof(dagdb_index));
+	dagdb_index_active = 0;
+}
+
+////////////////
+// Compaction //
+////////////////
+
+/**
+ * State of a compaction.
+ * The source database is mapped read-only, while the destination database is the loaded database.
+ * The pointer map is an open addressing hash table that maps the pointers of the source database to 
+ * the pointers of their copies. Its entries are pairs of source and destination pointer.
+ */
+typedef struct {
+	const char * file;
+	dagdb_size size;
+	dagdb_pointer * map;
+	uint64_t capacity;
+	uint64_t count;
+} Compaction;
+
+/** Returns the slot in the pointer map where the given source pointer is or should be stored. */
+static dagdb_pointer * dagdb_compact_slot(Compaction * c, dagdb_pointer old) {
+	uint64_t i = (old * 0x9e3779b97f4a7c15ULL) >> 32;
+	for (;; i++) {
+		dagdb_pointer * slot = c->map + 2 * (i & (c->capacity - 1));
+		if (slot[0] == old || slot[0] == 0) return slot;
+	}
+}
+
+/** Adds a pair to the pointer map, doubling its capacity when it becomes half full. */
+static int dagdb_compact_map(Compaction * c, dagdb_pointer old, dagdb_pointer new) {
+	if (2 * (c->count + 1) > c->capacity) {
+		Compaction d = *c;
+		d.capacity = c->capacity ? 2 * c->capacity : 1024;
+		d.map = calloc(d.capacity, 2 * sizeof(dagdb_pointer));
+		if (!d.map) {
+			dagdb_errno = DAGDB_ERROR_OTHER;
+			dagdb_report_p("Cannot allocate pointer map");
+			return -1;
+		}
+		for (uint64_t i = 0; i < c->capacity; i++) {
+			if (c->map[2*i]) memcpy(dagdb_compact_slot(&d, c->map[2*i]), c->map + 2*i, 2 * sizeof(dagdb_pointer));
+		}
+		free(c->map);
+		*c = d;
+	}
+	dagdb_pointer * slot = dagdb_compact_slot(c, old);
+	assert(slot[0] == 0);
+	slot[0] = old;
+	slot[1] = new;
+	c->count++;
+	return 0;
+}
+
+/**
+ * Returns the structure at the given location in the source database, 
+ * or NULL if the structure would not fit in the source database.
+ */
+static const void * dagdb_compact_locate(Compaction * c, dagdb_pointer location, dagdb_size length) {
+	location &= ~DAGDB_TYPE_MASK;
+	if (location < HEADER_SIZE || location > c->size || c->size - location < length) {
+		dagdb_errno = DAGDB_ERROR_INVALID_DB;
+		dagdb_report("Pointer %lx is out of bounds", location);
+		return NULL;
+	}
+	return c->file + location;
+}
+
+/** Returns the allocated length of the structure at the given location in the source database, or 0 if it is invalid. */
+static dagdb_size dagdb_compact_length(Compaction * c, dagdb_pointer location) {
+	switch (dagdb_get_pointer_type(location)) {
+		case DAGDB_TYPE_DATA: {
+			const Data * d = dagdb_compact_locate(c, location, sizeof(Data));
+			if (!d || d->length > c->size - sizeof(Data)) return 0;
+			return sizeof(Data) + d->length;
+		}
+		case DAGDB_TYPE_ELEMENT: {
+			const Element * e = dagdb_compact_locate(c, location, sizeof(Element));
+			if (!e || (e->info & ELEMENT_INLINE && (e->info & ELEMENT_LENGTH_MASK) > DAGDB_MAX_INLINE_LENGTH)) return 0;
+			return element_size(e->info);
+		}
+		case DAGDB_TYPE_TRIE:    return TOP_SIZE(SLOT_WIDTH(location)); // The top of a trie, nodes use dagdb_compact_node_length.
+		case DAGDB_TYPE_KVPAIR:  return 0; // Pairs are embedded in tries, hence never referenced.
+		default: UNREACHABLE;
+	}
+}
+
+/**
+ * Returns the allocated length of the trie node with slots of w pointers at the given location in the source database, 
+ * or 0 if it is invalid.
+ */
+static dagdb_size dagdb_compact_node_length(Compaction * c, dagdb_pointer location, uint_fast32_t w) {
+	const Node * n = dagdb_compact_locate(c, location, sizeof(Node));
+	if (!n) return 0;
+	return NODE_SIZE(node_count(n), w);
+}
+
+/**
+ * Copies a single structure of the given length of the source database into the destination database, 
+ * without rewriting its pointers. A length of 0 denotes an invalid structure.
+ * Returns the new location, or 0 in case of an error.
+ */
+static dagdb_pointer dagdb_compact_copy(Compaction * c, dagdb_pointer location, dagdb_size length) {
+	const void * src = length ? dagdb_compact_locate(c, location, length) : NULL;
+	if (!src) {
+		dagdb_errno = DAGDB_ERROR_INVALID_DB;
+		dagdb_report("Structure at %lx is invalid", location);
+		return 0;
+	}
+	dagdb_pointer type = dagdb_get_pointer_type(location);
+	dagdb_pointer r = dagdb_malloc_typed(length, type);
+	if (!r) return 0;
+	memcpy(LOCATE(void, r), src, length);
+	r |= location & DAGDB_TYPE_MASK;
+	if (dagdb_compact_map(c, location, r)) return 0;
+	return r;
+}
+
+static int dagdb_compact_owned(Compaction * c, dagdb_pointer location);
+
+/**
+ * Copies the structures owned by the given slots of w pointers of a trie or node.
+ * Returns 0 on success, or -1 in case of an error.
+ */
+static int dagdb_compact_entries(Compaction * c, const dagdb_pointer * entry, uint_fast32_t count, uint_fast32_t w) {
+	for (uint_fast32_t i = 0; i < count; i++) {
+		const dagdb_pointer * slot = entry + i*w;
+		if (dagdb_get_pointer_type(slot[0]) == DAGDB_TYPE_TRIE) {
+			// Nodes are only referenced by their parent, hence this is the first time it is visited.
+			if (!dagdb_compact_copy(c, slot[0], dagdb_compact_node_length(c, slot[0], w))) return -1;
+			const Node * n = dagdb_compact_locate(c, slot[0], sizeof(Node));
+			if (dagdb_compact_entries(c, n->entry, node_count(n), w)) return -1;
+		} else if (w == 2 && dagdb_get_pointer_type(slot[1]) == DAGDB_TYPE_TRIE) {
+			// The key of a pair is an element, its value is owned if it is a trie.
+			if (dagdb_compact_owned(c, slot[1])) return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Copies the given structure and everything it owns depth first, such that these end up close together.
+ * A structure owns the data and backref of an element, the nodes of a trie and the values of the kvpairs
+ * embedded in it, if these are tries. References to elements are not followed, as elements are owned by the root trie.
+ * Returns 0 on success, or -1 in case of an error.
+ */
+static int dagdb_compact_owned(Compaction * c, dagdb_pointer location) {
+	if (*dagdb_compact_slot(c, location)) return 0; // Already copied.
+	if (!dagdb_compact_copy(c, location, dagdb_compact_length(c, location))) return -1;
+	switch (dagdb_get_pointer_type(location)) {
+		case DAGDB_TYPE_DATA: 
+			return 0;
+		case DAGDB_TYPE_ELEMENT: {
+			const Element * e = dagdb_compact_locate(c, location, sizeof(Element));
+			dagdb_pointer data = e->info & ELEMENT_INLINE ? 0 : e->data, backref = e->backref;
+			if (data && dagdb_compact_owned(c, data)) return -1;
+			if (backref && dagdb_compact_owned(c, backref)) return -1;
+			return 0;
+		}
+		case DAGDB_TYPE_TRIE: {
+			uint_fast32_t w = SLOT_WIDTH(location);
+			const dagdb_pointer * top = dagdb_compact_locate(c, location, TOP_SIZE(w));
+			return dagdb_compact_entries(c, top, 16, w);
+		}
+		default: UNREACHABLE;
+	}
+}
+
+/**
+ * Copies the top and nodes of the root trie in breadth first order, followed by the elements in that trie, 
+ * each together with the structures it owns. The slots of its top are selected by the given number of nibbles.
+ * Returns the new location of the root trie, or 0 in case of an error.
+ */
+static dagdb_pointer dagdb_compact_root(Compaction * c, dagdb_pointer root, uint_fast32_t nibbles) {
+	dagdb_pointer r = 0;
+	uint64_t queue_size = 1, leaves_size = 0, capacity = 1024;
+	dagdb_pointer * queue = malloc(capacity * sizeof(dagdb_pointer));
+	dagdb_pointer * leaves = malloc(capacity * sizeof(dagdb_pointer));
+	if (!queue || !leaves) goto oom;
+	queue[0] = root;
+	for (uint64_t i = 0; i < queue_size; i++) {
+		// The first entry of the queue is the top of the trie, the others are nodes.
+		dagdb_size length = i ? dagdb_compact_node_length(c, queue[i], 1) : TOP_SIZE_NIBBLES(nibbles, 1);
+		if (!dagdb_compact_copy(c, queue[i], length)) goto done;
+		const dagdb_pointer * entry = i ? 
+			((const Node *)dagdb_compact_locate(c, queue[i], length))->entry : 
+			(const dagdb_pointer *)dagdb_compact_locate(c, queue[i], length);
+		uint_fast32_t count = i ? (length - sizeof(Node)) / S : TOP_SLOTS(nibbles);
+		for (uint_fast32_t j = 0; j < count; j++) {
+			dagdb_pointer p = entry[j];
+			if (!p) continue;
+			if (queue_size == capacity || leaves_size == capacity) {
+				capacity *= 2;
+				dagdb_pointer * q = realloc(queue, capacity * sizeof(dagdb_pointer));
+				if (q) queue = q;
+				dagdb_pointer * l = realloc(leaves, capacity * sizeof(dagdb_pointer));
+				if (l) leaves = l;
+				if (!q || !l) goto oom;
+			}
+			if (dagdb_get_pointer_type(p) == DAGDB_TYPE_TRIE) {
+				queue[queue_size++] = p;
+			} else {
+				leaves[leaves_size++] = leaf_element(p);
+			}
+		}
+	}
+	for (uint64_t i = 0; i < leaves_size; i++) {
+		if (dagdb_compact_owned(c, leaves[i])) goto done;
+	}
+	r = dagdb_compact_slot(c, root)[1];
+	goto done;
+	
+	oom:
+	dagdb_errno = DAGDB_ERROR_OTHER;
+	dagdb_report_p("Cannot allocate trie queue");
+	done:
+	free(queue);
+	free(leaves);
+	return r;
+}
+
+/** Replaces a pointer of the source database by the pointer of its copy. */
+static int dagdb_compact_rewrite(Compaction * c, dagdb_pointer * p) {
+	if (*p == 0) return 0;
+	dagdb_pointer * slot = dagdb_compact_slot(c, *p);
+	if (slot[0] == 0) {
+		dagdb_errno = DAGDB_ERROR_INVALID_DB;
+		dagdb_report("Pointer %lx refers to a structure that is not reachable from the root", *p);
+		return -1;
+	}
+	*p = slot[1];
+	return 0;
+}
+
+static int dagdb_compact_rewrite_trie(Compaction * c, dagdb_pointer * p);
+
+/**
+ * Replaces the pointers in the given slots of w pointers of a copied trie or node, and those in the nodes 
+ * and values they refer to. As each trie is owned by a single structure, this is done once for every trie, by its owner.
+ */
+static int dagdb_compact_rewrite_entries(Compaction * c, dagdb_pointer * entry, uint_fast32_t count, uint_fast32_t w) {
+	for (uint_fast32_t i = 0; i < count; i++) {
+		dagdb_pointer * slot = entry + i*w;
+		// The element of a leaf keeps its fingerprint.
+		dagdb_pointer fp = dagdb_get_pointer_type(slot[0]) == DAGDB_TYPE_TRIE ? 0 : slot[0] & FINGERPRINT_MASK;
+		slot[0] = leaf_element(slot[0]);
+		if (dagdb_compact_rewrite(c, &slot[0])) return -1;
+		slot[0] |= fp;
+		if (dagdb_get_pointer_type(slot[0]) == DAGDB_TYPE_TRIE) {
+			Node * n = LOCATE(Node, slot[0]);
+			if (dagdb_compact_rewrite_entries(c, n->entry, node_count(n), w)) return -1;
+		} else if (w == 2 && dagdb_compact_rewrite_trie(c, &slot[1])) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** Replaces the pointer to a trie, and the pointers inside the copy of that trie. */
+static int dagdb_compact_rewrite_trie(Compaction * c, dagdb_pointer * p) {
+	if (dagdb_compact_rewrite(c, p)) return -1;
+	if (dagdb_get_pointer_type(*p) != DAGDB_TYPE_TRIE) return 0;
+	return dagdb_compact_rewrite_entries(c, LOCATE(dagdb_pointer, *p), 16, SLOT_WIDTH(*p));
+}
+
+/**
+ * Rewrites the given source database into the given destination file, such that the structures are stored 
+ * in locality order. The nodes of the root trie are placed at the start of the file in breadth first order. 
+ * These are followed by the elements, each directly followed by its data or record trie and backref.
+ * Structures that are not reachable from the root are dropped.
+ * The destination has the same slab size, root table, number of filter bits per key and segregation of types as the source.
+ * 
+ * The source is only read, hence it may be a read-only file. The destination file must not yet exist. 
+ * Any database that is loaded is unloaded first.
+ * No database is loaded after this function returns.
+ * Returns 0 on success, or -1 in case of an error.
+ */
+int dagdb_compact(const char * source, const char * destination) {
+	dagdb_unload();
+	Compaction c = {MAP_FAILED, 0, NULL, 0, 0};
+	int fd = -1, created = 0, r = -1;
+	
+	// Map the source read-only, such that it is not modified and need not be writable.
+	fd = open(source, O_RDONLY);
+	if (fd == -1) {
+		dagdb_errno = DAGDB_ERROR_BAD_ARGUMENT;
+		dagdb_report_p("Cannot open '%s'", source);
+		goto error;
+	}
+	c.size = lseek(fd, 0, SEEK_END);
+	if (c.size < HEADER_SIZE) {
+		dagdb_errno = DAGDB_ERROR_INVALID_DB;
+		dagdb_report("File has unexpected size %lu", c.size);
+		goto error;
+	}
+	c.file = mmap(NULL, c.size, PROT_READ, MAP_SHARED, fd, 0);
+	if (c.file == MAP_FAILED) {
+		dagdb_errno = DAGDB_ERROR_OTHER;
+		dagdb_report_p("Cannot map '%s' to memory", source);
+		goto error;
+	}
+	
+	// Check that the source is a valid database.
+	const Header * h = (const Header *)c.file;
+	if (dagdb_check_header(h, c.size)) {
+		dagdb_errno = DAGDB_ERROR_INVALID_DB;
+		goto error;
+	}
+	dagdb_pointer root = h->root;
+	uint_fast32_t nibbles = h->root_nibbles;
+	dagdb_options options = dagdb_default_options;
+	options.slab_size = h->slab_size;
+	options.root_table_bits = nibbles > 1 ? 4 * nibbles : 0;
+	options.filter_bits_per_key = h->filter_bits_per_key;
+	options.segregate_types = h->segregate_types;
+	madvise((void*)c.file, c.size, MADV_SEQUENTIAL);
+	
+	// Create the destination.
+	int dst = open(destination, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (dst == -1) {
+		dagdb_errno = DAGDB_ERROR_BAD_ARGUMENT;
+		dagdb_report_p("Cannot create '%s'", destination);
+		goto error;
+	}
+	close(dst);
+	created = 1;
+	if (dagdb_load_options(destination, &options)) goto error;
+	
+	if (root) {
+		// Copy all structures and then replace the pointers inside the copies.
+		dagdb_pointer new_root = dagdb_compact_root(&c, root, nibbles);
+		if (!new_root) goto error;
+		for (uint64_t i = 0; i < c.capacity; i++) {
+			dagdb_pointer p = c.map[2*i+1];
+			if (!p) continue;
+			switch (dagdb_get_pointer_type(p)) {
+				case DAGDB_TYPE_DATA: 
+					break;
+				case DAGDB_TYPE_TRIE: 
+					// Rewritten by their owner.
+					break;
+				case DAGDB_TYPE_ELEMENT: {
+					Element * e = LOCATE(Element, p);
+					if (!(e->info & ELEMENT_INLINE) && dagdb_compact_rewrite_trie(&c, &e->data)) goto error;
+					if (dagdb_compact_rewrite_trie(&c, &e->backref)) goto error;
+					break;
+				}
+				case DAGDB_TYPE_KVPAIR:
+					// Pairs are embedded in tries and rewritten with them.
+					UNREACHABLE;
+			}
+		}
+		if (dagdb_compact_rewrite_entries(&c, LOCATE(dagdb_pointer, new_root), TOP_SLOTS(nibbles), 1)) goto error;
+		LOCATE(Header, 0)->root = new_root;
+		// The filter is built anew, which is smaller than the filter of the source if keys were removed.
+		if (options.filter_bits_per_key && dagdb_filter_rebuild(options.filter_bits_per_key)) goto error;
+	}
+	// Do not retain the space that was preallocated while growing.
+	if (dagdb_trim()) goto error;
+	r = 0;
+	
+	error:
+	dagdb_unload();
+	if (r && created) unlink(destination);
+	if (c.file != MAP_FAILED) munmap((void*)c.file, c.size);
+	if (fd != -1) close(fd);
+	free(c.map);
+	return r;
 }
@@ -32,18 +32,33 @@ typedef enum {
 	DAGDB_TYPE_KVPAIR,
 } dagdb_pointer_type;
 
+/**
+ * Set in addition to the trie type in pointers to tries that map keys to values.
+ * The key-value pairs of such a trie are embedded in it.
+ */
+#define DAGDB_TRIE_PAIRS 4
+
+/** Byte arrays up to this length are stored inside their element, see dagdb_element_create_inline. */
+#define DAGDB_MAX_INLINE_LENGTH 32
+
 // Trie related
-dagdb_pointer dagdb_trie_create();
+dagdb_pointer dagdb_trie_create(dagdb_pointer hint);
+dagdb_pointer dagdb_trie_create_pairs(dagdb_pointer hint);
 void          dagdb_trie_delete(dagdb_pointer location);
 int           dagdb_trie_insert(dagdb_pointer trie, dagdb_pointer pointer) WARN_UNUSED_RESULT;
+int           dagdb_trie_insert_pair(dagdb_pointer trie, dagdb_pointer key, dagdb_pointer value) WARN_UNUSED_RESULT;
 dagdb_pointer dagdb_trie_find  (dagdb_pointer trie, dagdb_key key);
+void          dagdb_trie_find_many(dagdb_pointer trie, dagdb_size count, const dagdb_key * keys, dagdb_pointer * results);
 int           dagdb_trie_remove(dagdb_pointer trie, dagdb_key key) WARN_UNUSED_RESULT;
 
 // Element related
 dagdb_pointer dagdb_element_create (dagdb_key key, dagdb_pointer data, dagdb_pointer backref);
+dagdb_pointer dagdb_element_create_inline(dagdb_key key, dagdb_size length, const void * data, dagdb_pointer backref);
 void          dagdb_element_delete (dagdb_pointer location);
 dagdb_pointer dagdb_element_data   (dagdb_pointer location);
+const void *  dagdb_element_bytes  (dagdb_pointer location, dagdb_size * length);
 dagdb_pointer dagdb_element_backref(dagdb_pointer location);
+dagdb_pointer dagdb_element_backref_obtain(dagdb_pointer location);
 void          dagdb_element_key    (uint8_t * key, dagdb_pointer location);
 
 // Data related
@@ -53,14 +68,19 @@ dagdb_size    dagdb_data_length(dagdb_pointer location);
 const void *  dagdb_data_access(dagdb_pointer location);
 
 // KVpair related
-dagdb_pointer dagdb_kvpair_create(dagdb_pointer key,dagdb_pointer value);
-void          dagdb_kvpair_delete(dagdb_pointer location);
 dagdb_pointer dagdb_kvpair_key   (dagdb_pointer location);
 dagdb_pointer dagdb_kvpair_value (dagdb_pointer location);
 
 // Other
 int           dagdb_load(const char * database) WARN_UNUSED_RESULT;
+int           dagdb_load_options(const char * database, const dagdb_options * options) WARN_UNUSED_RESULT;
 void          dagdb_unload();
+int           dagdb_trim();
+void          dagdb_get_counters(dagdb_counters * counters);
+void          dagdb_prefetch(const void * address, dagdb_size length);
+void          dagdb_stats(dagdb_statistics * stats, uint_fast32_t samples);
+int           dagdb_compact(const char * source, const char * destination);
+int           dagdb_filter_rebuild(uint32_t bits_per_key);
 dagdb_pointer dagdb_root();
 dagdb_pointer_type dagdb_get_pointer_type(dagdb_pointer location);
 
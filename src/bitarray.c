@@ -16,6 +16,9 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <assert.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "bitarray.h"
 
@@ -78,3 +81,111 @@ int_fast32_t dagdb_bitarray_read(dagdb_bitarray* bitarray, int_fast32_t pos) {
 	return bitarray[pos/(sizeof(dagdb_bitarray)*8)] & (1UL << pos%(sizeof(dagdb_bitarray)*8));
 }
 
+/**
+ * Returns the words of the bitarray, inverted when searching for unset bits, 
+ * such that the searched bits are always the set bits.
+ */
+#define WORD(w) (bitarray[w] ^ invert)
+
+/**
+ * Returns the position of the first bit in the given range that is set to value, 
+ * or -1 if there is no such bit.
+ * The bitarray is scanned a word at a time, or four words at a time if AVX2 is available.
+ */
+int_fast32_t dagdb_bitarray_scan_next(dagdb_bitarray* bitarray, int_fast32_t start, int_fast32_t length, int_fast32_t value) {
+	assert(start>=0);
+	assert(length>=0);
+	assert(value==0 || value==1);
+	if (length==0) return -1;
+	dagdb_bitarray invert = value ? 0 : ~0UL;
+	int_fast32_t end = start + length;
+	int_fast32_t w = start/B, last = (end-1)/B;
+	dagdb_bitarray word = WORD(w) & (~0UL << start%B);
+	while (!word) {
+		if (++w > last) return -1;
+#ifdef __AVX2__
+		// Skip blocks of four words that do not contain the value.
+		__m256i ones = _mm256_set1_epi64x(-1);
+		while (w + 3 <= last) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(bitarray + w));
+			if (value ? !_mm256_testz_si256(v, v) : !_mm256_testc_si256(v, ones)) break;
+			w += 4;
+		}
+		if (w > last) return -1;
+#endif
+		word = WORD(w);
+	}
+	int_fast32_t pos = w*B + __builtin_ctzl(word);
+	return pos < end ? pos : -1;
+}
+
+/**
+ * Returns the position of the last bit in the given range that is set to value, 
+ * or -1 if there is no such bit.
+ */
+int_fast32_t dagdb_bitarray_scan_prev(dagdb_bitarray* bitarray, int_fast32_t start, int_fast32_t length, int_fast32_t value) {
+	assert(start>=0);
+	assert(length>=0);
+	assert(value==0 || value==1);
+	if (length==0) return -1;
+	dagdb_bitarray invert = value ? 0 : ~0UL;
+	int_fast32_t end = start + length;
+	int_fast32_t w = (end-1)/B, first = start/B;
+	dagdb_bitarray word = WORD(w) & (~0UL >> (B-1 - (end-1)%B));
+	while (!word) {
+		if (--w < first) return -1;
+		word = WORD(w);
+	}
+	int_fast32_t pos = w*B + B-1 - __builtin_clzl(word);
+	return pos >= start ? pos : -1;
+}
+
+/**
+ * Returns the number of set bits in the given range.
+ */
+int_fast32_t dagdb_bitarray_count(dagdb_bitarray* bitarray, int_fast32_t start, int_fast32_t length) {
+	assert(start>=0);
+	assert(length>=0);
+	if (length==0) return 0;
+	int_fast32_t end = start + length;
+	int_fast32_t w1 = start/B, w2 = (end-1)/B;
+	dagdb_bitarray head = ~0UL << start%B, tail = ~0UL >> (B-1 - (end-1)%B);
+	if (w1==w2) return __builtin_popcountl(bitarray[w1] & head & tail);
+	int_fast32_t count = __builtin_popcountl(bitarray[w1] & head) + __builtin_popcountl(bitarray[w2] & tail);
+	int_fast32_t w = w1+1;
+#ifdef __AVX2__
+	// Count the bits of each nibble using a lookup table and sum the bytes of each word.
+	const __m256i table = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i sum = _mm256_setzero_si256();
+	for (; w + 4 <= w2; w += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(bitarray + w));
+		__m256i bytes = _mm256_add_epi8(
+			_mm256_shuffle_epi8(table, _mm256_and_si256(v, low)),
+			_mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+	}
+	count += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+#endif
+	for (; w < w2; w++) {
+		count += __builtin_popcountl(bitarray[w]);
+	}
+	return count;
+}
+
+/**
+ * Returns the position of the first run of at least run bits that are set to value, 
+ * which lies entirely within the given range, or -1 if there is no such run.
+ */
+int_fast32_t dagdb_bitarray_find_run(dagdb_bitarray* bitarray, int_fast32_t start, int_fast32_t length, int_fast32_t run, int_fast32_t value) {
+	assert(run>0);
+	int_fast32_t end = start + length;
+	while (end - start >= run) {
+		int_fast32_t p = dagdb_bitarray_scan_next(bitarray, start, end - start, value);
+		if (p < 0 || end - p < run) return -1;
+		int_fast32_t q = dagdb_bitarray_scan_next(bitarray, p, run, !value);
+		if (q < 0) return p;
+		start = q;
+	}
+	return -1;
+}
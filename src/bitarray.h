@@ -35,5 +35,9 @@ void         dagdb_bitarray_unmark(dagdb_bitarray* bitarray, int_fast32_t start,
 void         dagdb_bitarray_flip  (dagdb_bitarray* bitarray, int_fast32_t start, int_fast32_t length);
 int_fast32_t dagdb_bitarray_check (dagdb_bitarray* bitarray, int_fast32_t start, int_fast32_t length, int_fast32_t value);
 int_fast32_t dagdb_bitarray_read  (dagdb_bitarray* bitarray, int_fast32_t pos);
+int_fast32_t dagdb_bitarray_scan_next(dagdb_bitarray* bitarray, int_fast32_t start, int_fast32_t length, int_fast32_t value);
+int_fast32_t dagdb_bitarray_scan_prev(dagdb_bitarray* bitarray, int_fast32_t start, int_fast32_t length, int_fast32_t value);
+int_fast32_t dagdb_bitarray_count    (dagdb_bitarray* bitarray, int_fast32_t start, int_fast32_t length);
+int_fast32_t dagdb_bitarray_find_run (dagdb_bitarray* bitarray, int_fast32_t start, int_fast32_t length, int_fast32_t run, int_fast32_t value);
 
 #endif
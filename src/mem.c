@@ -16,6 +16,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -35,16 +36,24 @@
 /////////////
 
 /**
- * Maximum amount of space (in bytes) that the database is allowed to use.
- * TODO (low): Remove this limit.
+ * Amount of virtual address space (in bytes) that is reserved for the database mapping.
+ * The whole range is mapped at load time, such that the mapping never has to move
+ * while the file grows and LOCATE remains a single addition.
+ * If the system refuses to reserve this much, a smaller range is tried.
  */
-#define MAX_SIZE (1<<30)
+#define RESERVE_SIZE (1ULL<<40)
+
+/**
+ * Smallest amount of virtual address space (in bytes) that dagdb_load tries to reserve.
+ * Beyond the reserved range, the mapping is grown in place with mremap.
+ */
+#define MIN_RESERVE_SIZE (1ULL<<30)
 
 /**
  * Counter for the database format. Incremented whenever a format change
  * is incompatible with previous versions of this library.
  */
-#define FORMAT_VERSION 1
+#define FORMAT_VERSION 11
 
 /**
  * A 4 byte string that helps identifying a DagDB database.
@@ -65,7 +74,49 @@
  */
 #define MAX_CHUNK_SIZE 766*S
 
+/**
+ * Maximum allocatable extent size (in bytes).
+ * Allocations larger than MAX_CHUNK_SIZE are stored in extents: runs of whole slabs.
+ * This limit only exists to prevent overflows in the size computations.
+ */
+#define MAX_EXTENT_SIZE (1ULL<<48)
+
+/** Number of bits in a byte. */
+#define BITS_PER_BYTE 8
+
+/** The size of a single memory page. This value can differ between systems, but is usually 4096. */
+#define PAGE_SIZE 4096
+
+/** Size of a single memory slab, unless another size was chosen when the database was created. */
+#define DEFAULT_SLAB_SIZE (8 * 4096)
+
+/**
+ * Smallest allowed slab size.
+ * The first slab must be able to hold the header and a chunk of MAX_CHUNK_SIZE must fit in a slab.
+ */
+#define MIN_SLAB_SIZE (2 * 4096)
+
+/**
+ * Largest allowed slab size.
+ * This keeps the bit indices of a slab's bitmap within 32 bits.
+ */
+#define MAX_SLAB_SIZE (1ULL<<30)
+
+/** 
+ * Number of groups of S that fit in a slab of the given size, while perserving room for the usage bitmap,
+ * the usage count and the extent field. 
+ * Rounding the bitmap up to whole words can make this one or two too large, which dagdb_slab_geometry corrects.
+ */
+#define SLAB_BITMAP_SIZE(size) ((((size)-2*S)*BITS_PER_BYTE) / (S*BITS_PER_BYTE+1))
+
+/**
+ * Forces a function to be inlined, such that calls with a constant slab geometry are specialized for it.
+ */
+#define ALWAYS_INLINE inline __attribute__ ((always_inline))
+
 STATIC_ASSERT(sizeof(Header) <= HEADER_SIZE, header_too_large);
+STATIC_ASSERT(CHUNK_TABLE_SIZE <= 64, chunk_table_fits_in_chunk_mask);
+STATIC_ASSERT(CHUNK_TABLE_SIZE == DAGDB_STATS_SIZE_CLASSES, chunk_table_size_matches_statistics);
 STATIC_ASSERT(S == sizeof(dagdb_size), same_pointer_size_size);
 STATIC_ASSERT(((S - 1)&S) == 0, size_power_of_two);
 
@@ -92,6 +143,31 @@ typedef struct {
 STATIC_ASSERT(MIN_CHUNK_SIZE%S == 0, min_chunk_size_is_multiple_of_s);
 STATIC_ASSERT(sizeof(FreeMemoryChunk)%S == 0, fmc_size_is_multiple_of_s);
 
+/**
+ * Describes the layout of the slabs of a database, which depends on the slab size.
+ * A slab of this size starts with bitmap_size groups of S that are used for allocation,
+ * followed by a bitmap that stores whether each of these groups is in use.
+ * The last two groups of S of the slab contain its usage count and extent field.
+ * @see dagdb_slab_used
+ * @see dagdb_slab_extent
+ */
+typedef struct {
+	/** The size of a slab (in bytes), which is a power of two. */
+	dagdb_size size;
+	/** The number of groups of S in a slab that can be allocated, which is also the number of bits in its bitmap. */
+	dagdb_size bitmap_size;
+} SlabGeometry;
+
+/**
+ * The layout of slabs of DEFAULT_SLAB_SIZE.
+ * Passing this constant to an inlined function lets the compiler fold all slab computations.
+ */
+#define DEFAULT_SLAB_GEOMETRY ((SlabGeometry){DEFAULT_SLAB_SIZE, SLAB_BITMAP_SIZE(DEFAULT_SLAB_SIZE)})
+STATIC_ASSERT(SLAB_BITMAP_SIZE(DEFAULT_SLAB_SIZE)*S + DAGDB_BITARRAY_ARRAY_SIZE(SLAB_BITMAP_SIZE(DEFAULT_SLAB_SIZE))*sizeof(dagdb_bitarray) <= DEFAULT_SLAB_SIZE - 2*S, default_slab_layout_fits);
+STATIC_ASSERT(SLAB_BITMAP_SIZE(DEFAULT_SLAB_SIZE)*S + DAGDB_BITARRAY_ARRAY_SIZE(SLAB_BITMAP_SIZE(DEFAULT_SLAB_SIZE))*sizeof(dagdb_bitarray) > DEFAULT_SLAB_SIZE - 4*S, default_slab_layout_does_not_waste_too_much);
+STATIC_ASSERT((DEFAULT_SLAB_SIZE & (DEFAULT_SLAB_SIZE-1)) == 0, slab_size_power_of_two);
+STATIC_ASSERT(SLAB_BITMAP_SIZE(MIN_SLAB_SIZE)*S - 2*S > MAX_CHUNK_SIZE && MIN_SLAB_SIZE >= 2*HEADER_SIZE, min_slab_size_fits_header_and_chunks);
+
 
 //////////////////////
 // Static variables //
@@ -109,45 +185,128 @@ void *dagdb_file = MAP_FAILED;
 
 /**
  * The current size of the currently opened database.
+ * This is the end of the last slab in use, which can be less than the size of the file.
  */
 static dagdb_size dagdb_database_size;
 
+/**
+ * The size of the file of the currently opened database.
+ * The space beyond dagdb_database_size is preallocated and consists of empty slabs.
+ */
+static dagdb_size dagdb_file_size;
+
+/**
+ * Counters of the memory management of the currently opened database.
+ */
+static dagdb_counters dagdb_counter;
+
+/**
+ * The options the currently opened database was loaded with.
+ */
+static dagdb_options dagdb_current_options;
+
+/**
+ * Options used by dagdb_load.
+ * The file grows with 1/8th of its size, but at least 1MiB and at most 1GiB.
+ * Up to 4MiB of unused space is retained at the end of the file.
+ * The storage of free slabs in the middle of the file is released.
+ */
+const dagdb_options dagdb_default_options = {
+	.growth_min = 1<<20,
+	.growth_max = 1<<30,
+	.growth_percent = 12,
+	.retention = 4<<20,
+	.release_slabs = 1,
+};
+
+/**
+ * The amount of address space that is reserved for the mapping of the currently opened database.
+ */
+static dagdb_size dagdb_mapping_size;
+
+/**
+ * The layout of the slabs of the currently opened database.
+ * This has the default layout until a database with another slab size is loaded.
+ */
+static SlabGeometry dagdb_slab = DEFAULT_SLAB_GEOMETRY;
+
 
 //////////////////////
 // Space allocation //
 //////////////////////
 
-/** Number of bits in a byte. */
-#define BITS_PER_BYTE 8
+/**
+ * Returns a dagdb_pointer, pointing to the root element of the linked list with the given id in the given free chunk table.
+ */
+#define CHUNK_TABLE_LOCATION(table, id) ((dagdb_pointer)&(((Header*)0)->chunks[(table)][2*(id)]))
 
-/** The size of a single memory page. This value can differ between systems, but is usually 4096. */
-#define PAGE_SIZE 4096
+/** Size of a single memory slab of the currently opened database. */
+#define SLAB_SIZE (dagdb_slab.size)
 
-/** Size of a single memory slab. */
-#define SLAB_SIZE (8 * 4096)
+/** Number of groups of S in a slab of the currently opened database that can be allocated. */
+#define BITMAP_SIZE (dagdb_slab.bitmap_size)
 
-/** 
- * Number of ints that fit in the slab (in ints), while perserving room for the usage bitmap. 
+/** Number of bytes in a slab of the currently opened database that can be allocated. */
+#define SLAB_USEABLE_SPACE_SIZE (BITMAP_SIZE*S)
+
+/**
+ * Calls the given function with the slab geometry of the currently opened database as first argument.
+ * For the default slab size the constant DEFAULT_SLAB_GEOMETRY is passed instead, 
+ * such that the slab computations in that call are constant folded.
  */
-#define BITMAP_SIZE ((SLAB_SIZE*BITS_PER_BYTE) / (S*BITS_PER_BYTE+1))
+#define WITH_SLAB_GEOMETRY(function, ...) (dagdb_slab.size == DEFAULT_SLAB_SIZE ? \
+	function(DEFAULT_SLAB_GEOMETRY, __VA_ARGS__) : function(dagdb_slab, __VA_ARGS__))
 
 /**
- * Returns a dagdb_pointer, pointing to the root element of the linked list with the given id in the free chunk table.
+ * Number of slabs needed for an extent of the given length (in bytes).
+ * The data of an extent spans all its slabs, except for the bitmap and extent field of the last slab.
  */
-#define CHUNK_TABLE_LOCATION(id) ((dagdb_pointer)&(((Header*)0)->chunks[2*(id)]))
+#define EXTENT_SLABS(length) (((length) + SLAB_SIZE - SLAB_USEABLE_SPACE_SIZE + SLAB_SIZE - 1) / SLAB_SIZE)
 
 /**
- * A struct for the internal structure of a slab.
+ * Returns whether the given slab size is a power of two between MIN_SLAB_SIZE and MAX_SLAB_SIZE.
  */
-typedef struct {
-	/** The part of a memory slab used for allocation. */
-	dagdb_pointer data[BITMAP_SIZE];
-	/** Stores whether each groups of S in data is in use. */
-	dagdb_bitarray bitmap[DAGDB_BITARRAY_ARRAY_SIZE(BITMAP_SIZE)];
-} MemorySlab;
-STATIC_ASSERT(sizeof(MemorySlab) <= SLAB_SIZE, memory_slab_fits_in_a_slab);
-STATIC_ASSERT(sizeof(MemorySlab) > SLAB_SIZE - 2*S, memory_slab_does_not_waste_too_much);
-#define SLAB_USEABLE_SPACE_SIZE sizeof(((MemorySlab*)0)->data)
+static int dagdb_valid_slab_size(dagdb_size size) {
+	return size >= MIN_SLAB_SIZE && size <= MAX_SLAB_SIZE && (size & (size-1)) == 0;
+}
+
+/**
+ * Computes the slab layout for slabs of the given size, which must be a power of two.
+ */
+static SlabGeometry dagdb_slab_geometry(dagdb_size size) {
+	assert((size & (size-1)) == 0);
+	SlabGeometry g = {size, SLAB_BITMAP_SIZE(size)};
+	while (g.bitmap_size*S + DAGDB_BITARRAY_ARRAY_SIZE(g.bitmap_size)*sizeof(dagdb_bitarray) > size - 2*S) {
+		g.bitmap_size--;
+	}
+	return g;
+}
+
+/** Returns the number of bytes in a slab that can be allocated. */
+static ALWAYS_INLINE dagdb_size dagdb_slab_useable(SlabGeometry g) {
+	return g.bitmap_size*S;
+}
+
+/** Returns the bitmap of the given slab, which stores whether each group of S in the slab is in use. */
+static ALWAYS_INLINE dagdb_bitarray * dagdb_slab_bitmap(SlabGeometry g, dagdb_pointer slab) {
+	return LOCATE(dagdb_bitarray, slab + dagdb_slab_useable(g));
+}
+
+/** Returns the number of groups of S in the given slab that are in use, which is the number of bits set in its bitmap. */
+static ALWAYS_INLINE dagdb_size * dagdb_slab_used(SlabGeometry g, dagdb_pointer slab) {
+	return LOCATE(dagdb_size, slab + g.size - 2*S);
+}
+
+/** 
+ * Returns the extent field of the given slab.
+ * If this slab is the last slab of an extent, this is the number of slabs in that extent. Otherwise 0.
+ * Only the last slab of an extent keeps its bitmap, which is then completely marked,
+ * though its usage count is not maintained.
+ * The other slabs of the extent are entirely filled with data.
+ */
+static ALWAYS_INLINE dagdb_size * dagdb_slab_extent(SlabGeometry g, dagdb_pointer slab) {
+	return LOCATE(dagdb_size, slab + g.size - S);
+}
 
 /**
  * Rounds up the given argument to an allocatable size.
@@ -159,18 +318,11 @@ dagdb_size dagdb_round_up(dagdb_size v) {
 }
 
 /**
- * Computes the log2 of an 32-bit integer.
- * Based on: http://graphics.stanford.edu/~seander/bithacks.html#IntegerLog.
+ * Computes the log2 of a non-zero 32-bit integer.
  */
-static inline uint_fast32_t lg2(register uint_fast32_t v) {
-	register uint_fast32_t r; // result of log2(v) will go here
-	register uint_fast32_t shift;
-	r =     (v > 0xFFFF) << 4; v >>= r;
-	shift = (v > 0xFF  ) << 3; v >>= shift; r |= shift;
-	shift = (v > 0xF   ) << 2; v >>= shift; r |= shift;
-	shift = (v > 0x3   ) << 1; v >>= shift; r |= shift;
-	r |= (v >> 1);
-	return r;
+static inline uint_fast32_t lg2(uint32_t v) {
+	assert(v > 0);
+	return 31 - __builtin_clz(v);
 }
 
 /**
@@ -196,24 +348,36 @@ static int_fast32_t alloc_chunk_id(uint_fast32_t v) {
 }
 
 /**
- * Inserts the given chunk into the free chunk linked list table.
+ * Returns the free chunk table that is used for memory with the pointer type of the given location.
+ */
+static inline uint_fast32_t dagdb_chunk_table(dagdb_pointer location) {
+	if (!dagdb_current_options.segregate_types) return 0;
+	assert(dagdb_get_pointer_type(location) < CHUNK_TABLE_COUNT);
+	return dagdb_get_pointer_type(location);
+}
+
+/**
+ * Inserts the given chunk into the given free chunk linked list table.
  */
-static void dagdb_chunk_insert(dagdb_pointer location, dagdb_size size) {
+static void dagdb_chunk_insert(uint_fast32_t table, dagdb_pointer location, dagdb_size size) {
 	assert(size>=MIN_CHUNK_SIZE);
 	assert(size<=SLAB_USEABLE_SPACE_SIZE);
 	assert(location%S==0);
 	assert(location>=HEADER_SIZE);
 	assert(location%SLAB_SIZE + size <= SLAB_USEABLE_SPACE_SIZE);
+	assert(table < CHUNK_TABLE_COUNT);
 	int_fast32_t id = free_chunk_id(size);
 	assert(id>=0 && id<CHUNK_TABLE_SIZE);
-	dagdb_pointer table = CHUNK_TABLE_LOCATION(id);
+	dagdb_pointer list = CHUNK_TABLE_LOCATION(table, id);
 	FreeMemoryChunk * n = LOCATE(FreeMemoryChunk, location);
-	FreeMemoryChunk * t = LOCATE(FreeMemoryChunk, table);
+	FreeMemoryChunk * t = LOCATE(FreeMemoryChunk, list);
 	FreeMemoryChunk * o = LOCATE(FreeMemoryChunk, t->next);
-	n->prev = table;
+	n->prev = list;
 	n->next = t->next;
 	t->next = location;
 	o->prev = location;
+	LOCATE(Header, 0)->chunk_mask[table] |= 1ULL << id;
+	LOCATE(Header, 0)->free_bytes[id] += size;
 	if (size>=sizeof(FreeMemoryChunk)) {
 		n->size = size;
 		*LOCATE(dagdb_size, location + size - S) = size; // Also write the length of the chunk at the end.
@@ -221,88 +385,354 @@ static void dagdb_chunk_insert(dagdb_pointer location, dagdb_size size) {
 }
 
 /**
- * Removes the given chunk from its linked list.
+ * Removes the given chunk of the given size from its linked list.
  */
-static void dagdb_chunk_remove(dagdb_pointer location) {
+static void dagdb_chunk_remove(dagdb_pointer location, dagdb_size size) {
 	FreeMemoryChunk * c = LOCATE(FreeMemoryChunk, location);
+	assert(size < sizeof(FreeMemoryChunk) || size == c->size);
+	LOCATE(Header, 0)->free_bytes[free_chunk_id(size)] -= size;
 	assert(c->next>0);
 	assert(c->prev>0);
 	LOCATE(FreeMemoryChunk,c->next)->prev = c->prev;
 	LOCATE(FreeMemoryChunk,c->prev)->next = c->next;
+	if (c->prev == c->next) {
+		// The list only contains its head, which tells which list it is.
+		assert(c->prev < HEADER_SIZE);
+		uint_fast32_t list = (c->prev - CHUNK_TABLE_LOCATION(0, 0)) / (2*S);
+		LOCATE(Header, 0)->chunk_mask[list / CHUNK_TABLE_SIZE] &= ~(1ULL << list % CHUNK_TABLE_SIZE);
+	}
 	c->prev = c->next = 0;
 }
 
+/**
+ * Tells in which bucket of the occupancy histogram a slab with the given usage count belongs.
+ * The first bucket contains the empty slabs.
+ */
+static ALWAYS_INLINE int_fast32_t occupancy_bucket(SlabGeometry g, dagdb_size used) {
+	if (used == 0) return 0;
+	return 1 + (used - 1) * (DAGDB_STATS_OCCUPANCY_BUCKETS - 1) / g.bitmap_size;
+}
+
 /**
  * Set or unset the usage flag of the given range in a slab's bitmap.
+ * The size must be a multiple of S.
  */
-static void dagdb_bitmap_mark(dagdb_pointer location, dagdb_size size, int_fast32_t value) {
+static ALWAYS_INLINE void dagdb_bitmap_mark(SlabGeometry g, dagdb_pointer location, dagdb_size size, int_fast32_t value) {
 	assert(value==0 || value==1);
 	assert(location%S==0);
-	assert(location%SLAB_SIZE + size <= SLAB_USEABLE_SPACE_SIZE);
-	int_fast32_t offset = location & (SLAB_SIZE-1);
-	MemorySlab * s = LOCATE(MemorySlab, location-offset);
-	(value?dagdb_bitarray_mark:dagdb_bitarray_unmark)(s->bitmap, offset/S, dagdb_round_up(size)/S);
+	assert(size%S==0);
+	int_fast32_t offset = location & (g.size-1);
+	assert(offset + size <= dagdb_slab_useable(g));
+	dagdb_pointer slab = location - offset;
+	(value?dagdb_bitarray_mark:dagdb_bitarray_unmark)(dagdb_slab_bitmap(g, slab), offset/S, size/S);
+	
+	// Update the usage count and occupancy histogram.
+	dagdb_size * histogram = LOCATE(Header, 0)->slab_occupancy;
+	dagdb_size * used = dagdb_slab_used(g, slab);
+	histogram[occupancy_bucket(g, *used)]--;
+	*used = value ? *used + size/S : *used - size/S;
+	assert(*used <= g.bitmap_size);
+	histogram[occupancy_bucket(g, *used)]++;
+}
+
+/**
+ * Number of bits next to a free range that are scanned to determine its size.
+ * Free ranges of at least this size are chunks that store their size at both ends.
+ */
+#define SCAN_BITS 3
+STATIC_ASSERT(SCAN_BITS*S == sizeof(FreeMemoryChunk), scan_bits_matches_tagged_chunk_size);
+
+/**
+ * Returns the size of the free memory that ends at the given location, or 0 if the memory before it is in use.
+ * Free ranges of size S are not large enough to be stored in the free chunk table.
+ * Larger free ranges are chunks that are stored in the free chunk table.
+ */
+static ALWAYS_INLINE dagdb_size dagdb_free_left(SlabGeometry g, dagdb_pointer location) {
+	dagdb_pointer offset = location & (g.size-1);
+	dagdb_bitarray * bitmap = dagdb_slab_bitmap(g, location - offset);
+	int_fast32_t bit = offset/S;
+	// Find the last used bit before the location. The start of the slab counts as used.
+	int_fast32_t n = bit < SCAN_BITS ? bit : SCAN_BITS;
+	int_fast32_t used = dagdb_bitarray_scan_prev(bitmap, bit - n, n, 1);
+	if (used < 0) used = bit - n - 1;
+	if (bit - 1 - used < SCAN_BITS) return (bit - 1 - used) * S;
+	dagdb_size size = *LOCATE(dagdb_size, location - S);
+	assert(size>=3*S);
+	assert(size<=offset);
+	assert(size==LOCATE(FreeMemoryChunk, location - size)->size);
+	return size;
+}
+
+/**
+ * Returns the size of the free memory that starts at the given location, or 0 if that memory is in use.
+ * @see dagdb_free_left
+ */
+static ALWAYS_INLINE dagdb_size dagdb_free_right(SlabGeometry g, dagdb_pointer location) {
+	dagdb_pointer offset = location & (g.size-1);
+	dagdb_bitarray * bitmap = dagdb_slab_bitmap(g, location - offset);
+	int_fast32_t bit = offset/S;
+	// Find the first used bit after the location. The end of the bitmap counts as used.
+	int_fast32_t n = g.bitmap_size - bit < SCAN_BITS ? g.bitmap_size - bit : SCAN_BITS;
+	int_fast32_t used = dagdb_bitarray_scan_next(bitmap, bit, n, 1);
+	if (used < 0) used = bit + n;
+	if (used - bit < SCAN_BITS) return (used - bit) * S;
+	dagdb_size size = LOCATE(FreeMemoryChunk, location)->size;
+	assert(size>=3*S);
+	assert(offset + size<=dagdb_slab_useable(g));
+	assert(size==*LOCATE(dagdb_size, location + size - S));
+	return size;
+}
+
+/**
+ * Amount of bytes at the start of a free slab that are kept when releasing its storage.
+ * These contain the administration of the free chunk that spans the slab.
+ */
+#define RELEASE_MARGIN 4096
+
+/**
+ * Gives the storage of the given free slab back to the filesystem, 
+ * except for its first page and the pages from the one that contains the size at the end of its free chunk.
+ * The latter also contain the slab's bitmap.
+ * Slabs at the end of the database are skipped, as these are either truncated or retained for reuse.
+ * Uses hole punching if the filesystem supports it, otherwise only the memory is released.
+ */
+static void dagdb_slab_release(dagdb_pointer location) {
+	assert(location % SLAB_SIZE == 0);
+	if (!dagdb_current_options.release_slabs || location + SLAB_SIZE >= dagdb_database_size) return;
+	dagdb_size end = (SLAB_USEABLE_SPACE_SIZE - S) & ~(dagdb_size)(PAGE_SIZE-1);
+	if (end <= RELEASE_MARGIN) return;
+	dagdb_counter.slabs_released++;
+	if (fallocate(dagdb_database_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, location + RELEASE_MARGIN, end - RELEASE_MARGIN)) {
+		madvise(dagdb_file + location + RELEASE_MARGIN, end - RELEASE_MARGIN, MADV_DONTNEED);
+	}
+}
+
+/**
+ * Puts the given range, which must already be unmarked in the bitmap, back in the given free chunk table.
+ * If free chunks are next to the range being released, then these chunks are merged.
+ * Ranges that remain smaller than MIN_CHUNK_SIZE are only tracked by the bitmap.
+ * Slabs that become completely free are put in the shared table 0, such that they can be used for any type,
+ * and their storage is released.
+ */
+static ALWAYS_INLINE void dagdb_chunk_release(SlabGeometry g, uint_fast32_t table, dagdb_pointer location, dagdb_size length) {
+	// Check for free chunk left.
+	dagdb_size size = dagdb_free_left(g, location);
+	if (size >= MIN_CHUNK_SIZE) dagdb_chunk_remove(location - size, size);
+	location -= size;
+	length += size;
+
+	// Check for free chunk right.
+	size = dagdb_free_right(g, location + length);
+	if (size >= MIN_CHUNK_SIZE) dagdb_chunk_remove(location + length, size);
+	length += size;
+
+	// Add chunk to free chunk table.
+	if (length == dagdb_slab_useable(g)) {
+		dagdb_chunk_insert(0, location, length);
+		dagdb_slab_release(location);
+	} else if (length >= MIN_CHUNK_SIZE) {
+		dagdb_chunk_insert(table, location, length);
+	}
+}
+
+/**
+ * Enlarges the reserved address range such that it can contain at least size bytes.
+ * The mapping is grown in place, as moving it would invalidate pointers obtained with LOCATE.
+ * @return 0 if successful.
+ */
+static int dagdb_grow_mapping(dagdb_size size) {
+	dagdb_size new_mapping_size = dagdb_mapping_size;
+	while (new_mapping_size < size) new_mapping_size *= 2;
+	if (mremap(dagdb_file, dagdb_mapping_size, new_mapping_size, 0) == MAP_FAILED) {
+		dagdb_errno = DAGDB_ERROR_DB_TOO_LARGE;
+		dagdb_report_p("Cannot grow mapping of %lub to %lub in place", dagdb_mapping_size, new_mapping_size);
+		return -1;
+	}
+	dagdb_mapping_size = new_mapping_size;
+	return 0;
+}
+
+/**
+ * Sets the size of the database file to new_size, which must be larger than its current size.
+ * Uses fallocate, such that the filesystem can allocate the new space as a single extent.
+ * Falls back to ftruncate if the filesystem does not support fallocate.
+ * @return 0 if successful.
+ */
+static int dagdb_extend_file(dagdb_size new_size) {
+	assert(new_size > dagdb_file_size);
+	if (new_size > dagdb_mapping_size && dagdb_grow_mapping(new_size)) {
+		return -1;
+	}
+	dagdb_counter.growth_count++;
+	if (fallocate(dagdb_database_fd, 0, dagdb_file_size, new_size - dagdb_file_size)) {
+		if (errno != EOPNOTSUPP && errno != ENOSYS) return -1;
+		if (ftruncate(dagdb_database_fd, new_size)) return -1;
+	}
+	dagdb_file_size = new_size;
+	return 0;
+}
+
+/**
+ * Enlarges the database with the given amount of bytes, which must be a multiple of SLAB_SIZE.
+ * If the file is too small, it is grown geometrically as configured in the options,
+ * such that a growing database needs few syscalls and ends up less fragmented on disk.
+ * @return The location of the new space, 0 in case of an error.
+ */
+static dagdb_pointer dagdb_grow(dagdb_size size) {
+	dagdb_pointer r = dagdb_database_size;
+	assert((dagdb_database_size % SLAB_SIZE) == 0);
+	assert((size % SLAB_SIZE) == 0);
+	dagdb_size new_size = dagdb_database_size + size;
+	if (new_size > 1ULL << DAGDB_POINTER_BITS) {
+		dagdb_errno = DAGDB_ERROR_DB_TOO_LARGE;
+		dagdb_report("Cannot grow database beyond %llub", 1ULL << DAGDB_POINTER_BITS);
+		return 0;
+	}
+	if (new_size > dagdb_file_size) {
+		dagdb_size step = dagdb_file_size / 100 * dagdb_current_options.growth_percent;
+		if (step > dagdb_current_options.growth_max) step = dagdb_current_options.growth_max;
+		if (step < dagdb_current_options.growth_min) step = dagdb_current_options.growth_min;
+		dagdb_size target = (dagdb_file_size + step + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1);
+		if (target < new_size) target = new_size;
+		// If preallocating fails, try again with only the space that is needed.
+		if (dagdb_extend_file(target) && (target == new_size || dagdb_extend_file(new_size))) {
+			dagdb_errno = DAGDB_ERROR_DB_TOO_LARGE;
+			dagdb_report_p("Failed to grow database file to %lub", new_size);
+			return 0;
+		}
+	}
+	dagdb_database_size = new_size;
+	return r;
+}
+
+/**
+ * Returns whether the given slab is a normal slab in which no memory is in use.
+ * Such a slab consists of a single free chunk.
+ */
+static ALWAYS_INLINE int dagdb_slab_empty(SlabGeometry g, dagdb_pointer location) {
+	assert((location & (g.size-1)) == 0);
+	dagdb_size used = *dagdb_slab_used(g, location);
+	dagdb_size extent = *dagdb_slab_extent(g, location);
+	assert(extent != 0 || (used == 0) == dagdb_bitarray_check(dagdb_slab_bitmap(g, location), 0, g.bitmap_size, 0));
+	return extent == 0 && used == 0;
+}
+
+/**
+ * Allocates an extent of the given length at the end of the database file.
+ * The last slab of the extent is marked as completely used and records the length of the extent.
+ */
+static dagdb_pointer dagdb_extent_malloc(dagdb_size length) {
+	if (length > MAX_EXTENT_SIZE) {
+		dagdb_errno = DAGDB_ERROR_BAD_ARGUMENT;
+		dagdb_report("Cannot allocate %lub, which is larger than the maximum %llub.", length, MAX_EXTENT_SIZE);
+		return 0;
+	}
+	dagdb_size slabs = EXTENT_SLABS(length);
+	dagdb_pointer r = dagdb_grow(slabs * SLAB_SIZE);
+	if (!r) return 0;
+	dagdb_pointer last = r + (slabs - 1) * SLAB_SIZE;
+	dagdb_bitarray_mark(dagdb_slab_bitmap(dagdb_slab, last), 0, BITMAP_SIZE);
+	*dagdb_slab_extent(dagdb_slab, last) = slabs;
+	LOCATE(Header, 0)->extent_slabs += slabs;
+#ifdef DAGDB_HARDEN_MALLOC
+	for (uint64_t i=0; i<length; i+=8) {
+		*LOCATE(uint64_t, r+i) = random();
+	}
+#endif // DAGDB_HARDEN_MALLOC
+	return r;
+}
+
+/**
+ * Releases an extent by turning each of its slabs into an empty slab.
+ * The contents of the extent are not cleared.
+ */
+static void dagdb_extent_free(dagdb_pointer location, dagdb_size length) {
+	assert(location % SLAB_SIZE == 0);
+	dagdb_size slabs = EXTENT_SLABS(length);
+	assert(location + slabs * SLAB_SIZE <= dagdb_database_size);
+	assert(*dagdb_slab_extent(dagdb_slab, location + (slabs - 1) * SLAB_SIZE) == slabs);
+	LOCATE(Header, 0)->extent_slabs -= slabs;
+	LOCATE(Header, 0)->slab_occupancy[0] += slabs;
+	for (dagdb_size i=0; i<slabs; i++) {
+		// Clear the part that is used for the bitmap, usage count and extent field of a normal slab.
+		memset(dagdb_slab_bitmap(dagdb_slab, location + i * SLAB_SIZE), 0, SLAB_SIZE - SLAB_USEABLE_SPACE_SIZE);
+		dagdb_chunk_insert(0, location + i * SLAB_SIZE, SLAB_USEABLE_SPACE_SIZE);
+		dagdb_slab_release(location + i * SLAB_SIZE);
+	}
 }
-STATIC_ASSERT((SLAB_SIZE & (SLAB_SIZE-1)) == 0, slab_size_power_of_two);
 
 /**
  * Allocates the requested amount of bytes.
  * WARNING: Like malloc, these are not zero'd out. However, as the chunks tend to be
  * from new diskspace, which is initialized to 0, this might seem to be the case.
+ * Allocations larger than MAX_CHUNK_SIZE are stored in an extent of whole slabs,
+ * which starts at the beginning of a slab.
  * 
  * @return A pointer to the newly allocated memory, 0 in case of an error.
  */
 dagdb_pointer dagdb_malloc(dagdb_size length) {
-	// Traverse the free chunk table, to find an empty spot in one of the already existing slabs.
+	return dagdb_malloc_typed(length, 0);
+}
+
+/**
+ * Implementation of dagdb_malloc_typed for slabs with the given geometry.
+ */
+static ALWAYS_INLINE dagdb_pointer dagdb_malloc_slab(SlabGeometry g, dagdb_size length, uint_fast32_t type) {
+	assert(type < CHUNK_TABLE_COUNT);
 	if (length > MAX_CHUNK_SIZE) {
-		dagdb_errno = DAGDB_ERROR_BAD_ARGUMENT;
-		dagdb_report("Cannot allocate %lub, which is larger than the maximum %lub.", length, MAX_CHUNK_SIZE);
-		return 0;
+		dagdb_pointer r = dagdb_extent_malloc(length);
+		if (r) LOCATE(Header, 0)->type_bytes[type] += dagdb_round_up(length);
+		return r;
 	}
+	uint_fast32_t table = dagdb_chunk_table(type);
 	
-	// Lookup a sufficiently large chunk in the free chunk table.
+	// Lookup the first non-empty list in the free chunk table that contains sufficiently large chunks.
 	int_fast32_t id = alloc_chunk_id(length);
-	FreeMemoryChunk * m = LOCATE(FreeMemoryChunk, CHUNK_TABLE_LOCATION(id));
-	while (m->next < HEADER_SIZE && ++id < CHUNK_TABLE_SIZE) {
-		m = LOCATE(FreeMemoryChunk, CHUNK_TABLE_LOCATION(id));
-	}
+	uint64_t mask = LOCATE(Header, 0)->chunk_mask[table] >> id;
 	
-	dagdb_pointer r;
+	dagdb_pointer r = 0;
 	length = dagdb_round_up(length);
-	if (id < CHUNK_TABLE_SIZE) {
+	if (mask) {
 		// There is a sufficiently large chunk available.
+		id += __builtin_ctzll(mask);
+		FreeMemoryChunk * m = LOCATE(FreeMemoryChunk, CHUNK_TABLE_LOCATION(table, id));
 		r = m->next;
 		assert(r>=HEADER_SIZE);
-		dagdb_chunk_remove(r);
 		m = LOCATE(FreeMemoryChunk, r);
-		assert(id==0 || free_chunk_id(m->size)==id);
-		assert(id==0 || m->size==*LOCATE(dagdb_size,r+m->size-S));
-		if (id > 0 && m->size-length>=MIN_CHUNK_SIZE) {
-			dagdb_chunk_insert(r+length, m->size-length);
+		dagdb_size size = id==0 ? MIN_CHUNK_SIZE : m->size;
+		assert(free_chunk_id(size)==id);
+		assert(id==0 || size==*LOCATE(dagdb_size,r+size-S));
+		dagdb_chunk_remove(r, size);
+		if (size-length>=MIN_CHUNK_SIZE) {
+			dagdb_chunk_insert(table, r+length, size-length);
 		}
 	} else {
-		// Allocate the memory in a newly created slab.
-		r = dagdb_database_size;
-		assert((dagdb_database_size % SLAB_SIZE) == 0);
-		dagdb_size new_size = dagdb_database_size + SLAB_SIZE;
-		if (new_size > MAX_SIZE) {
-			dagdb_errno = DAGDB_ERROR_DB_TOO_LARGE;
-			dagdb_report("Cannot enlarge database of %lub with %ub beyond hard coded limit of %u bytes", dagdb_database_size, SLAB_SIZE, MAX_SIZE);
-			return 0;
+		if (table) {
+			// Reuse a completely free slab from the shared table.
+			// These are in its last list, together with the large chunks of partially used slabs.
+			dagdb_pointer list = CHUNK_TABLE_LOCATION(0, CHUNK_TABLE_SIZE-1);
+			for (dagdb_pointer c = LOCATE(FreeMemoryChunk, list)->next; c != list; c = LOCATE(FreeMemoryChunk, c)->next) {
+				if ((c & (g.size-1)) == 0 && LOCATE(FreeMemoryChunk, c)->size == dagdb_slab_useable(g)) {
+					r = c;
+					dagdb_chunk_remove(r, dagdb_slab_useable(g));
+					break;
+				}
+			}
 		}
-		if (ftruncate(dagdb_database_fd, new_size)) {
-			dagdb_errno = DAGDB_ERROR_DB_TOO_LARGE;
-			dagdb_report_p("Failed to grow database file to %lub", new_size);
-			return 0;
+		if (!r) {
+			// Allocate the memory in a newly created slab.
+			r = dagdb_grow(g.size);
+			if (!r) return 0;
+			LOCATE(Header, 0)->slab_occupancy[0]++;
 		}
-		dagdb_database_size = new_size;
 		
 		// Insert the unused part of the slab in the free chunk table.
-		dagdb_chunk_insert(r+length, SLAB_USEABLE_SPACE_SIZE-length);
+		dagdb_chunk_insert(table, r+length, dagdb_slab_useable(g)-length);
 	}
 	assert((r % S) == 0);
 	// Mark the bitmap.
-	dagdb_bitmap_mark(r,length,1);
+	dagdb_bitmap_mark(g,r,length,1);
+	LOCATE(Header, 0)->type_bytes[type] += length;
 #ifdef DAGDB_HARDEN_MALLOC
 	for (uint64_t i=0; i<length; i+=8) {
 		*LOCATE(uint64_t, r+i) = random();
@@ -310,109 +740,313 @@ dagdb_pointer dagdb_malloc(dagdb_size length) {
 #endif // DAGDB_HARDEN_MALLOC
 	return r;
 }
+
+/**
+ * Allocates the requested amount of bytes for a structure of the given pointer type.
+ * If type segregation is enabled, the memory is taken from slabs that only contain structures of this type.
+ * The returned pointer does not contain the type information.
+ * @see dagdb_malloc
+ */
+dagdb_pointer dagdb_malloc_typed(dagdb_size length, uint_fast32_t type) {
+	return WITH_SLAB_GEOMETRY(dagdb_malloc_slab, length, type);
+}
 STATIC_ASSERT(MAX_CHUNK_SIZE % S == 0, chunk_size_multiple_of_S);
 
+/**
+ * Number of slabs before the slab of the hint that dagdb_malloc_near inspects.
+ */
+#define NEAR_SLABS 2
+
+/**
+ * Implementation of dagdb_malloc_near for slabs with the given geometry.
+ */
+static ALWAYS_INLINE dagdb_pointer dagdb_malloc_near_slab(SlabGeometry g, dagdb_size length, uint_fast32_t type, dagdb_pointer hint) {
+	assert(type < CHUNK_TABLE_COUNT);
+	uint_fast32_t table = dagdb_chunk_table(type);
+	if (hint < HEADER_SIZE || length > MAX_CHUNK_SIZE || dagdb_get_pointer_type(hint) == DAGDB_TYPE_DATA || dagdb_chunk_table(hint) != table) {
+		return dagdb_malloc_typed(length, type);
+	}
+	length = dagdb_round_up(length);
+	hint &= ~DAGDB_TYPE_MASK;
+	dagdb_pointer slab = hint & ~(g.size-1);
+	// In the slab of the hint, search the free ranges after the hint first.
+	int_fast32_t start = (hint - slab)/S;
+	assert(dagdb_bitarray_read(dagdb_slab_bitmap(g, slab), start));
+	// The slabs before that of the hint might belong to another free chunk table.
+	int_fast32_t slabs = dagdb_current_options.segregate_types ? 0 : NEAR_SLABS;
+	for (int_fast32_t i = 0; ; i++) {
+		dagdb_size extent = *dagdb_slab_extent(g, slab);
+		if (extent) {
+			// This is the last slab of an extent, which has no free space.
+			slab -= (extent - 1) * g.size;
+		} else if (g.bitmap_size - *dagdb_slab_used(g, slab) >= length/S) {
+			dagdb_bitarray * bitmap = dagdb_slab_bitmap(g, slab);
+			int_fast32_t found = dagdb_bitarray_find_run(bitmap, start, g.bitmap_size - start, length/S, 0);
+			if (found < 0) found = dagdb_bitarray_find_run(bitmap, 0, start, length/S, 0);
+			if (found >= 0) {
+				// The bit before the run is in use, hence the run is the start of a free range.
+				dagdb_pointer r = slab + found*S;
+				dagdb_size size = dagdb_free_right(g, r);
+				assert(size >= length);
+				if (size >= MIN_CHUNK_SIZE) dagdb_chunk_remove(r, size);
+				if (size - length >= MIN_CHUNK_SIZE) dagdb_chunk_insert(table, r + length, size - length);
+				dagdb_bitmap_mark(g, r, length, 1);
+				LOCATE(Header, 0)->type_bytes[type] += length;
+				dagdb_counter.allocations_near++;
+#ifdef DAGDB_HARDEN_MALLOC
+				for (uint64_t j=0; j<length; j+=8) {
+					*LOCATE(uint64_t, r+j) = random();
+				}
+#endif // DAGDB_HARDEN_MALLOC
+				return r;
+			}
+		}
+		// Continue with the slab before this one. 
+		// The slabs after the hint are not inspected, as the first slab of an extent cannot be recognized.
+		if (i == slabs || slab == 0) break;
+		slab -= g.size;
+		start = 0;
+	}
+	return dagdb_malloc_typed(length, type);
+}
+
+/**
+ * Allocates the requested amount of bytes for a structure of the given pointer type, close to the structure the hint points to,
+ * such that related structures share pages.
+ * The memory is taken from the first free range that is large enough in the slab of the hint, 
+ * or otherwise in one of the NEAR_SLABS slabs before it. With type segregation enabled, only the slab of the hint is used.
+ * The hint must be 0 or a pointer with type information to a structure that is in use. 
+ * Hints that point to data are ignored, as data can be stored in an extent, which has no bitmap. 
+ * For the same reason, the hint must not point to another structure that is stored in an extent.
+ * With type segregation enabled, hints of another type are ignored as well.
+ * If the hint is ignored, or there is no room near it, this behaves like dagdb_malloc_typed.
+ * @see dagdb_malloc_typed
+ */
+dagdb_pointer dagdb_malloc_near(dagdb_size length, uint_fast32_t type, dagdb_pointer hint) {
+	return WITH_SLAB_GEOMETRY(dagdb_malloc_near_slab, length, type, hint);
+}
+
+/**
+ * Implementation of dagdb_realloc for slabs with the given geometry.
+ */
+static ALWAYS_INLINE dagdb_pointer dagdb_realloc_slab(SlabGeometry g, dagdb_pointer location, dagdb_size oldlength, dagdb_size newlength) {
+	dagdb_pointer type = dagdb_get_pointer_type(location);
+	location &= ~DAGDB_TYPE_MASK;
+	assert(type < CHUNK_TABLE_COUNT);
+	assert(location>=HEADER_SIZE);
+	assert(location+oldlength<=dagdb_database_size);
+	if (oldlength > MAX_CHUNK_SIZE || newlength > MAX_CHUNK_SIZE) {
+		if (oldlength > MAX_CHUNK_SIZE && newlength > MAX_CHUNK_SIZE && EXTENT_SLABS(oldlength) == EXTENT_SLABS(newlength)) {
+			LOCATE(Header, 0)->type_bytes[type] += dagdb_round_up(newlength) - dagdb_round_up(oldlength);
+			return location | type;
+		}
+		goto move;
+	}
+	oldlength = dagdb_round_up(oldlength);
+	newlength = dagdb_round_up(newlength);
+	
+	if (newlength <= oldlength) {
+		// Shrink in place by releasing the tail.
+		if (newlength < oldlength) {
+			dagdb_bitmap_mark(g, location + newlength, oldlength - newlength, 0);
+			dagdb_chunk_release(g, dagdb_chunk_table(type), location + newlength, oldlength - newlength);
+			LOCATE(Header, 0)->type_bytes[type] -= oldlength - newlength;
+		}
+		return location | type;
+	}
+	
+	// Grow in place if the memory right of the chunk is free.
+	dagdb_size extra = newlength - oldlength;
+	dagdb_size size = dagdb_free_right(g, location + oldlength);
+	if (size >= extra) {
+		if (size >= MIN_CHUNK_SIZE) dagdb_chunk_remove(location + oldlength, size);
+		if (size - extra >= MIN_CHUNK_SIZE) dagdb_chunk_insert(dagdb_chunk_table(type), location + newlength, size - extra);
+		dagdb_bitmap_mark(g, location + oldlength, extra, 1);
+		LOCATE(Header, 0)->type_bytes[type] += extra;
+#ifdef DAGDB_HARDEN_MALLOC
+		for (uint64_t i=oldlength; i<newlength; i+=8) {
+			*LOCATE(uint64_t, location+i) = random();
+		}
+#endif // DAGDB_HARDEN_MALLOC
+		return location | type;
+	}
+	
+	// Move the data to a new chunk.
+	move:;
+	dagdb_pointer r = dagdb_malloc_typed(newlength, type);
+	if (!r) return 0;
+	memcpy(LOCATE(void, r), LOCATE(void, location), oldlength < newlength ? oldlength : newlength);
+	dagdb_free(location | type, oldlength);
+	return r | type;
+}
+
 /**
  * Enlarges or shrinks the provided memory such that its size is the given amount of bytes.
- * If the current data must be moved to a different location, this function will perform that move.
- * Note that the new allocated memory might be at a different location (even if shrinking).
+ * Shrinking always happens in place. Growing happens in place if the memory directly 
+ * following the chunk is free and sufficiently large. Otherwise, the data is moved to a 
+ * newly allocated chunk and the old chunk is freed.
  * When growing, the newly allocated bits remain uninitialized.
- * TODO (med): unimplemented / implement realloc
+ * The type information of the pointer is preserved.
+ * Extents are resized in place as long as the number of slabs does not change.
+ * 
+ * @return A pointer to the resized memory, 0 in case of an error. In the latter case the
+ * provided memory is left untouched.
  */
 dagdb_pointer dagdb_realloc(dagdb_pointer location, dagdb_size oldlength, dagdb_size newlength) {
-	return 0;
+	return WITH_SLAB_GEOMETRY(dagdb_realloc_slab, location, oldlength, newlength);
 }
 
-#define CHECK_BIT(a) (((a)<0) || (((unsigned)a)>=BITMAP_SIZE) || dagdb_bitarray_read(slab->bitmap,(a)))
-
 /**
- * Frees the provided memory.
- * Currently only zero's out the memory range.
- * This function also strips off the type information before freeing.
- * The chunk is put back in a pool, such that it can be reused by malloc. 
- * If free chunks are next to the chunk being released, then these chunks are merged.
- * If the last chunk used in the last slab is removed, then that slab is,
- * and all empty slabs that come directly before that are, truncated.
+ * Implementation of dagdb_free for slabs with the given geometry.
  */
-void dagdb_free(dagdb_pointer location, dagdb_size length) {
+static ALWAYS_INLINE void dagdb_free_slab(SlabGeometry g, dagdb_pointer location, dagdb_size length) {
 	// Strip type information
+	uint_fast32_t table = dagdb_chunk_table(location);
+	LOCATE(Header, 0)->type_bytes[dagdb_get_pointer_type(location)] -= dagdb_round_up(length);
 	location &= ~DAGDB_TYPE_MASK;
 	// Do sanity checks
 	assert(location>=HEADER_SIZE);
 	assert(location+length<=dagdb_database_size);
-	assert(location % SLAB_SIZE + length <= SLAB_USEABLE_SPACE_SIZE);
-	// Clear memory
-	length = dagdb_round_up(length);
-	memset(dagdb_file + location, 0, dagdb_round_up(length));
-	
-	// Free range in bitmap.
-	dagdb_bitmap_mark(location, length, 0);
+	if (length > MAX_CHUNK_SIZE) {
+		dagdb_extent_free(location, length);
+	} else {
+		assert((location & (g.size-1)) + length <= dagdb_slab_useable(g));
+		length = dagdb_round_up(length);
+		
+		// Free range in bitmap and put it back in the free chunk table.
+		dagdb_bitmap_mark(g, location, length, 0);
+		dagdb_chunk_release(g, table, location, length);
+	}
 	
-	// TODO (med): move left and right chunk elimination to a separate function, such that it can be reused in realloc.
-	int_fast32_t bit;
-	uint_fast32_t size;
-	// Check for free chunk left.
-	MemorySlab * slab = LOCATE(MemorySlab, location & ~(SLAB_SIZE-1));
-	bit = (location % SLAB_SIZE)/S;
-	size = 0;
-	if (!CHECK_BIT(bit-1)) {
-		if (!CHECK_BIT(bit-2)) {
-			if (!CHECK_BIT(bit-3)) {
-				size = *LOCATE(dagdb_size, location - S);
-				assert(size>=3*S);
-				assert(size<=location%SLAB_SIZE);
-				assert(size==*LOCATE(dagdb_size, location - size + 2*S));
-			} else {
-				size = 2*S;
-			}
-			dagdb_chunk_remove(location - size);
+	// Reduce database size if possible.
+	dagdb_size new_size = dagdb_database_size;
+	while (dagdb_slab_empty(g, new_size - g.size)) {
+		new_size -= g.size;
+		// Remove chunk from table and clear its administration, 
+		// such that the space beyond the end of the database does not look like a free chunk.
+		dagdb_chunk_remove(new_size, dagdb_slab_useable(g));
+		LOCATE(Header, 0)->slab_occupancy[0]--;
+		memset(LOCATE(void, new_size), 0, sizeof(FreeMemoryChunk));
+		*LOCATE(dagdb_size, new_size + dagdb_slab_useable(g) - S) = 0;
+	}
+	assert(new_size >= g.size);
+	assert(new_size <= dagdb_database_size);
+	assert((new_size & (g.size-1)) == 0);
+	if (new_size < dagdb_database_size) {
+		dagdb_database_size = new_size;
+		// Only shrink the file if too much unused space would be retained.
+		if (dagdb_file_size - new_size > dagdb_current_options.retention) {
+			dagdb_trim();
 		} else {
-			size = S;
+			dagdb_counter.truncations_avoided++;
 		}
 	}
-	location -= size;
-	length += size;
+}
 
-	// Check for free chunk right.
-	bit = (location % SLAB_SIZE + length)/S;
-	size = 0;
-	if (!CHECK_BIT(bit)) {
-		if (!CHECK_BIT(bit+1)) {
-			if (!CHECK_BIT(bit+2)) {
-				size = LOCATE(FreeMemoryChunk, location + length)->size;
-				assert(size>=3*S);
-				assert(location%SLAB_SIZE + length + size<=SLAB_USEABLE_SPACE_SIZE);
-				assert(size==*LOCATE(dagdb_size, location + length + size - S));
-			} else {
-				size = 2*S;
-			}
-			dagdb_chunk_remove(location + length);
-		} else {
-			size = S;
-		}
+/**
+ * Frees the provided memory.
+ * The memory is not cleared, as the next user of the memory has to initialize it anyway.
+ * This function also strips off the type information before freeing.
+ * The chunk is put back in a pool, such that it can be reused by malloc. 
+ * If free chunks are next to the chunk being released, then these chunks are merged.
+ * Extents are released by turning their slabs into empty slabs.
+ * If the last chunk used in the last slab is removed, then that slab is,
+ * and all empty slabs that come directly before that are, truncated.
+ */
+void dagdb_free(dagdb_pointer location, dagdb_size length) {
+	WITH_SLAB_GEOMETRY(dagdb_free_slab, location, length);
+}
+
+/**
+ * Truncates the unused space at the end of the database file.
+ * @return 0 if successful.
+ */
+int dagdb_trim() {
+	if (dagdb_file_size == dagdb_database_size) return 0;
+	dagdb_counter.truncation_count++;
+	if (ftruncate(dagdb_database_fd, dagdb_database_size)) {
+		dagdb_errno = DAGDB_ERROR_OTHER;
+		dagdb_report_p("Failed to shrink database file to %lub", dagdb_database_size);
+		return -1;
 	}
-	length += size;
+	dagdb_file_size = dagdb_database_size;
+	return 0;
+}
 
-	// Add chunk to free chunk table.
-	dagdb_chunk_insert(location, length);
-	
-	// Reduce file size if possible.
-	dagdb_size new_size = dagdb_database_size;
-	while (SLAB_USEABLE_SPACE_SIZE == *LOCATE(dagdb_size, new_size - SLAB_SIZE + SLAB_USEABLE_SPACE_SIZE - S)) {
-		new_size -= SLAB_SIZE;
-		// Remove chunk from table.
-		dagdb_chunk_remove(new_size);
+/**
+ * Copies the memory management counters of the currently opened database.
+ */
+void dagdb_get_counters(dagdb_counters * counters) {
+	*counters = dagdb_counter;
+}
+
+/**
+ * Fills in the memory related fields of the statistics.
+ * These are read from the administration in the header, which is kept up to date by the allocator.
+ */
+void dagdb_memory_stats(dagdb_statistics * stats) {
+	Header * h = LOCATE(Header, 0);
+	stats->file_size = dagdb_file_size;
+	stats->database_size = dagdb_database_size;
+	stats->slab_size = SLAB_SIZE;
+	stats->root_table_bits = h->root_nibbles > 1 ? 4 * h->root_nibbles : 0;
+	stats->live_bytes = 0;
+	for (int_fast32_t i = 0; i < CHUNK_TABLE_COUNT; i++) {
+		stats->type_bytes[i] = h->type_bytes[i];
+		stats->live_bytes += h->type_bytes[i];
 	}
-	assert(new_size >= SLAB_SIZE);
-	assert(new_size <= dagdb_database_size);
-	assert(new_size % SLAB_SIZE == 0);
-	if (new_size < dagdb_database_size) {
-		if (ftruncate(dagdb_database_fd, new_size)) {
-			dagdb_errno = DAGDB_ERROR_OTHER;
-			dagdb_report_p("Failed to shrink database file to %lub", new_size);
-		}
-		dagdb_database_size = new_size;
+	for (int_fast32_t i = 0; i < CHUNK_TABLE_SIZE; i++) {
+		stats->free_bytes[i] = h->free_bytes[i];
+	}
+	for (int_fast32_t i = 0; i < DAGDB_STATS_OCCUPANCY_BUCKETS; i++) {
+		stats->slab_occupancy[i] = h->slab_occupancy[i];
+	}
+	stats->extent_slabs = h->extent_slabs;
+}
+
+
+////////////////////
+// Mapping advice //
+////////////////////
+
+/**
+ * Asks the kernel to read the given memory range of the database ahead, such that accessing it causes fewer page faults.
+ * This returns immediately and has no effect if the range is already in memory.
+ */
+void dagdb_prefetch(const void * address, dagdb_size length) {
+	dagdb_pointer location = (const char*)address - (const char*)dagdb_file;
+	dagdb_pointer start = location & ~(dagdb_pointer)(PAGE_SIZE-1);
+	madvise(LOCATE(void, start), location + length - start, MADV_WILLNEED);
+}
+
+/**
+ * Reads and maps the first length bytes of the database, such that accessing these does not cause page faults.
+ * Uses MADV_POPULATE_READ and falls back to touching each page on kernels that do not support it.
+ */
+static void dagdb_populate(dagdb_size length) {
+	dagdb_prefetch(dagdb_file, length);
+#ifdef MADV_POPULATE_READ
+	if (madvise(dagdb_file, length, MADV_POPULATE_READ) == 0) return;
+#endif
+	volatile const char * p = dagdb_file;
+	for (dagdb_size i = 0; i < length; i += PAGE_SIZE) (void)p[i];
+}
+
+/**
+ * Applies the huge page, access pattern and populate options to the mapping of the loaded database.
+ * Failures are ignored, as the advice only affects performance.
+ */
+static void dagdb_advise_mapping() {
+	static const int advice[] = {MADV_NORMAL, MADV_RANDOM, MADV_SEQUENTIAL};
+	if (dagdb_current_options.huge_pages) {
+		madvise(dagdb_file, dagdb_mapping_size, MADV_HUGEPAGE);
+	}
+	if (dagdb_current_options.access_pattern != DAGDB_ACCESS_NORMAL) {
+		madvise(dagdb_file, dagdb_mapping_size, advice[dagdb_current_options.access_pattern]);
 	}
+	dagdb_size length = dagdb_current_options.populate;
+	if (length > dagdb_database_size) length = dagdb_database_size;
+	if (length > 0) dagdb_populate(length);
 }
 
 
@@ -426,27 +1060,125 @@ void dagdb_free(dagdb_pointer location, dagdb_size length) {
 static void dagdb_initialize_header(Header* h) {
 	h->magic = DAGDB_MAGIC;
 	h->format_version = FORMAT_VERSION;
+	h->slab_size = SLAB_SIZE;
+	h->root_nibbles = dagdb_current_options.root_table_bits ? dagdb_current_options.root_table_bits / 4 : 1;
+	h->filter_bits_per_key = dagdb_current_options.filter_bits_per_key;
+	h->segregate_types = dagdb_current_options.segregate_types != 0;
 	
-	// Self-link all items in the free chunk table.
-	for (int_fast32_t i=0; i<CHUNK_TABLE_SIZE; i++) {
-		dagdb_pointer pos = CHUNK_TABLE_LOCATION(i);
-		assert(pos < HEADER_SIZE);
-		FreeMemoryChunk * m = LOCATE(FreeMemoryChunk, pos);
-		m->prev = m->next = CHUNK_TABLE_LOCATION(i);
+	// Self-link all items in the free chunk tables.
+	for (int_fast32_t t=0; t<CHUNK_TABLE_COUNT; t++) {
+		for (int_fast32_t i=0; i<CHUNK_TABLE_SIZE; i++) {
+			dagdb_pointer pos = CHUNK_TABLE_LOCATION(t, i);
+			assert(pos < HEADER_SIZE);
+			FreeMemoryChunk * m = LOCATE(FreeMemoryChunk, pos);
+			m->prev = m->next = pos;
+		}
 	}
 	
 	// Insert the unused part of the slab in the free chunk table.
-	dagdb_chunk_insert(HEADER_SIZE, SLAB_USEABLE_SPACE_SIZE-HEADER_SIZE);
+	dagdb_chunk_insert(0, HEADER_SIZE, SLAB_USEABLE_SPACE_SIZE-HEADER_SIZE);
 	
 	// Mark header as used in bitmap
-	dagdb_bitmap_mark(0, HEADER_SIZE, 1);
+	h->slab_occupancy[0] = 1;
+	dagdb_bitmap_mark(dagdb_slab, 0, HEADER_SIZE, 1);
 }
 
 /**
- * Opens the given file. Creates it if it does not yet exist.
+ * Checks that the given header, of a file of the given size, belongs to a database that this library can open.
+ * The header is only read, such that it can be checked in a read-only mapping.
+ * @returns 0 if the header is valid. Otherwise, the error is reported and -1 is returned.
+ */
+int dagdb_check_header(const Header* h, dagdb_size size) {
+	if(size < MIN_SLAB_SIZE) {
+		dagdb_report("File has unexpected size %lu", size);
+		return -1;
+	}
+	if(h->magic!=DAGDB_MAGIC) {
+		dagdb_report("File has invalid magic");
+		return -1;
+	}
+	if(h->format_version!=FORMAT_VERSION) {
+		dagdb_report("File has incompatible format version");
+		return -1;
+	}
+	if(!dagdb_valid_slab_size(h->slab_size)) {
+		dagdb_report("File has invalid slab size %lu", h->slab_size);
+		return -1;
+	}
+	if(h->root_nibbles < 1 || h->root_nibbles > DAGDB_MAX_ROOT_TABLE_BITS / 4) {
+		dagdb_report("File has invalid root table size %lu", h->root_nibbles);
+		return -1;
+	}
+	if(h->filter_bits_per_key > DAGDB_MAX_FILTER_BITS_PER_KEY || (h->filter && (
+		h->filter < HEADER_SIZE || h->filter >= size || h->filter_blocks < FILTER_MIN_BLOCKS || (h->filter_blocks & (h->filter_blocks - 1)) || 
+		h->filter_blocks > (size - h->filter) / FILTER_BLOCK_SIZE
+	))) {
+		dagdb_report("File has invalid filter");
+		return -1;
+	}
+	// database size must be a multiple of the slab size
+	if((size & (h->slab_size-1))!=0) {
+		dagdb_report("File has unexpected size %lu", size);
+		return -1;
+	}
+	if(h->root!=0) {
+		if (h->root<HEADER_SIZE) {
+			dagdb_report("File has invalid root pointer");
+			return -1;
+		}
+		if(h->root>=size) {
+			dagdb_report("File has invalid root pointer");
+			return -1;
+		}
+		if(dagdb_get_pointer_type(h->root) != DAGDB_TYPE_TRIE) {
+			dagdb_report("File has invalid root pointer");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Opens the given file with the default options. Creates it if it does not yet exist.
  * @returns 0 if successful.
  */
 int dagdb_load(const char *database) {
+	return dagdb_load_options(database, &dagdb_default_options);
+}
+
+/**
+ * Opens the given file using the given options. Creates it if it does not yet exist.
+ * @returns 0 if successful.
+ */
+int dagdb_load_options(const char *database, const dagdb_options *options) {
+	if (options->access_pattern > DAGDB_ACCESS_SEQUENTIAL) {
+		dagdb_errno = DAGDB_ERROR_BAD_ARGUMENT;
+		dagdb_report("Invalid access pattern %u", options->access_pattern);
+		return -1;
+	}
+	if (options->slab_size && !dagdb_valid_slab_size(options->slab_size)) {
+		dagdb_errno = DAGDB_ERROR_BAD_ARGUMENT;
+		dagdb_report("Invalid slab size %lu", options->slab_size);
+		return -1;
+	}
+	if (options->root_table_bits % 4 || (options->root_table_bits && (options->root_table_bits < 8 || options->root_table_bits > DAGDB_MAX_ROOT_TABLE_BITS))) {
+		dagdb_errno = DAGDB_ERROR_BAD_ARGUMENT;
+		dagdb_report("Invalid root table size of %u bits", options->root_table_bits);
+		return -1;
+	}
+	if (options->filter_bits_per_key > DAGDB_MAX_FILTER_BITS_PER_KEY) {
+		dagdb_errno = DAGDB_ERROR_BAD_ARGUMENT;
+		dagdb_report("Invalid filter size of %u bits per key", options->filter_bits_per_key);
+		return -1;
+	}
+	if (options->index_threads > DAGDB_MAX_INDEX_THREADS) {
+		dagdb_errno = DAGDB_ERROR_BAD_ARGUMENT;
+		dagdb_report("Invalid number of %u index threads", options->index_threads);
+		return -1;
+	}
+	dagdb_current_options = *options;
+	memset(&dagdb_counter, 0, sizeof(dagdb_counter));
+
 	// Open the database file
 	int_fast32_t fd = open(database, O_RDWR | O_CREAT, 0644);
 	if (fd == -1) {
@@ -454,65 +1186,56 @@ int dagdb_load(const char *database) {
 		goto error;
 	}
 
-	// Map database into memory
-	dagdb_file = mmap(NULL, MAX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (dagdb_file == MAP_FAILED) {
-		dagdb_report_p("Cannot map file to memory");
-		goto error;
-	}
-
 	// Obtain length of database file
-	dagdb_database_size = lseek(fd, 0, SEEK_END);
-	if (dagdb_database_size>MAX_SIZE) {
-		dagdb_report("File exceeds hardcoded size limit %lu > %u", dagdb_database_size, MAX_SIZE);
-		goto error;
-	}
+	dagdb_database_size = dagdb_file_size = lseek(fd, 0, SEEK_END);
 	
-	// database size must be a multiple of SLAB_SIZE
-	if((dagdb_database_size%SLAB_SIZE)!=0) {
-		dagdb_report("File has unexpected size %lu", dagdb_database_size);
-		goto error;
+	// Map database into memory. 
+	// Reserve as much address space as the system allows, such that the mapping rarely needs to grow.
+	dagdb_mapping_size = RESERVE_SIZE;
+	while (dagdb_mapping_size < dagdb_database_size) dagdb_mapping_size *= 2;
+	for (;;) {
+		dagdb_file = mmap(NULL, dagdb_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+		if (dagdb_file != MAP_FAILED) break;
+		if (dagdb_mapping_size/2 < dagdb_database_size || dagdb_mapping_size/2 < MIN_RESERVE_SIZE) {
+			dagdb_report_p("Cannot map file to memory");
+			goto error;
+		}
+		dagdb_mapping_size /= 2;
 	}
-	
+
 	Header* h = LOCATE(Header,0);
 	if (dagdb_database_size == 0) {
 		// Database is freshly created, initialize header.
+		dagdb_slab = dagdb_slab_geometry(options->slab_size ? options->slab_size : DEFAULT_SLAB_SIZE);
 		dagdb_database_fd = fd;
 		if (ftruncate(fd, SLAB_SIZE)) {
-			dagdb_report_p("Could not allocate %db diskspace for database", SLAB_SIZE);
+			dagdb_report_p("Could not allocate %lub diskspace for database", SLAB_SIZE);
 			goto error;
 		}
-		dagdb_database_size = SLAB_SIZE;
+		dagdb_database_size = dagdb_file_size = SLAB_SIZE;
 		dagdb_initialize_header(h);
 		assert(h->root==0);
 	} else {
 		// Check headers.
-		if(h->magic!=DAGDB_MAGIC) {
-			dagdb_report("File has invalid magic");
-			goto error;
-		}
-		if(h->format_version!=FORMAT_VERSION) {
-			dagdb_report("File has incompatible format version");
-			goto error;
-		}
-		if(h->root!=0) {
-			if (h->root<HEADER_SIZE) {
-				dagdb_report("File has invalid root pointer");
-				goto error;
-			}
-			if(h->root>=dagdb_database_size) {
-				dagdb_report("File has invalid root pointer");
-				goto error;
-			}
-			if(dagdb_get_pointer_type(h->root) != DAGDB_TYPE_TRIE) {
-				dagdb_report("File has invalid root pointer");
-				goto error;
-			}
-		}
+		if (dagdb_check_header(h, dagdb_database_size)) goto error;
+		dagdb_slab = dagdb_slab_geometry(h->slab_size);
+		// The free chunks of a database are kept in the tables it was created with.
+		dagdb_current_options.segregate_types = h->segregate_types;
 		dagdb_database_fd = fd;
+		
+		// Skip the preallocated empty slabs at the end of the file.
+		while (dagdb_database_size > SLAB_SIZE && dagdb_slab_empty(dagdb_slab, dagdb_database_size - SLAB_SIZE)) {
+			dagdb_database_size -= SLAB_SIZE;
+		}
 	}
 
 	// Database opened successfully.
+	dagdb_advise_mapping();
+	if (options->index_threads && dagdb_index_build(options->index_threads)) {
+		// The error has been reported by dagdb_index_build.
+		dagdb_unload();
+		return -1;
+	}
 	return 0;
 
 error:
@@ -520,7 +1243,7 @@ error:
 	// At this point the error message must have been set already.
 	dagdb_errno = DAGDB_ERROR_INVALID_DB;
 	if (dagdb_file!=MAP_FAILED) {
-		munmap(dagdb_file, MAX_SIZE);
+		munmap(dagdb_file, dagdb_mapping_size);
 		dagdb_file = MAP_FAILED;
 	}
 	if (fd != -1) close(fd);
@@ -532,8 +1255,9 @@ error:
  * Does nothing if no database file is currently open.
  */
 void dagdb_unload() {
+	dagdb_index_free();
 	if (dagdb_file!=MAP_FAILED) {
-		munmap(dagdb_file, MAX_SIZE);
+		munmap(dagdb_file, dagdb_mapping_size);
 		dagdb_file = MAP_FAILED;
 		//printf("Unmapped DB\n");
 	}
@@ -39,17 +39,41 @@
  */
 #define LOCATE(type,location) ((type*)(dagdb_file+((location)&~DAGDB_TYPE_MASK)))
 
+/**
+ * Number of low bits of a pointer that can be in use. The bits above are free to carry other information, 
+ * which is used by the leaves of tries. Hence, this limits the size of a database.
+ */
+#define DAGDB_POINTER_BITS 48
+
 /**
  * The amount of space (in bytes) reserved for the database header. 
+ * This leaves room for the header to grow, such that new fields do not move the data after it.
  * Defined in the header, as it is often used in assertions.
  */
-#define HEADER_SIZE 512
+#define HEADER_SIZE 4096
 
 /**
  * Length of the free memory chunk lists table.
  */
 #define CHUNK_TABLE_SIZE 31
 
+/**
+ * Number of free memory chunk tables. 
+ * When type segregation is enabled, each pointer type allocates from its own table.
+ */
+#define CHUNK_TABLE_COUNT 4
+
+/**
+ * The size of a block of the filter of the keys in the root trie, which is a cache line.
+ */
+#define FILTER_BLOCK_SIZE 64
+
+/**
+ * The least number of blocks of the filter. The filter then exceeds the largest chunk,
+ * such that it is stored in an extent, in slabs of its own.
+ */
+#define FILTER_MIN_BLOCKS 128
+
 /**
  * Stores some basic information about the database.
  * The size of this header cannot exceed HEADER_SIZE.
@@ -61,14 +85,46 @@ typedef struct {
 	uint32_t format_version;
 	/** Pointer to the trie containing all elements. */
 	dagdb_pointer root;
-	/** A list of the linked lists containing free chunks of memory. */
-	dagdb_pointer chunks[2*CHUNK_TABLE_SIZE];
+	/** For each free chunk table, a bitmask telling which of its linked lists are non-empty. */
+	uint64_t chunk_mask[CHUNK_TABLE_COUNT];
+	/** The free chunk tables, each a list of the linked lists containing free chunks of memory. */
+	dagdb_pointer chunks[CHUNK_TABLE_COUNT][2*CHUNK_TABLE_SIZE];
+	/** The number of bytes allocated for each pointer type. */
+	dagdb_size type_bytes[CHUNK_TABLE_COUNT];
+	/** The number of bytes in free chunks, for each size class, summed over all free chunk tables. */
+	dagdb_size free_bytes[CHUNK_TABLE_SIZE];
+	/** Histogram of the number of slabs by their occupancy. */
+	dagdb_size slab_occupancy[DAGDB_STATS_OCCUPANCY_BUCKETS];
+	/** The number of slabs that are part of an extent. */
+	dagdb_size extent_slabs;
+	/** The size of the slabs (in bytes), which is chosen when the database is created. */
+	dagdb_size slab_size;
+	/** The number of leading key nibbles that select a slot in the top of the root trie, which is 1 without root table. */
+	dagdb_size root_nibbles;
+	/** Pointer to the filter of the keys in the root trie, or 0 if it has not been built. */
+	dagdb_pointer filter;
+	/** The number of blocks of the filter, which is a power of two. */
+	dagdb_size filter_blocks;
+	/** The number of keys that were added to the filter since it was built. */
+	dagdb_size filter_keys;
+	/** The minimum number of filter bits per key, or 0 if the database has no filter. */
+	dagdb_size filter_bits_per_key;
+	/** Whether each pointer type has its own free chunk table, see dagdb_options::segregate_types. */
+	dagdb_size segregate_types;
 } Header;
 
 extern void* dagdb_file;
 
-dagdb_pointer dagdb_malloc (dagdb_size length);
-dagdb_pointer dagdb_realloc(dagdb_pointer location, dagdb_size oldlength, dagdb_size newlength);
-void          dagdb_free   (dagdb_pointer location, dagdb_size length);
+dagdb_pointer dagdb_malloc      (dagdb_size length);
+dagdb_pointer dagdb_malloc_typed(dagdb_size length, uint_fast32_t type);
+dagdb_pointer dagdb_malloc_near (dagdb_size length, uint_fast32_t type, dagdb_pointer hint);
+dagdb_pointer dagdb_realloc     (dagdb_pointer location, dagdb_size oldlength, dagdb_size newlength);
+void          dagdb_free        (dagdb_pointer location, dagdb_size length);
+void          dagdb_memory_stats(dagdb_statistics * stats);
+int           dagdb_check_header(const Header* h, dagdb_size size);
+
+// The hash index is implemented in base.c, as it is built from the root trie.
+int           dagdb_index_build (uint32_t threads);
+void          dagdb_index_free  ();
 
 #endif
@@ -21,4 +21,173 @@
 #include <stdint.h>
 typedef uint64_t dagdb_size;
 typedef uint64_t dagdb_pointer;
+
+/** Access patterns that can be advised for the mapping of the database. */
+typedef enum {
+	DAGDB_ACCESS_NORMAL,
+	DAGDB_ACCESS_RANDOM,
+	DAGDB_ACCESS_SEQUENTIAL,
+} dagdb_access_pattern;
+
+/**
+ * Settings that can be provided when opening a database with dagdb_load_options.
+ * Start from dagdb_default_options and modify the fields of interest.
+ */
+typedef struct {
+	/** 
+	 * Minimum amount of bytes that the database file grows with when it runs out of space.
+	 * Rounded up to a multiple of the slab size.
+	 */
+	uint64_t growth_min;
+	/** Maximum amount of bytes that the database file grows with at once. */
+	uint64_t growth_max;
+	/** Amount the database file grows with, as a percentage of its current size. */
+	uint32_t growth_percent;
+	/** 
+	 * Amount of unused bytes that dagdb_free keeps at the end of the database file, 
+	 * such that they can be reused without growing the file again.
+	 * The file is truncated once more space becomes unused, or when dagdb_trim is called.
+	 */
+	uint64_t retention;
+	/**
+	 * If non-zero, data, elements, tries and kvpairs are allocated from separate slabs.
+	 * This keeps the structures that are visited during lookups close together.
+	 * A database that already exists keeps the allocation it was created with and ignores this option.
+	 */
+	uint32_t segregate_types;
+	/**
+	 * If non-zero, the storage of slabs in the middle of the file that become completely free
+	 * is given back to the filesystem.
+	 */
+	uint32_t release_slabs;
+	/**
+	 * If non-zero, the kernel is asked to back the mapping of the database with transparent huge pages,
+	 * which reduces TLB misses during random lookups. This only has effect if the filesystem supports it.
+	 */
+	uint32_t huge_pages;
+	/**
+	 * The access pattern that is advised for the mapping of the database, one of dagdb_access_pattern.
+	 * DAGDB_ACCESS_RANDOM disables readahead, such that every page that is not cached is read on its own. 
+	 * Nearby trie nodes are then no longer read along, which makes lookups in a database that is not cached 
+	 * slower, hence it is not recommended for trie lookups. 
+	 * Large reads of data are still read ahead, regardless of this option.
+	 */
+	uint32_t access_pattern;
+	/**
+	 * Amount of bytes at the start of the database that are read and mapped when it is loaded, 
+	 * such that accessing these does not cause page faults. 
+	 * As dagdb_compact places the root trie at the start of the file, this can be used to prefault the root trie.
+	 */
+	uint64_t populate;
+	/**
+	 * Size of the slabs (in bytes) of a newly created database, or 0 for the default of 32KiB. 
+	 * This must be a power of two between 8KiB and 1GiB. Blob heavy databases benefit from large slabs, 
+	 * for example 2MiB slabs that line up with huge pages, while small slabs keep databases with little data small.
+	 * A database that already exists keeps the slab size it was created with and ignores this option.
+	 */
+	uint64_t slab_size;
+	/**
+	 * If non-zero, the top of the root trie of a newly created database is a table of 2^root_table_bits slots, 
+	 * indexed by the leading bits of the key, instead of 16 slots indexed by its first 4 bits. 
+	 * As these levels of the root trie are fully populated in large databases, this replaces the top and 
+	 * the nodes below it by a single load. This must be a multiple of 4 between 8 and DAGDB_MAX_ROOT_TABLE_BITS. 
+	 * A table of 12 bits takes 32KiB and is the recommended size for databases of millions of elements. 
+	 * Tables of 8 and 16 bits make inserts several times slower, as the nodes below them grow large, 
+	 * one child at a time. A table of 16 bits takes 512KiB and only suits databases that are mostly read.
+	 * A database that already exists keeps the root table it was created with and ignores this option.
+	 */
+	uint32_t root_table_bits;
+	/**
+	 * If non-zero, a newly created database keeps a filter of the keys in the root trie, with at least this 
+	 * many bits per key. Lookups in the root trie of keys that are not in the database are then mostly 
+	 * rejected by reading a single cache line of the filter. At 10 bits per key, about 1% of these pass. 
+	 * This must be at most DAGDB_MAX_FILTER_BITS_PER_KEY. 
+	 * A database that already exists keeps its filter, which can be changed with dagdb_filter_rebuild.
+	 */
+	uint32_t filter_bits_per_key;
+	/**
+	 * If non-zero, dagdb_load builds a hash index of the keys in the root trie in anonymous memory, using this 
+	 * many threads. Lookups in the root trie, such as dagdb_find_bytes and dagdb_find_record, then probe the index 
+	 * instead of walking the trie. Inserts and removals in the root trie update the index. It takes about 16 bytes 
+	 * per key and is rebuilt on every load, hence it suits processes that open a database once and mostly read it. 
+	 * This must be at most DAGDB_MAX_INDEX_THREADS. The database file is not affected.
+	 */
+	uint32_t index_threads;
+} dagdb_options;
+
+/** The largest number of bits that can index the root table, see dagdb_options::root_table_bits. */
+#define DAGDB_MAX_ROOT_TABLE_BITS 24
+
+/** The largest number of filter bits per key, see dagdb_options::filter_bits_per_key. */
+#define DAGDB_MAX_FILTER_BITS_PER_KEY 32
+
+/** The largest number of threads that build the hash index, see dagdb_options::index_threads. */
+#define DAGDB_MAX_INDEX_THREADS 16
+
+/**
+ * Counters of the memory management of the currently opened database.
+ * These are reset when a database is loaded.
+ */
+typedef struct {
+	/** The number of syscalls used to enlarge the database file. */
+	uint64_t growth_count;
+	/** The number of times the database file was truncated. */
+	uint64_t truncation_count;
+	/** The number of times unused space at the end of the file was retained instead of truncated. */
+	uint64_t truncations_avoided;
+	/** The number of free slabs whose storage was given back to the filesystem. */
+	uint64_t slabs_released;
+	/** The number of allocations that were placed close to the structure given as hint. */
+	uint64_t allocations_near;
+} dagdb_counters;
+
+/** Number of size classes of free memory chunks. */
+#define DAGDB_STATS_SIZE_CLASSES 31
+/** Number of buckets of the slab occupancy histogram: empty slabs, followed by one bucket per 10% of occupancy. */
+#define DAGDB_STATS_OCCUPANCY_BUCKETS 11
+/** Number of buckets of the trie depth histogram. Keys have 40 nibbles, hence a lookup visits at most 41 levels. */
+#define DAGDB_STATS_DEPTH_BUCKETS 41
+
+/**
+ * Statistics about the storage of the currently opened database, as reported by dagdb_stats.
+ * Apart from the trie depths and the false positive rate of the filter, these are maintained incrementally, 
+ * hence are cheap to obtain.
+ */
+typedef struct {
+	/** The size of the database file. */
+	uint64_t file_size;
+	/** The size of the part of the file that is in use by slabs. */
+	uint64_t database_size;
+	/** The size of a single slab. */
+	uint64_t slab_size;
+	/** The number of bits that index the root table, or 0 if the root trie has a regular top. */
+	uint64_t root_table_bits;
+	/** The number of bytes allocated for structures. */
+	uint64_t live_bytes;
+	/** The number of bytes allocated for data, elements, tries and kvpairs, indexed by pointer type. */
+	uint64_t type_bytes[4];
+	/** The number of bytes in free chunks, for each size class of the free chunk table. */
+	uint64_t free_bytes[DAGDB_STATS_SIZE_CLASSES];
+	/** The number of slabs for each occupancy bucket. Slabs that are part of an extent are not included. */
+	uint64_t slab_occupancy[DAGDB_STATS_OCCUPANCY_BUCKETS];
+	/** The number of slabs that are part of an extent. */
+	uint64_t extent_slabs;
+	/** The number of sampled random keys whose lookup in the root trie ended at the given depth. */
+	uint64_t trie_depth[DAGDB_STATS_DEPTH_BUCKETS];
+	/** The minimum number of filter bits per key, or 0 if the database has no filter. */
+	uint64_t filter_bits_per_key;
+	/** The size of the filter. */
+	uint64_t filter_bytes;
+	/** The number of keys that were added to the filter since it was built, including keys that have been removed since. */
+	uint64_t filter_keys;
+	/** 
+	 * The expected fraction of keys that are not in the database, whose lookup passes the filter. 
+	 * This is computed from the bits that are set in the filter, and is 1 if there is no filter.
+	 */
+	double filter_false_positive_rate;
+	/** The size of the hash index in memory, or 0 if there is none, see dagdb_options::index_threads. */
+	uint64_t index_bytes;
+} dagdb_statistics;
+
+extern const dagdb_options dagdb_default_options;
 #endif
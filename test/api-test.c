@@ -20,6 +20,10 @@
 #include "../src/api.c"
 
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../src/error.h"
+#include "../src/mem.h"
 #include "test.h"
 
 /** Writes the key to the given string buffer. */
@@ -140,17 +144,23 @@ static void test_handle_types() {
 	
 	dagdb_handle d = dagdb_data_create(0,"");
 	EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(d), DAGDB_HANDLE_INVALID);
-	dagdb_handle t = dagdb_trie_create();
+	dagdb_handle t = dagdb_trie_create(0);
 	EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(t), DAGDB_HANDLE_MAP);
 	dagdb_handle el = dagdb_element_create(k, d, t);
 	EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(el), DAGDB_HANDLE_BYTES);
-	dagdb_handle kv = dagdb_kvpair_create(el,el);
+	dagdb_handle m = dagdb_trie_create_pairs(0);
+	int r = dagdb_trie_insert_pair(m, el, el);
+	EX_ASSERT_EQUAL_INT(r, 1);
+	EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(m), DAGDB_HANDLE_MAP);
+	dagdb_handle kv = dagdb_trie_find(m, k);
 	EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(kv), DAGDB_HANDLE_INVALID);
 	dagdb_handle el2 = dagdb_element_create(k, kv, t);
 	EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(el2), DAGDB_HANDLE_INVALID);
 	dagdb_handle el3 = dagdb_element_create(k, t, t);
 	EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(el3), DAGDB_HANDLE_RECORD);
 	EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(dagdb_back_reference(el3)), DAGDB_HANDLE_MAP);
+	dagdb_handle el4 = dagdb_element_create_inline(k, 0, "", t);
+	EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(el4), DAGDB_HANDLE_BYTES);
 }
 
 const char * test_data[] = {
@@ -159,6 +169,8 @@ const char * test_data[] = {
 	"b",
 	"test",
 	"slightly longer data",
+	"32 bytes are kept in the element",
+	"33 bytes are kept in a data chunk",
 	record,
 	record_sorted,
 };
@@ -178,6 +190,8 @@ static void test_data_write() {
 		EX_ASSERT_EQUAL_INT(g,h);
 		EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(g), DAGDB_HANDLE_BYTES);
 		EX_ASSERT_EQUAL_INT(dagdb_bytes_length(g), length);
+		// Short data is stored inline.
+		EX_ASSERT_EQUAL_INT(dagdb_element_data(g) == 0, length <= DAGDB_MAX_INLINE_LENGTH);
 		
 		uint8_t * buffer = malloc(length+11);
 		buffer[length]='#';
@@ -190,7 +204,7 @@ static void test_data_write() {
 		EX_ASSERT_EQUAL_INT(read, length<10?0:length>20?10:length-10);
 		EX_ASSERT_EQUAL_INT(buffer[length],'#');
 		if (length>=20) {
-			CU_ASSERT(memcmp(buffer, test_data[i], 10)==0);
+			CU_ASSERT(memcmp(buffer, test_data[i]+10, 10)==0);
 		}
 		free(buffer);
 	}
@@ -209,7 +223,49 @@ static void test_data_write() {
 		EX_ASSERT_EQUAL_INT(dagdb_get_handle_type(g), DAGDB_HANDLE_BYTES);
 		EX_ASSERT_EQUAL_INT(dagdb_bytes_length(g), length);
 	}
+	
+	// Batched lookups find the written data, and not data that has not been written.
+	const int M = N + 2;
+	uint64_t lengths[M];
+	const char * batch[M];
+	dagdb_handle result[M];
+	for (i=0; i<N; i++) {
+		lengths[i] = strlen(test_data[i]);
+		batch[i] = test_data[i];
+	}
+	lengths[N] = 5;
+	batch[N] = "never";
+	lengths[N+1] = length;
+	batch[N+1] = nullbytes;
+	dagdb_find_bytes_batch(M, lengths, batch, result);
+	for (i=0; i<M; i++) {
+		EX_ASSERT_EQUAL_INT(result[i], dagdb_find_bytes(lengths[i], batch[i]));
+	}
+	EX_ASSERT_EQUAL_INT(result[N], 0);
+	CU_ASSERT(result[N+1] != 0);
+
+	verify_chunk_table();
+}
 
+static void test_large_data_write() {
+	// Data that does not fit in a single slab is stored in an extent.
+	uint64_t length = 100000;
+	char * data = malloc(length);
+	uint64_t i;
+	for (i=0; i<length; i++) data[i] = i * 7 + (i >> 8);
+	dagdb_handle h = dagdb_write_bytes(length, data);
+	CU_ASSERT(h != 0);
+	EX_ASSERT_EQUAL_INT(dagdb_find_bytes(length, data), h);
+	EX_ASSERT_EQUAL_INT(dagdb_bytes_length(h), length);
+	
+	uint8_t * buffer = malloc(length);
+	EX_ASSERT_EQUAL_INT(dagdb_bytes_read(buffer, h, 0, length), length);
+	CU_ASSERT(memcmp(buffer, data, length)==0);
+	EX_ASSERT_EQUAL_INT(dagdb_bytes_read(buffer, h, 70000, length), 30000);
+	CU_ASSERT(memcmp(buffer, data + 70000, 30000)==0);
+	free(buffer);
+	free(data);
+	
 	verify_chunk_table();
 }
 
@@ -308,12 +364,20 @@ static void test_record_write() {
 		}
 	}
 	
+	// Elements that are not referred to have no backref.
+	for (i=0; i<5; i++) {
+		EX_ASSERT_EQUAL_INT(dagdb_back_reference(refs[i*2]), 0);
+		EX_ASSERT_EQUAL_INT(dagdb_select(dagdb_back_reference(refs[i*2]), refs[i*2]), 0);
+	}
+	EX_ASSERT_EQUAL_INT(dagdb_back_reference(ref1), 0);
+	
 	verify_chunk_table();
 }
 
 static CU_TestInfo test_api_read_write[] = {
 	{ "handle_types", test_handle_types },
 	{ "data_write", test_data_write },
+	{ "large_data_write", test_large_data_write },
 	{ "record_hash", test_record_hashing },
 	{ "record_write", test_record_write },
 	CU_TEST_INFO_NULL,
@@ -339,12 +403,14 @@ static void test_iterators() {
 	CU_ASSERT(it1!=0);
 	CU_ASSERT(it2!=0);
 	CU_ASSERT(it3==0);
+	EX_ASSERT_EQUAL_INT(dagdb_back_reference(ref1), 0);
 	CU_ASSERT(it4!=0);
 	CU_ASSERT(it5!=0);
 	dagdb_iterator_destroy(it3);
 	
 	CU_ASSERT(!dagdb_iterator_advance(it1));
 	CU_ASSERT(!dagdb_iterator_advance(it4));
+	CU_ASSERT(!dagdb_iterator_advance(it4));
 	dagdb_iterator_destroy(it1);
 	dagdb_iterator_destroy(it4);
 	
@@ -386,9 +452,279 @@ static CU_TestInfo test_api_iterators[] = {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+#define COMPACT_FILENAME "test-compact.dagdb"
+
+static void test_compact() {
+	// Fill a database with data and records, with some fragmentation caused by temporary allocations.
+	dagdb_handle refs[64];
+	char buf[32];
+	int i;
+	for(i=0; i<64; i++) {
+		dagdb_free(dagdb_malloc(40 + i*8) | DAGDB_TYPE_DATA, 40 + i*8);
+		sprintf(buf, "compaction test %d", i);
+		refs[i] = dagdb_write_bytes(strlen(buf), buf);
+		dagdb_malloc(24);
+	}
+	for(i=0; i<16; i++) {
+		CU_ASSERT(dagdb_write_record(2, (dagdb_record_entry*)(refs + i*4)) != 0);
+	}
+	dagdb_statistics before;
+	dagdb_stats(&before, 0);
+	dagdb_unload();
+	
+	// The source must exist.
+	unlink(COMPACT_FILENAME);
+	int r = dagdb_compact(COMPACT_FILENAME, DB_FILENAME);
+	EX_ASSERT_EQUAL_INT(r, -1);
+	EX_ASSERT_ERROR(DAGDB_ERROR_BAD_ARGUMENT);
+	CU_ASSERT(access(COMPACT_FILENAME, F_OK) != 0);
+	r = dagdb_compact(DB_FILENAME, COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	// The destination must not exist yet.
+	r = dagdb_compact(DB_FILENAME, COMPACT_FILENAME);
+	EX_ASSERT_EQUAL_INT(r, -1);
+	EX_ASSERT_ERROR(DAGDB_ERROR_BAD_ARGUMENT);
+	
+	// The compacted database contains the same structures, without the garbage.
+	r = dagdb_load(COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	dagdb_statistics after;
+	dagdb_stats(&after, 0);
+	CU_ASSERT(after.live_bytes < before.live_bytes);
+	EX_ASSERT_EQUAL_INT(after.type_bytes[DAGDB_TYPE_ELEMENT], before.type_bytes[DAGDB_TYPE_ELEMENT]);
+	EX_ASSERT_EQUAL_INT(after.type_bytes[DAGDB_TYPE_TRIE], before.type_bytes[DAGDB_TYPE_TRIE]);
+	EX_ASSERT_EQUAL_INT(after.type_bytes[DAGDB_TYPE_KVPAIR], before.type_bytes[DAGDB_TYPE_KVPAIR]);
+	// The root trie is at the start of the file.
+	EX_ASSERT_EQUAL_LONG_HEX(LOCATE(Header, 0)->root, HEADER_SIZE | DAGDB_TYPE_TRIE);
+	for(i=0; i<64; i++) {
+		sprintf(buf, "compaction test %d", i);
+		refs[i] = dagdb_find_bytes(strlen(buf), buf);
+		CU_ASSERT(refs[i] != 0);
+		uint8_t data[32] = {0};
+		EX_ASSERT_EQUAL_INT(dagdb_bytes_read(data, refs[i], 0, sizeof(data)), strlen(buf));
+		EX_ASSERT_EQUAL_STRING((char*)data, buf);
+	}
+	for(i=0; i<16; i++) {
+		dagdb_handle record = dagdb_find_record(2, (dagdb_record_entry*)(refs + i*4));
+		CU_ASSERT(record != 0);
+		EX_ASSERT_EQUAL_INT(dagdb_select(record, refs[i*4]), refs[i*4+1]);
+		EX_ASSERT_EQUAL_INT(dagdb_select(record, refs[i*4+2]), refs[i*4+3]);
+		dagdb_handle key_br = dagdb_select(dagdb_back_reference(refs[i*4+3]), refs[i*4+2]);
+		EX_ASSERT_EQUAL_INT(dagdb_select(key_br, record), record);
+	}
+	verify_chunk_table();
+	dagdb_unload();
+	unlink(COMPACT_FILENAME);
+}
+
+static void test_compact_slab_size() {
+	// The compacted database keeps the slab size of the source.
+	dagdb_unload();
+	unlink(DB_FILENAME);
+	dagdb_options options = dagdb_default_options;
+	options.slab_size = 1<<16;
+	int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	dagdb_handle data = dagdb_write_bytes(13, "slab size 64k");
+	CU_ASSERT(data != 0);
+	dagdb_unload();
+	unlink(COMPACT_FILENAME);
+	r = dagdb_compact(DB_FILENAME, COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	r = dagdb_load(COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.slab_size, 1<<16);
+	EX_ASSERT_EQUAL_INT(stats.database_size % (1<<16), 0);
+	CU_ASSERT(dagdb_find_bytes(13, "slab size 64k") != 0);
+	verify_chunk_table();
+	dagdb_unload();
+	unlink(COMPACT_FILENAME);
+}
+
+static void test_compact_root_table() {
+	// The compacted database keeps the root table of the source.
+	dagdb_unload();
+	unlink(DB_FILENAME);
+	dagdb_options options = dagdb_default_options;
+	options.root_table_bits = 16;
+	int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	char buf[32];
+	for (int i=0; i<200; i++) {
+		sprintf(buf, "root table %d", i);
+		CU_ASSERT(dagdb_write_bytes(strlen(buf), buf) != 0);
+	}
+	dagdb_unload();
+	unlink(COMPACT_FILENAME);
+	r = dagdb_compact(DB_FILENAME, COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	r = dagdb_load(COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.root_table_bits, 16);
+	for (int i=0; i<200; i++) {
+		sprintf(buf, "root table %d", i);
+		CU_ASSERT(dagdb_find_bytes(strlen(buf), buf) != 0);
+	}
+	CU_ASSERT(dagdb_find_bytes(14, "root table 200") == 0);
+	verify_chunk_table();
+	dagdb_unload();
+	unlink(COMPACT_FILENAME);
+}
+
+static void test_compact_filter() {
+	// The compacted database has a filter with the same number of bits per key as the source.
+	dagdb_unload();
+	unlink(DB_FILENAME);
+	dagdb_options options = dagdb_default_options;
+	options.filter_bits_per_key = 12;
+	int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	char buf[32];
+	for (int i=0; i<200; i++) {
+		sprintf(buf, "filter %d", i);
+		CU_ASSERT(dagdb_write_bytes(strlen(buf), buf) != 0);
+	}
+	dagdb_unload();
+	unlink(COMPACT_FILENAME);
+	r = dagdb_compact(DB_FILENAME, COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	r = dagdb_load(COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.filter_bits_per_key, 12);
+	EX_ASSERT_EQUAL_INT(stats.filter_keys, 200);
+	CU_ASSERT(stats.filter_bytes > 0);
+	for (int i=0; i<200; i++) {
+		sprintf(buf, "filter %d", i);
+		CU_ASSERT(dagdb_find_bytes(strlen(buf), buf) != 0);
+	}
+	CU_ASSERT(dagdb_find_bytes(10, "filter 200") == 0);
+	verify_chunk_table();
+	dagdb_unload();
+	unlink(COMPACT_FILENAME);
+}
+
+static void test_compact_segregated() {
+	// The compacted database allocates each type from its own slabs, like the source.
+	dagdb_unload();
+	unlink(DB_FILENAME);
+	dagdb_options options = dagdb_default_options;
+	options.segregate_types = 1;
+	int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	char buf[32];
+	for (int i=0; i<200; i++) {
+		sprintf(buf, "segregated %d", i);
+		CU_ASSERT(dagdb_write_bytes(strlen(buf), buf) != 0);
+	}
+	dagdb_unload();
+	unlink(COMPACT_FILENAME);
+	r = dagdb_compact(DB_FILENAME, COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	r = dagdb_load(COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->segregate_types, 1);
+	for (int i=0; i<200; i++) {
+		sprintf(buf, "segregated %d", i);
+		CU_ASSERT(dagdb_find_bytes(strlen(buf), buf) != 0);
+	}
+	// New elements are not put in the slabs of the tries.
+	dagdb_handle h = dagdb_write_bytes(13, "segregated 200");
+	CU_ASSERT(h != 0);
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 0);
+	CU_ASSERT(h / stats.slab_size != LOCATE(Header, 0)->root / stats.slab_size);
+	verify_chunk_table();
+	dagdb_unload();
+	unlink(COMPACT_FILENAME);
+}
+
+/** Reads the given file into a newly allocated buffer, whose size is stored in size. */
+static char * read_file(const char * filename, size_t * size) {
+	FILE * f = fopen(filename, "rb");
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	rewind(f);
+	char * buf = malloc(*size);
+	if (fread(buf, 1, *size, f) != *size) *size = 0;
+	fclose(f);
+	return buf;
+}
+
+static void test_compact_read_only() {
+	// The source is only read, hence it may be a read-only file.
+	dagdb_unload();
+	unlink(DB_FILENAME);
+	int r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	char buf[32];
+	for (int i=0; i<64; i++) {
+		sprintf(buf, "read only %d", i);
+		CU_ASSERT(dagdb_write_bytes(strlen(buf), buf) != 0);
+	}
+	dagdb_unload();
+	size_t size_before, size_after;
+	char * before = read_file(DB_FILENAME, &size_before);
+	CU_ASSERT(chmod(DB_FILENAME, 0444) == 0);
+	unlink(COMPACT_FILENAME);
+	r = dagdb_compact(DB_FILENAME, COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	char * after = read_file(DB_FILENAME, &size_after);
+	EX_ASSERT_EQUAL_INT(size_after, size_before);
+	CU_ASSERT(memcmp(before, after, size_before) == 0);
+	free(before);
+	free(after);
+	CU_ASSERT(chmod(DB_FILENAME, 0644) == 0);
+	r = dagdb_load(COMPACT_FILENAME); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(r, 0);
+	for (int i=0; i<64; i++) {
+		sprintf(buf, "read only %d", i);
+		CU_ASSERT(dagdb_find_bytes(strlen(buf), buf) != 0);
+	}
+	dagdb_unload();
+	unlink(COMPACT_FILENAME);
+	
+	// A source that is not a valid database is rejected, without creating the destination.
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	LOCATE(Header, 0)->magic = -1;
+	dagdb_unload();
+	r = dagdb_compact(DB_FILENAME, COMPACT_FILENAME);
+	EX_ASSERT_EQUAL_INT(r, -1);
+	EX_ASSERT_ERROR(DAGDB_ERROR_INVALID_DB);
+	CU_ASSERT(strstr(dagdb_last_error(), "magic") != NULL);
+	CU_ASSERT(access(COMPACT_FILENAME, F_OK) != 0);
+	// An empty source as well.
+	FILE * f = fopen(DB_FILENAME, "w");
+	fclose(f);
+	r = dagdb_compact(DB_FILENAME, COMPACT_FILENAME);
+	EX_ASSERT_EQUAL_INT(r, -1);
+	EX_ASSERT_ERROR(DAGDB_ERROR_INVALID_DB);
+	CU_ASSERT(access(COMPACT_FILENAME, F_OK) != 0);
+	unlink(DB_FILENAME);
+}
+
+static CU_TestInfo test_api_compaction[] = {
+	{ "compact", test_compact },
+	{ "compact_slab_size", test_compact_slab_size },
+	{ "compact_root_table", test_compact_root_table },
+	{ "compact_filter", test_compact_filter },
+	{ "compact_segregated", test_compact_segregated },
+	{ "compact_read_only", test_compact_read_only },
+	CU_TEST_INFO_NULL,
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
 CU_SuiteInfo api_suites[] = {
 	{ "api-non-io",     NULL,        NULL,     test_api_non_io },
 	{ "api-read-write", open_new_db, close_db, test_api_read_write },
 	{ "api-iterators",  open_new_db, close_db, test_api_iterators },
+	{ "api-compaction", open_new_db, close_db, test_api_compaction },
 	CU_SUITE_INFO_NULL,
 };
@@ -51,8 +51,38 @@ static void test_nibble() {
 		EX_ASSERT_EQUAL_INT(nibble(key0,i), nibbles[i]);
 }
 
+static void test_split_byte() {
+	int i;
+	for (i=1; i+1<2*DAGDB_KEY_LENGTH; i+=2)
+		EX_ASSERT_EQUAL_INT(split_byte(key0,i), nibbles[i]<<4 | nibbles[i+1]);
+	EX_ASSERT_EQUAL_INT(split_byte(key0,2*DAGDB_KEY_LENGTH-1), nibbles[2*DAGDB_KEY_LENGTH-1]<<4);
+}
+
+static void test_node_index() {
+	// Check the counts against counting the bits one at a time, for a full, a nearly full, an empty and a sparse node.
+	uint64_t patterns[4][4] = {
+		{~0ULL, ~0ULL, ~0ULL, ~0ULL},
+		{~0ULL, ~0ULL, ~0ULL, ~0ULL >> 1},
+		{0, 0, 0, 0},
+		{0x8000000000000001ULL, 0, 0x0123456789abcdefULL, 0xf0f0f0f0f0f0f0f0ULL},
+	};
+	for (int p=0; p<4; p++) {
+		Node n;
+		memcpy(n.bitmap, patterns[p], sizeof(n.bitmap));
+		uint_fast32_t count = 0;
+		for (uint_fast32_t b=0; b<256; b++) {
+			EX_ASSERT_EQUAL_INT(node_index(&n, b), count);
+			EX_ASSERT_EQUAL_INT(node_has(&n, b), (patterns[p][b>>6] >> (b&63)) & 1);
+			count += node_has(&n, b);
+		}
+		EX_ASSERT_EQUAL_INT(node_count(&n), count);
+	}
+}
+
 static CU_TestInfo test_non_io[] = {
 	{ "nibble", test_nibble },
+	{ "split_byte", test_split_byte },
+	{ "node_index", test_node_index },
 	CU_TEST_INFO_NULL,
 };
 
@@ -85,33 +115,86 @@ static void test_element() {
 	dagdb_element_delete(el);
 }
 
+static void test_element_inline() {
+	const char *data = "This string has exactly 32 bytes";
+	for (uint_fast32_t len = 0; len <= DAGDB_MAX_INLINE_LENGTH; len += 4) {
+		dagdb_pointer el = dagdb_element_create_inline(key1, len, data, 1337);
+		CU_ASSERT(el);
+		EX_ASSERT_EQUAL_INT(dagdb_get_pointer_type(el), DAGDB_TYPE_ELEMENT);
+		EX_ASSERT_EQUAL_INT(dagdb_element_data(el), 0u);
+		EX_ASSERT_EQUAL_INT(dagdb_element_backref(el), 1337u);
+		dagdb_size length = 1000;
+		const char * bytes = dagdb_element_bytes(el, &length);
+		// The data is embedded directly after the backref.
+		EX_ASSERT_EQUAL_INT((const char*)bytes - (const char*)LOCATE(Element, el), offsetof(Element, bytes));
+		EX_ASSERT_EQUAL_INT(length, len);
+		CU_ASSERT_NSTRING_EQUAL(bytes, data, len);
+		key k = obtain_key(el);
+		CU_ASSERT_NSTRING_EQUAL(k,key1,DAGDB_KEY_LENGTH);
+		dagdb_element_delete(el);
+	}
+	// Elements that refer to data return it through the data pointer.
+	dagdb_pointer d = dagdb_data_create(4, data);
+	dagdb_pointer el = dagdb_element_create(key1, d, 0);
+	dagdb_size length = 0;
+	CU_ASSERT(dagdb_element_bytes(el, &length) == dagdb_data_access(d));
+	EX_ASSERT_EQUAL_INT(length, 4u);
+	dagdb_element_delete(el);
+	dagdb_data_delete(d);
+}
+
+static void test_element_backref() {
+	dagdb_pointer el = dagdb_element_create(key1, 0, 0);
+	EX_ASSERT_EQUAL_INT(dagdb_element_backref(el), 0u);
+	// The backref is created on demand, once.
+	dagdb_pointer br = dagdb_element_backref_obtain(el);
+	CU_ASSERT(br);
+	EX_ASSERT_EQUAL_INT(br & DAGDB_TYPE_MASK, DAGDB_TYPE_TRIE | DAGDB_TRIE_PAIRS);
+	EX_ASSERT_EQUAL_INT(dagdb_element_backref(el), br);
+	EX_ASSERT_EQUAL_INT(dagdb_element_backref_obtain(el), br);
+	dagdb_trie_delete(br);
+	dagdb_element_delete(el);
+	verify_chunk_table();
+}
+
 static void test_kvpair() {
 	// Depends on element
 	dagdb_pointer el = dagdb_element_create(key1, 1, 2);
 	EX_ASSERT_EQUAL_INT(dagdb_get_pointer_type(el), DAGDB_TYPE_ELEMENT);
-	dagdb_pointer kv = dagdb_kvpair_create(el, 42);
-	CU_ASSERT(kv);
+	dagdb_pointer t = dagdb_trie_create_pairs(0);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert_pair(t, el, 42), 1);
+	// The pair is embedded in the top of the trie.
+	dagdb_pointer kv = dagdb_trie_find(t, key1);
 	EX_ASSERT_EQUAL_INT(dagdb_get_pointer_type(kv), DAGDB_TYPE_KVPAIR);
+	EX_ASSERT_EQUAL_INT(kv & ~DAGDB_TYPE_MASK, (t & ~DAGDB_TYPE_MASK) + nibble(key1, 0)*2*S);
 	EX_ASSERT_EQUAL_INT(dagdb_kvpair_key(kv), el);
 	EX_ASSERT_EQUAL_INT(dagdb_kvpair_value(kv), 42u);
-	key k = obtain_key(kv);
-	CU_ASSERT_NSTRING_EQUAL(k,key1,DAGDB_KEY_LENGTH);
-	dagdb_kvpair_delete(kv);
+	dagdb_trie_delete(t);
 	EX_ASSERT_EQUAL_INT(dagdb_element_data(el), 1u);
 	EX_ASSERT_EQUAL_INT(dagdb_element_backref(el), 2u);
 	dagdb_element_delete(el);
 }
 
 static void test_trie() {
-	dagdb_pointer t = dagdb_trie_create();
+	dagdb_pointer t = dagdb_trie_create(0);
 	CU_ASSERT(t);
 	EX_ASSERT_EQUAL_INT(dagdb_get_pointer_type(t), DAGDB_TYPE_TRIE);
 	
 	// Check if trie is properly initialized.
-	Trie * v = LOCATE(Trie, t);
+	dagdb_pointer * v = LOCATE(dagdb_pointer, t);
 	int i;
 	for(i=0; i<16; i++) {
-		EX_ASSERT_EQUAL_INT(v->entry[i], 0);
+		EX_ASSERT_EQUAL_INT(v[i], 0);
+	}
+	dagdb_trie_delete(t);
+	
+	// A trie that maps keys to values has slots for 16 pairs.
+	t = dagdb_trie_create_pairs(0);
+	EX_ASSERT_EQUAL_INT(dagdb_get_pointer_type(t), DAGDB_TYPE_TRIE);
+	CU_ASSERT(t & DAGDB_TRIE_PAIRS);
+	v = LOCATE(dagdb_pointer, t);
+	for(i=0; i<32; i++) {
+		EX_ASSERT_EQUAL_INT(v[i], 0);
 	}
 	dagdb_trie_delete(t);
 }
@@ -119,6 +202,8 @@ static void test_trie() {
 static CU_TestInfo test_basic_io[] = {
 	{ "data", test_data },
 	{ "element", test_element },
+	{ "element_inline", test_element_inline },
+	{ "element_backref", test_element_backref },
 	{ "kvpair", test_kvpair },
 	{ "trie", test_trie },
 	{ "verify_chunk_table", verify_chunk_table },
@@ -156,6 +241,21 @@ static void test_find() {
 	EX_ASSERT_EQUAL_INT(dagdb_trie_find(dagdb_root(), key4), 0u); // fail on key mismatch.
 }
 
+static void test_stats() {
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 1000);
+	// The root trie and the three elements created by test_insert are live.
+	// As key1 and key2 share their first 8 nibbles, they are separated by a single node, which skips these.
+	EX_ASSERT_EQUAL_INT(stats.type_bytes[DAGDB_TYPE_TRIE], TOP_SIZE(1) + NODE_SIZE(2,1));
+	EX_ASSERT_EQUAL_INT(LOCATE(Node, LOCATE(dagdb_pointer, dagdb_root())[nibble(key1, 0)])->index, 7);
+	EX_ASSERT_EQUAL_INT(stats.type_bytes[DAGDB_TYPE_ELEMENT], 3*sizeof(Element));
+	uint64_t total = 0;
+	for (int i=0; i<DAGDB_STATS_DEPTH_BUCKETS; i++) total += stats.trie_depth[i];
+	EX_ASSERT_EQUAL_INT(total, 1000);
+	// The root trie contains only two elements, hence almost all lookups end in it.
+	CU_ASSERT(stats.trie_depth[0] > 900);
+}
+
 static void test_remove() {
 	// The previous tests should left the database with key1 and key2 
 	// in the root trie and nothing else in there.
@@ -178,23 +278,35 @@ static void test_remove() {
 }
 
 static void test_trie_kvpair() {
-	dagdb_pointer el = dagdb_element_create(key1, 1, 2);
-	EX_ASSERT_EQUAL_INT(dagdb_get_pointer_type(el), DAGDB_TYPE_ELEMENT);
-	dagdb_pointer kv = dagdb_kvpair_create(el, 3);
-	EX_ASSERT_EQUAL_INT(dagdb_get_pointer_type(kv), DAGDB_TYPE_KVPAIR);
+	dagdb_pointer el1 = dagdb_element_create(key1, 1, 2);
+	dagdb_pointer el2 = dagdb_element_create(key2, 1, 2);
+	EX_ASSERT_EQUAL_INT(dagdb_get_pointer_type(el1), DAGDB_TYPE_ELEMENT);
+	dagdb_pointer t = dagdb_trie_create_pairs(0);
 	
-	EX_ASSERT_EQUAL_INT(dagdb_trie_insert(dagdb_root(), kv), 1); // Insert kv-pair using key1
-	EX_ASSERT_EQUAL_INT(dagdb_trie_insert(dagdb_root(), el), 0); // inserting element using key1 fails
-	EX_ASSERT_EQUAL_INT(dagdb_trie_find(dagdb_root(), key1), kv); // The key value pair can be found
-
-	EX_ASSERT_EQUAL_INT(dagdb_trie_remove(dagdb_root(), key1), 1); // We can remove an element that uses key1
-	EX_ASSERT_EQUAL_INT(dagdb_kvpair_key(kv), el); // This wont affect the key value pair. 
-	EX_ASSERT_EQUAL_INT(dagdb_kvpair_value(kv), 3u);
-	dagdb_element_delete(el);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert_pair(t, el1, 3), 1); // Insert kv-pair using key1
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert_pair(t, el1, 4), 0); // inserting another pair using key1 fails
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert_pair(t, el2, 5), 1); // key2 shares the slot of key1, so a node is created
+	dagdb_pointer kv = dagdb_trie_find(t, key1); // The key value pair can be found
+	EX_ASSERT_EQUAL_INT(dagdb_get_pointer_type(kv), DAGDB_TYPE_KVPAIR);
+	EX_ASSERT_EQUAL_INT(dagdb_kvpair_key(kv), el1);
+	EX_ASSERT_EQUAL_INT(dagdb_kvpair_value(kv), 3u); // The value is unchanged by the duplicate insert
+	kv = dagdb_trie_find(t, key2);
+	EX_ASSERT_EQUAL_INT(dagdb_kvpair_key(kv), el2);
+	EX_ASSERT_EQUAL_INT(dagdb_kvpair_value(kv), 5u);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_find(t, key3), 0u);
+
+	EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, key1), 1); // We can remove the pair that uses key1
+	EX_ASSERT_EQUAL_INT(dagdb_trie_find(t, key1), 0u);
+	kv = dagdb_trie_find(t, key2);
+	EX_ASSERT_EQUAL_INT(dagdb_kvpair_key(kv), el2);
+	EX_ASSERT_EQUAL_INT(dagdb_kvpair_value(kv), 5u);
+	dagdb_trie_delete(t);
+	dagdb_element_delete(el1);
+	dagdb_element_delete(el2);
 }
  
 static void test_trie_recursive_delete() {
-	dagdb_pointer t = dagdb_trie_create();
+	dagdb_pointer t = dagdb_trie_create(0);
 	int r1 = dagdb_trie_insert(t, dagdb_element_create(key1, 0, 2));
 	int r2 = dagdb_trie_insert(t, dagdb_element_create(key1, 1, 2));
 	int r3 = dagdb_trie_insert(t, dagdb_element_create(key2, 1, 2));
@@ -207,12 +319,506 @@ static void test_trie_recursive_delete() {
 	verify_chunk_table();
 }
 
+static void test_trie_prefix() {
+	// The keys share all but their last nibble, or all but the last nibble of the first pair.
+	uint8_t keys[4][DAGDB_KEY_LENGTH];
+	memset(keys, 0x55, sizeof(keys));
+	keys[1][DAGDB_KEY_LENGTH-1] = 0x65;
+	keys[2][0] = 0x75;
+	keys[3][0] = 0x75;
+	keys[3][DAGDB_KEY_LENGTH-1] = 0x65;
+	dagdb_pointer el[4];
+	for (int i=0; i<4; i++) el[i] = dagdb_element_create(keys[i], 0, 0);
+	dagdb_statistics before, after;
+	dagdb_stats(&before, 0);
+	dagdb_pointer t = dagdb_trie_create(0);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert(t, el[0]), 1);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert(t, el[1]), 1);
+	// A single node splits on the last nibble.
+	dagdb_stats(&after, 0);
+	EX_ASSERT_EQUAL_INT(after.type_bytes[DAGDB_TYPE_TRIE] - before.type_bytes[DAGDB_TYPE_TRIE], TOP_SIZE(1) + NODE_SIZE(2,1));
+	Node * n = LOCATE(Node, LOCATE(dagdb_pointer, t)[5]);
+	EX_ASSERT_EQUAL_INT(n->index, 2*DAGDB_KEY_LENGTH-1);
+	// A key that differs earlier gets a node above it, which leaves the last node in place.
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert(t, el[2]), 1);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert(t, el[3]), 1);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert(t, el[3]), 0);
+	dagdb_stats(&after, 0);
+	EX_ASSERT_EQUAL_INT(after.type_bytes[DAGDB_TYPE_TRIE] - before.type_bytes[DAGDB_TYPE_TRIE], TOP_SIZE(1) + 3*NODE_SIZE(2,1));
+	EX_ASSERT_EQUAL_INT(LOCATE(Node, LOCATE(dagdb_pointer, t)[5])->index, 1);
+	// A key that only differs in skipped nibbles is not found.
+	uint8_t other[DAGDB_KEY_LENGTH];
+	memcpy(other, keys[0], DAGDB_KEY_LENGTH);
+	other[5] = 0;
+	EX_ASSERT_EQUAL_INT(dagdb_trie_find(t, other), 0u);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, other), 0);
+	for (int i=0; i<4; i++) {
+		EX_ASSERT_EQUAL_INT(dagdb_trie_find(t, keys[i]), el[i]);
+	}
+	// Removing the later keys collapses the nodes above the last node.
+	EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, keys[2]), 1);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, keys[3]), 1);
+	dagdb_stats(&after, 0);
+	EX_ASSERT_EQUAL_INT(after.type_bytes[DAGDB_TYPE_TRIE] - before.type_bytes[DAGDB_TYPE_TRIE], TOP_SIZE(1) + NODE_SIZE(2,1));
+	EX_ASSERT_EQUAL_INT(LOCATE(Node, LOCATE(dagdb_pointer, t)[5])->index, 2*DAGDB_KEY_LENGTH-1);
+	// Removing one of the last two keys leaves the other in the top.
+	EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, keys[0]), 1);
+	CU_ASSERT(leaf_element(LOCATE(dagdb_pointer, t)[5]) == el[1]);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_find(t, keys[1]), el[1]);
+	dagdb_trie_delete(t);
+	for (int i=0; i<4; i++) dagdb_element_delete(el[i]);
+	verify_chunk_table();
+}
+
+/** Compares two keys in the order of their nibbles, which is the order of iteration. */
+static int compare_nibbles(const uint8_t * a, const uint8_t * b) {
+	for (int i=0; i<2*DAGDB_KEY_LENGTH; i++) {
+		int d = (int)nibble(a,i) - (int)nibble(b,i);
+		if (d) return d;
+	}
+	return 0;
+}
+
+/** Returns the least number of children of the nodes below the given slots of w pointers. */
+static uint_fast32_t min_children(const dagdb_pointer * entry, uint_fast32_t count, uint_fast32_t w) {
+	uint_fast32_t r = 256;
+	for (uint_fast32_t i=0; i<count; i++) {
+		if (dagdb_get_pointer_type(entry[i*w]) != DAGDB_TYPE_TRIE) continue;
+		Node * n = LOCATE(Node, entry[i*w]);
+		if (node_count(n) < r) r = node_count(n);
+		uint_fast32_t c = min_children(n->entry, node_count(n), w);
+		if (c < r) r = c;
+	}
+	return r;
+}
+
+/**
+ * Inserts, finds, removes and iterates many keys in the given empty set, or trie that maps keys to values.
+ * The value of a key is the element of the next key. Afterwards, the trie is empty again.
+ */
+static void trie_many(dagdb_pointer t) {
+	const int N = 3000;
+	static uint8_t keys[3000][DAGDB_KEY_LENGTH];
+	dagdb_pointer el[3000];
+	int pairs = SLOT_WIDTH(t) == 2;
+	dagdb_statistics before, after;
+	dagdb_stats(&before, 0);
+	uint64_t state = 1;
+	for (int i=0; i<N; i++) {
+		// Every third key shares all but its last nibble with the previous key, 
+		// such that nodes are created up to the deepest level.
+		if (i%3 == 1) {
+			memcpy(keys[i], keys[i-1], DAGDB_KEY_LENGTH);
+			keys[i][DAGDB_KEY_LENGTH-1] ^= 0x10;
+		} else {
+			for (int j=0; j<DAGDB_KEY_LENGTH; j++) {
+				state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+				keys[i][j] = state >> 56;
+			}
+		}
+		el[i] = dagdb_element_create(keys[i], 0, 0);
+	}
+	for (int i=0; i<N; i++) {
+		int r = pairs ? dagdb_trie_insert_pair(t, el[i], el[(i+1)%N]) : dagdb_trie_insert(t, el[i]);
+		EX_ASSERT_EQUAL_INT(r, 1);
+	}
+	for (int i=0; i<N; i++) {
+		if (pairs) {
+			dagdb_pointer kv = dagdb_trie_find(t, keys[i]);
+			EX_ASSERT_EQUAL_INT(dagdb_kvpair_key(kv), el[i]);
+			EX_ASSERT_EQUAL_INT(dagdb_kvpair_value(kv), el[(i+1)%N]);
+			EX_ASSERT_EQUAL_INT(dagdb_trie_insert_pair(t, el[i], 0), 0);
+		} else {
+			EX_ASSERT_EQUAL_INT(dagdb_trie_find(t, keys[i]), el[i]);
+			EX_ASSERT_EQUAL_INT(dagdb_trie_insert(t, el[i]), 0);
+		}
+	}
+	// Remove every other key, which shrinks the nodes and collapses those that are left with one child.
+	for (int i=0; i<N; i+=2) {
+		EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, keys[i]), 1);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, keys[i]), 0);
+	}
+	EX_ASSERT_EQUAL_INT(min_children(LOCATE(dagdb_pointer, t), TOP_SLOTS(top_nibbles(t)), SLOT_WIDTH(t)) >= 2, 1);
+	for (int i=0; i<N; i++) {
+		dagdb_pointer p = dagdb_trie_find(t, keys[i]);
+		if (pairs && p) p = dagdb_kvpair_key(p);
+		EX_ASSERT_EQUAL_INT(p, i%2 ? el[i] : 0);
+	}
+	// Batched lookups give the same results, for any number of keys in flight.
+	static dagdb_pointer found[3000];
+	for (int n=0; n<=N; n = n ? 3*n : 1) {
+		memset(found, 0xff, sizeof(found));
+		dagdb_trie_find_many(t, n, (const dagdb_key*)keys, found);
+		for (int i=0; i<n; i++) EX_ASSERT_EQUAL_INT(found[i], dagdb_trie_find(t, keys[i]));
+		if (n<N) CU_ASSERT(found[n] == ~(dagdb_pointer)0);
+	}
+	verify_chunk_table();
+	// The remaining keys are iterated in order.
+	dagdb_iterator * it = dagdb_iterator_create(t);
+	CU_ASSERT(it != NULL);
+	int count = 0;
+	uint8_t last[DAGDB_KEY_LENGTH];
+	while (dagdb_iterator_advance(it)) {
+		uint8_t k[DAGDB_KEY_LENGTH];
+		dagdb_pointer e = dagdb_iterator_key(it);
+		dagdb_element_key(k, e);
+		if (count) CU_ASSERT(compare_nibbles(last, k) < 0);
+		// The value belongs to the key, which is found through the position of the key in the array.
+		int i = 0;
+		while (el[i] != e) i++;
+		EX_ASSERT_EQUAL_INT(dagdb_iterator_value(it), pairs ? el[(i+1)%N] : e);
+		memcpy(last, k, DAGDB_KEY_LENGTH);
+		count++;
+	}
+	EX_ASSERT_EQUAL_INT(count, N/2);
+	dagdb_iterator_destroy(it);
+	// Removing the remaining keys releases all nodes, which leaves the top.
+	for (int i=1; i<N; i+=2) {
+		EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, keys[i]), 1);
+	}
+	for (int i=0; i<N; i++) dagdb_element_delete(el[i]);
+	dagdb_stats(&after, 0);
+	EX_ASSERT_EQUAL_INT(after.type_bytes[DAGDB_TYPE_TRIE], before.type_bytes[DAGDB_TYPE_TRIE]);
+	verify_chunk_table();
+}
+
+/** Runs trie_many on a new trie, which afterwards consists of its top, and deleting it releases that top. */
+static void trie_many_new(dagdb_pointer t) {
+	dagdb_statistics before, after;
+	dagdb_stats(&before, 0);
+	trie_many(t);
+	dagdb_trie_delete(t);
+	dagdb_stats(&after, 0);
+	EX_ASSERT_EQUAL_INT(before.type_bytes[DAGDB_TYPE_TRIE] - after.type_bytes[DAGDB_TYPE_TRIE], TOP_SIZE(SLOT_WIDTH(t)));
+	verify_chunk_table();
+}
+
+static void test_trie_many() {
+	trie_many_new(dagdb_trie_create(0));
+}
+
+static void test_trie_many_pairs() {
+	trie_many_new(dagdb_trie_create_pairs(0));
+}
+
+static void test_trie_root_table() {
+	// The slot in the top of the root trie of a database created with a root table is selected by the first nibbles.
+	// Those of key1 are 0, 3, 1 and 3. Key2 first differs from key1 in nibble 8, hence the node that splits them 
+	// is at the pair of nibbles that starts at index 7 below a table of 3 nibbles, and at index 8 below one of 4.
+	const uint32_t bits[2] = {12, 16};
+	const uint32_t slot[2] = {0x031, 0x0313};
+	const uint32_t index[2] = {7, 8};
+	for (int i=0; i<2; i++) {
+		dagdb_unload();
+		unlink(DB_FILENAME);
+		dagdb_options options = dagdb_default_options;
+		options.root_table_bits = bits[i];
+		int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+		CU_ASSERT(r == 0);
+		dagdb_pointer root = dagdb_root();
+		dagdb_statistics stats;
+		dagdb_stats(&stats, 0);
+		EX_ASSERT_EQUAL_INT(stats.type_bytes[DAGDB_TYPE_TRIE], TOP_SIZE_NIBBLES(bits[i]/4,1));
+		EX_ASSERT_EQUAL_INT(stats.root_table_bits, bits[i]);
+		dagdb_pointer el1 = dagdb_element_create(key1, 0, 0);
+		dagdb_pointer el2 = dagdb_element_create(key2, 0, 0);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_insert(root, el1), 1);
+		CU_ASSERT(leaf_element(LOCATE(dagdb_pointer, root)[slot[i]]) == el1);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_insert(root, el2), 1);
+		EX_ASSERT_EQUAL_INT(LOCATE(Node, LOCATE(dagdb_pointer, root)[slot[i]])->index, index[i]);
+		CU_ASSERT(dagdb_trie_find(root, key1) == el1);
+		CU_ASSERT(dagdb_trie_find(root, key2) == el2);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_remove(root, key2), 1);
+		CU_ASSERT(leaf_element(LOCATE(dagdb_pointer, root)[slot[i]]) == el1);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_remove(root, key1), 1);
+		dagdb_element_delete(el1);
+		dagdb_element_delete(el2);
+		// The root trie behaves as any other trie.
+		trie_many(root);
+		dagdb_stats(&stats, 0);
+		EX_ASSERT_EQUAL_INT(stats.type_bytes[DAGDB_TYPE_TRIE], TOP_SIZE_NIBBLES(bits[i]/4,1));
+	}
+}
+
+static void test_trie_fingerprint() {
+	// The slot of a leaf holds the element together with the fingerprint of its key.
+	dagdb_pointer t = dagdb_trie_create_pairs(0);
+	dagdb_pointer el = dagdb_element_create(key1, 0, 0);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert_pair(t, el, 1234), 1);
+	dagdb_pointer * slot = LOCATE(dagdb_pointer, t) + nibble(key1, 0)*2;
+	CU_ASSERT((slot[0] & FINGERPRINT_MASK) == fingerprint(key1));
+	CU_ASSERT(leaf_element(slot[0]) == el);
+	CU_ASSERT(slot[1] == 1234);
+	dagdb_pointer kv = dagdb_trie_find(t, key1);
+	CU_ASSERT(dagdb_kvpair_key(kv) == el);
+	dagdb_iterator * it = dagdb_iterator_create(t);
+	EX_ASSERT_EQUAL_INT(dagdb_iterator_advance(it), -1);
+	CU_ASSERT(dagdb_iterator_key(it) == el);
+	dagdb_iterator_destroy(it);
+	
+	// A key with another fingerprint is rejected, as is a key with the same fingerprint.
+	uint8_t other[DAGDB_KEY_LENGTH];
+	memcpy(other, key1, DAGDB_KEY_LENGTH);
+	other[DAGDB_KEY_LENGTH-1] ^= 1;
+	CU_ASSERT(fingerprint(other) != fingerprint(key1));
+	CU_ASSERT(dagdb_trie_find(t, other) == 0);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, other), 0);
+	memcpy(other, key1, DAGDB_KEY_LENGTH);
+	other[DAGDB_KEY_LENGTH-8] ^= 1;
+	other[DAGDB_KEY_LENGTH-4] ^= 1;
+	CU_ASSERT(fingerprint(other) == fingerprint(key1));
+	CU_ASSERT(dagdb_trie_find(t, other) == 0);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, other), 0);
+	dagdb_pointer result[2];
+	uint8_t keys[2][DAGDB_KEY_LENGTH];
+	memcpy(keys[0], key1, DAGDB_KEY_LENGTH);
+	memcpy(keys[1], other, DAGDB_KEY_LENGTH);
+	dagdb_trie_find_many(t, 2, (const dagdb_key*)keys, result);
+	CU_ASSERT(result[0] == kv);
+	CU_ASSERT(result[1] == 0);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_remove(t, key1), 1);
+	dagdb_trie_delete(t);
+	dagdb_element_delete(el);
+}
+
+static void test_trie_filter() {
+	dagdb_unload();
+	unlink(DB_FILENAME);
+	dagdb_options options = dagdb_default_options;
+	options.filter_bits_per_key = 10;
+	int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	dagdb_pointer root = dagdb_root();
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.filter_bits_per_key, 10);
+	EX_ASSERT_EQUAL_INT(stats.filter_bytes, 0);
+	CU_ASSERT(stats.filter_false_positive_rate == 1);
+	
+	// The filter is created by the first insert and rebuilt when it is full.
+	const int N = 10000;
+	static uint8_t keys[2][10000][DAGDB_KEY_LENGTH];
+	static dagdb_pointer el[10000], result[10000];
+	uint64_t state = 1;
+	for (int i=0; i<2*N; i++) {
+		for (int j=0; j<DAGDB_KEY_LENGTH; j++) {
+			state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+			keys[i/N][i%N][j] = state >> 56;
+		}
+	}
+	for (int i=0; i<N; i++) {
+		el[i] = dagdb_element_create(keys[0][i], 0, 0);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_insert(root, el[i]), 1);
+		if (i == 0) {
+			dagdb_stats(&stats, 0);
+			EX_ASSERT_EQUAL_INT(stats.filter_bytes, 128 * FILTER_BLOCK_SIZE);
+			EX_ASSERT_EQUAL_INT(stats.filter_keys, 1);
+		}
+	}
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.filter_bytes, 512 * FILTER_BLOCK_SIZE);
+	EX_ASSERT_EQUAL_INT(stats.filter_keys, N);
+	CU_ASSERT(stats.filter_false_positive_rate > 0);
+	CU_ASSERT(stats.filter_false_positive_rate < 0.01);
+	
+	// All keys pass the filter, while most other keys are rejected by it.
+	int passed = 0;
+	for (int i=0; i<N; i++) {
+		CU_ASSERT(!filter_rejects(root, keys[0][i]));
+		CU_ASSERT(dagdb_trie_find(root, keys[0][i]) == el[i]);
+		passed += !filter_rejects(root, keys[1][i]);
+		CU_ASSERT(dagdb_trie_find(root, keys[1][i]) == 0);
+	}
+	CU_ASSERT(passed < N * 0.01);
+	dagdb_trie_find_many(root, N, (const dagdb_key*)keys[0], result);
+	for (int i=0; i<N; i++) CU_ASSERT(result[i] == el[i]);
+	dagdb_trie_find_many(root, N, (const dagdb_key*)keys[1], result);
+	for (int i=0; i<N; i++) CU_ASSERT(result[i] == 0);
+	
+	// Removed keys remain in the filter until it is rebuilt.
+	for (int i=0; i<N; i++) {
+		EX_ASSERT_EQUAL_INT(dagdb_trie_remove(root, keys[0][i]), 1);
+		CU_ASSERT(dagdb_trie_find(root, keys[0][i]) == 0);
+		dagdb_element_delete(el[i]);
+	}
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.filter_keys, N);
+	r = dagdb_filter_rebuild(10); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.filter_bytes, 128 * FILTER_BLOCK_SIZE);
+	EX_ASSERT_EQUAL_INT(stats.filter_keys, 0);
+	CU_ASSERT(stats.filter_false_positive_rate == 0);
+	CU_ASSERT(filter_rejects(root, keys[0][0]));
+	
+	// A small filter still has slabs of its own.
+	r = dagdb_filter_rebuild(1); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.filter_bytes, FILTER_MIN_BLOCKS * FILTER_BLOCK_SIZE);
+	EX_ASSERT_EQUAL_INT(stats.extent_slabs, 1);
+	
+	// The filter can be removed.
+	r = dagdb_filter_rebuild(DAGDB_MAX_FILTER_BITS_PER_KEY + 1);
+	CU_ASSERT(r == -1);
+	EX_ASSERT_ERROR(DAGDB_ERROR_BAD_ARGUMENT);
+	r = dagdb_filter_rebuild(0); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.filter_bits_per_key, 0);
+	EX_ASSERT_EQUAL_INT(stats.filter_bytes, 0);
+	EX_ASSERT_EQUAL_INT(stats.extent_slabs, 0);
+	CU_ASSERT(stats.filter_false_positive_rate == 1);
+	el[0] = dagdb_element_create(keys[0][0], 0, 0);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_insert(root, el[0]), 1);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->filter, 0);
+	EX_ASSERT_EQUAL_INT(dagdb_trie_remove(root, keys[0][0]), 1);
+	dagdb_element_delete(el[0]);
+}
+
+static uint64_t index_total() {
+	uint64_t r = 0;
+	for (int i=0; i<INDEX_SHARDS; i++) r += dagdb_index[i].count;
+	return r;
+}
+
+static void test_trie_index() {
+	// Fill a database without an index.
+	dagdb_unload();
+	unlink(DB_FILENAME);
+	int r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	const int N = 10000;
+	static uint8_t keys[2][10000][DAGDB_KEY_LENGTH];
+	static dagdb_pointer el[2][10000], result[10000];
+	uint64_t state = 3;
+	for (int i=0; i<2*N; i++) {
+		for (int j=0; j<DAGDB_KEY_LENGTH; j++) {
+			state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+			keys[i/N][i%N][j] = state >> 56;
+		}
+	}
+	dagdb_pointer root = dagdb_root();
+	for (int i=0; i<N; i++) {
+		el[0][i] = dagdb_element_create(keys[0][i], 0, 0);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_insert(root, el[0][i]), 1);
+	}
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.index_bytes, 0);
+	dagdb_unload();
+	
+	// The index is built when the database is loaded.
+	dagdb_options options = dagdb_default_options;
+	options.index_threads = 4;
+	r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	CU_ASSERT(dagdb_index_active);
+	EX_ASSERT_EQUAL_INT(index_total(), N);
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.index_bytes, INDEX_SHARDS * 1024 * sizeof(dagdb_pointer));
+	root = dagdb_root();
+	for (int i=0; i<N; i++) {
+		CU_ASSERT(index_find(keys[0][i]) == el[0][i]);
+		CU_ASSERT(dagdb_trie_find(root, keys[0][i]) == el[0][i]);
+		CU_ASSERT(dagdb_trie_find(root, keys[1][i]) == 0);
+	}
+	dagdb_trie_find_many(root, N, (const dagdb_key*)keys[0], result);
+	for (int i=0; i<N; i++) CU_ASSERT(result[i] == el[0][i]);
+	dagdb_trie_find_many(root, N, (const dagdb_key*)keys[1], result);
+	for (int i=0; i<N; i++) CU_ASSERT(result[i] == 0);
+	
+	// Inserts and removals update the index, which grows as needed.
+	for (int i=0; i<N; i++) {
+		el[1][i] = dagdb_element_create(keys[1][i], 0, 0);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_insert(root, el[1][i]), 1);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_insert(root, el[1][i]), 0);
+	}
+	EX_ASSERT_EQUAL_INT(index_total(), 2*N);
+	dagdb_stats(&stats, 0);
+	EX_ASSERT_EQUAL_INT(stats.index_bytes, INDEX_SHARDS * 2048 * sizeof(dagdb_pointer));
+	for (int i=0; i<N; i++) {
+		EX_ASSERT_EQUAL_INT(dagdb_trie_remove(root, keys[0][i]), 1);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_remove(root, keys[0][i]), 0);
+		dagdb_element_delete(el[0][i]);
+	}
+	EX_ASSERT_EQUAL_INT(index_total(), N);
+	for (int i=0; i<N; i++) {
+		CU_ASSERT(dagdb_trie_find(root, keys[0][i]) == 0);
+		CU_ASSERT(dagdb_trie_find(root, keys[1][i]) == el[1][i]);
+	}
+	
+	// A single thread builds the same index.
+	dagdb_unload();
+	options.index_threads = 1;
+	r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	EX_ASSERT_EQUAL_INT(index_total(), N);
+	root = dagdb_root();
+	for (int i=0; i<N; i++) {
+		CU_ASSERT(index_find(keys[1][i]) == el[1][i]);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_remove(root, keys[1][i]), 1);
+		dagdb_element_delete(el[1][i]);
+	}
+	EX_ASSERT_EQUAL_INT(index_total(), 0);
+	dagdb_unload();
+	CU_ASSERT(!dagdb_index_active);
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+}
+
+static void test_trie_index_collisions() {
+	// Keys that only differ after the bytes that place them in the index end up in one cluster.
+	// Removing any of them moves the others back, such that these are still found.
+	dagdb_unload();
+	unlink(DB_FILENAME);
+	dagdb_options options = dagdb_default_options;
+	options.index_threads = 2;
+	int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	dagdb_pointer root = dagdb_root();
+	const int N = 5;
+	uint8_t keys[5][DAGDB_KEY_LENGTH];
+	dagdb_pointer el[5];
+	for (int i=0; i<N; i++) {
+		memcpy(keys[i], key1, DAGDB_KEY_LENGTH);
+		keys[i][DAGDB_KEY_LENGTH-1] ^= i;
+		el[i] = dagdb_element_create(keys[i], 0, 0);
+	}
+	// The last key is placed in the slot after the cluster.
+	keys[N-1][1] ^= 1;
+	dagdb_element_delete(el[N-1]);
+	el[N-1] = dagdb_element_create(keys[N-1], 0, 0);
+	for (int k=0; k<N-1; k++) {
+		for (int i=0; i<N; i++) EX_ASSERT_EQUAL_INT(dagdb_trie_insert(root, el[i]), 1);
+		EX_ASSERT_EQUAL_INT(dagdb_trie_remove(root, keys[k]), 1);
+		for (int i=0; i<N; i++) CU_ASSERT(dagdb_trie_find(root, keys[i]) == (i == k ? 0 : el[i]));
+		for (int i=0; i<N; i++) {
+			if (i != k) EX_ASSERT_EQUAL_INT(dagdb_trie_remove(root, keys[i]), 1);
+		}
+		EX_ASSERT_EQUAL_INT(index_total(), 0);
+	}
+	for (int i=0; i<N; i++) dagdb_element_delete(el[i]);
+	dagdb_unload();
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+}
+
 static CU_TestInfo test_trie_io[] = {
 	{ "insert", test_insert },
 	{ "find", test_find },
+	{ "stats", test_stats },
 	{ "remove", test_remove },
 	{ "kvpair", test_trie_kvpair },
 	{ "recursive_delete", test_trie_recursive_delete },
+	{ "prefix", test_trie_prefix },
+	{ "many", test_trie_many },
+	{ "many_pairs", test_trie_many_pairs },
+	{ "root_table", test_trie_root_table },
+	{ "fingerprint", test_trie_fingerprint },
+	{ "filter", test_trie_filter },
+	{ "index", test_trie_index },
+	{ "index_collisions", test_trie_index_collisions },
 	{ "verify_chunk_table", verify_chunk_table },
 	CU_TEST_INFO_NULL,
 };
@@ -220,7 +826,7 @@ static CU_TestInfo test_trie_io[] = {
 ///////////////////////////////////////////////////////////////////////////////
 
 static void test_iterator_create() {
-	dagdb_pointer t = dagdb_trie_create();
+	dagdb_pointer t = dagdb_trie_create(0);
 	dagdb_iterator * it = dagdb_iterator_create(t);
 	CU_ASSERT(it != NULL);
 	dagdb_iterator_destroy(it);
@@ -228,9 +834,13 @@ static void test_iterator_create() {
 };
 
 static void test_iterator_create_wrong() {
-	dagdb_pointer t = dagdb_trie_create();
+	dagdb_pointer t = dagdb_trie_create(0);
 	dagdb_pointer e = dagdb_element_create(key0, t, t);
-	dagdb_pointer k = dagdb_kvpair_create(e, e);
+	dagdb_pointer p = dagdb_trie_create_pairs(0);
+	int r = dagdb_trie_insert_pair(p, e, e);
+	EX_ASSERT_EQUAL_INT(r, 1);
+	dagdb_pointer k = dagdb_trie_find(p, key0);
+	EX_ASSERT_EQUAL_INT(dagdb_get_pointer_type(k), DAGDB_TYPE_KVPAIR);
 	dagdb_iterator * it1 = dagdb_iterator_create(k);
 	CU_ASSERT(it1 == NULL);
 	dagdb_iterator_destroy(it1);
@@ -243,16 +853,22 @@ static void test_iterator_create_wrong() {
 };
 
 static void test_iterator_advance_empty() {
-	dagdb_pointer t = dagdb_trie_create();
+	dagdb_pointer t = dagdb_trie_create(0);
 	dagdb_iterator * it = dagdb_iterator_create(t);
 	CU_ASSERT(it != NULL);
 	CU_ASSERT(!dagdb_iterator_advance(it));
 	dagdb_iterator_destroy(it);
+	// Missing backrefs are iterated as empty.
+	it = dagdb_iterator_create(0);
+	CU_ASSERT(it != NULL);
+	CU_ASSERT(!dagdb_iterator_advance(it));
+	CU_ASSERT(!dagdb_iterator_advance(it));
+	dagdb_iterator_destroy(it);
 	verify_chunk_table();
 };
 
 static void test_iterator_advance_one() {
-	dagdb_pointer t = dagdb_trie_create();
+	dagdb_pointer t = dagdb_trie_create(0);
 	dagdb_pointer e = dagdb_element_create(key0, t, t);
 	int i = dagdb_trie_insert(t, e);
 	EX_ASSERT_EQUAL_INT(i, 1);
@@ -267,7 +883,7 @@ static void test_iterator_advance_one() {
 };
 
 static void test_iterator_advance_many() {
-	dagdb_pointer t = dagdb_trie_create();
+	dagdb_pointer t = dagdb_trie_create(0);
 	dagdb_pointer e0 = dagdb_element_create(key0, t, t);
 	dagdb_pointer e1 = dagdb_element_create(key1, t, t);
 	dagdb_pointer e2 = dagdb_element_create(key2, t, t);
@@ -196,6 +196,111 @@ static void test_check() {
 	EX_ASSERT_EQUAL_INT(dagdb_bitarray_check(b,9*B+1,B-1,1),0);
 }
 
+static dagdb_bitarray scan_data[] = {
+	0x00ff03ffc0f8007fUL,
+	0x00000000ffffffffUL,
+	0x0000000000000000UL,
+	0x0000000000000000UL,
+	0x0000000000000000UL,
+	0x0000000000000000UL,
+	0xffffffff00000000UL,
+	0xffffffffffffffffUL,
+	0xffffffffffffffffUL,
+	0xffffffffffffffffUL,
+	0xffffffffffffffffUL,
+	0x80000000ffffffffUL,
+	0x0000000000400000UL,
+	0xfffffdffffffffffUL,
+};
+#define SCAN_BITS (sizeof(scan_data)*8)
+
+/** Reference implementation of dagdb_bitarray_scan_next, reading a single bit at a time. */
+static int_fast32_t slow_scan_next(int_fast32_t start, int_fast32_t length, int_fast32_t value) {
+	for (int_fast32_t i=start; i<start+length; i++) 
+		if ((dagdb_bitarray_read(scan_data, i)!=0) == value) return i;
+	return -1;
+}
+
+static void test_scan_next() {
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_scan_next(scan_data, 0, SCAN_BITS, 0), 7);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_scan_next(scan_data, 7, SCAN_BITS-7, 1), 19);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_scan_next(scan_data, B+32, SCAN_BITS-B-32, 1), 6*B+32);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_scan_next(scan_data, 6*B+32, SCAN_BITS-6*B-32, 0), 11*B+32);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_scan_next(scan_data, B+32, 5*B, 1), -1);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_scan_next(scan_data, 3, 0, 1), -1);
+	int_fast32_t errors = 0;
+	for (int_fast32_t start=0; start<(int_fast32_t)SCAN_BITS; start++) {
+		for (int_fast32_t length=0; start+length<=(int_fast32_t)SCAN_BITS; length++) {
+			errors += dagdb_bitarray_scan_next(scan_data, start, length, 0) != slow_scan_next(start, length, 0);
+			errors += dagdb_bitarray_scan_next(scan_data, start, length, 1) != slow_scan_next(start, length, 1);
+		}
+	}
+	EX_ASSERT_EQUAL_INT(errors, 0);
+}
+
+static int_fast32_t slow_scan_prev(int_fast32_t start, int_fast32_t length, int_fast32_t value) {
+	for (int_fast32_t i=start+length-1; i>=start; i--) 
+		if ((dagdb_bitarray_read(scan_data, i)!=0) == value) return i;
+	return -1;
+}
+
+static void test_scan_prev() {
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_scan_prev(scan_data, 0, SCAN_BITS, 0), 13*B+41);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_scan_prev(scan_data, 0, 6*B+32, 1), B+31);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_scan_prev(scan_data, 2*B, 4*B, 1), -1);
+	int_fast32_t errors = 0;
+	for (int_fast32_t start=0; start<(int_fast32_t)SCAN_BITS; start++) {
+		for (int_fast32_t length=0; start+length<=(int_fast32_t)SCAN_BITS; length++) {
+			errors += dagdb_bitarray_scan_prev(scan_data, start, length, 0) != slow_scan_prev(start, length, 0);
+			errors += dagdb_bitarray_scan_prev(scan_data, start, length, 1) != slow_scan_prev(start, length, 1);
+		}
+	}
+	EX_ASSERT_EQUAL_INT(errors, 0);
+}
+
+static void test_count() {
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_count(scan_data, 0, 7), 7);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_count(scan_data, 0, B), 7+5+12+8);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_count(scan_data, 6*B, 5*B), 4*B+32);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_count(scan_data, 5, 0), 0);
+	int_fast32_t errors = 0;
+	for (int_fast32_t start=0; start<(int_fast32_t)SCAN_BITS; start++) {
+		int_fast32_t count = 0;
+		for (int_fast32_t length=0; start+length<=(int_fast32_t)SCAN_BITS; length++) {
+			errors += dagdb_bitarray_count(scan_data, start, length) != count;
+			if (start+length<(int_fast32_t)SCAN_BITS) count += dagdb_bitarray_read(scan_data, start+length)!=0;
+		}
+	}
+	EX_ASSERT_EQUAL_INT(errors, 0);
+}
+
+static int_fast32_t slow_find_run(int_fast32_t start, int_fast32_t length, int_fast32_t run, int_fast32_t value) {
+	for (int_fast32_t i=start; i+run<=start+length; i++) {
+		if (dagdb_bitarray_check(scan_data, i, run, value)) return i;
+	}
+	return -1;
+}
+
+static void test_find_run() {
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_find_run(scan_data, 0, SCAN_BITS, 6, 0), 7);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_find_run(scan_data, 0, SCAN_BITS, 12, 0), 7);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_find_run(scan_data, 0, SCAN_BITS, 13, 0), B+32);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_find_run(scan_data, 0, SCAN_BITS, 10, 1), 30);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_find_run(scan_data, 0, SCAN_BITS, 3*B, 1), 6*B+32);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_find_run(scan_data, 0, SCAN_BITS, 5*B, 1), 6*B+32);
+	EX_ASSERT_EQUAL_INT(dagdb_bitarray_find_run(scan_data, 0, SCAN_BITS, 5*B+1, 1), -1);
+	int_fast32_t errors = 0;
+	for (int_fast32_t start=0; start<(int_fast32_t)SCAN_BITS; start+=7) {
+		for (int_fast32_t length=0; start+length<=(int_fast32_t)SCAN_BITS; length+=5) {
+			for (int_fast32_t run=1; run<=3*(int_fast32_t)B; run=run*3/2+1) {
+				errors += dagdb_bitarray_find_run(scan_data, start, length, run, 0) != slow_find_run(start, length, run, 0);
+				errors += dagdb_bitarray_find_run(scan_data, start, length, run, 1) != slow_find_run(start, length, run, 1);
+			}
+		}
+	}
+	EX_ASSERT_EQUAL_INT(errors, 0);
+}
+
 static CU_TestInfo test_bitarrray[] = {
 	{ "array_size", test_array_size },
 	{ "read", test_read },
@@ -203,6 +308,10 @@ static CU_TestInfo test_bitarrray[] = {
 	{ "unmark", test_unmark },
 	{ "flip", test_flip },
 	{ "check", test_check },
+	{ "scan_next", test_scan_next },
+	{ "scan_prev", test_scan_prev },
+	{ "count", test_count },
+	{ "find_run", test_find_run },
 	CU_TEST_INFO_NULL,
 };
 
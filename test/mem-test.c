@@ -32,18 +32,21 @@ static int check_bitmap_mark(dagdb_pointer location, dagdb_size size, int_fast32
 	assert(size%S==0);
 	assert(location%SLAB_SIZE + size <= SLAB_USEABLE_SPACE_SIZE);
 	int_fast32_t offset = location & (SLAB_SIZE-1);
-	return dagdb_bitarray_check(LOCATE(MemorySlab, location-offset)->bitmap, offset/S, size/S, value);
+	return dagdb_bitarray_check(dagdb_slab_bitmap(dagdb_slab, location-offset), offset/S, size/S, value);
 }
 
 /**
  * Verifies that all linked lists in the free chunk table are properly linked.
  * These lists are cyclic, hence the 'last' element in the list is also the element we start with:
  * the element that is in the free chunk table.
+ * Also verifies that the header's chunk masks tell which of these lists are non-empty,
+ * and that the statistics kept in the header match the chunk table and bitmaps.
  */
 void verify_chunk_table() {
-	int_fast32_t i;
-	for (i=0; i<CHUNK_TABLE_SIZE; i++) {
-		dagdb_pointer list = CHUNK_TABLE_LOCATION(i);
+	int_fast32_t i, t;
+	dagdb_size free_bytes[CHUNK_TABLE_SIZE] = {0};
+	for (t=0; t<CHUNK_TABLE_COUNT; t++) for (i=0; i<CHUNK_TABLE_SIZE; i++) {
+		dagdb_pointer list = CHUNK_TABLE_LOCATION(t, i);
 		dagdb_pointer current = list;
 		do {
 			dagdb_size size = (i==0)?2*S:LOCATE(FreeMemoryChunk, current)->size;
@@ -59,6 +62,7 @@ void verify_chunk_table() {
 				
 				// Check that the bitmap matches.
 				CU_ASSERT(check_bitmap_mark(current, size,0));
+				free_bytes[i] += size;
 				// There should not be any additional free space left and right of a free chunk.
 				if (current%SLAB_SIZE > 0)
 					CU_ASSERT(check_bitmap_mark(current-S, S,1));
@@ -70,14 +74,52 @@ void verify_chunk_table() {
 			current = next;
 		} while (current>=HEADER_SIZE);
 		EX_ASSERT_EQUAL_INT(current, list);
+		
+		// Check that the non-empty mask matches.
+		int_fast32_t nonempty = LOCATE(FreeMemoryChunk, list)->next != list;
+		EX_ASSERT_EQUAL_INT((LOCATE(Header, 0)->chunk_mask[t] >> i) & 1, nonempty);
+	}
+	for (i=0; i<CHUNK_TABLE_SIZE; i++) {
+		EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->free_bytes[i], free_bytes[i]);
+	}
+	
+	// Check the usage counts and the occupancy histogram, walking the slabs from the end,
+	// as an extent can only be recognized by its last slab.
+	dagdb_size occupancy[DAGDB_STATS_OCCUPANCY_BUCKETS] = {0};
+	dagdb_size extent_slabs = 0;
+	dagdb_pointer slab = dagdb_database_size;
+	while (slab > 0) {
+		slab -= SLAB_SIZE;
+		dagdb_size extent = *dagdb_slab_extent(dagdb_slab, slab);
+		if (extent) {
+			extent_slabs += extent;
+			slab -= (extent - 1) * SLAB_SIZE;
+			continue;
+		}
+		dagdb_size used = dagdb_bitarray_count(dagdb_slab_bitmap(dagdb_slab, slab), 0, BITMAP_SIZE);
+		EX_ASSERT_EQUAL_INT(*dagdb_slab_used(dagdb_slab, slab), used);
+		occupancy[occupancy_bucket(dagdb_slab, used)]++;
+	}
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->extent_slabs, extent_slabs);
+	for (i=0; i<DAGDB_STATS_OCCUPANCY_BUCKETS; i++) {
+		EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->slab_occupancy[i], occupancy[i]);
 	}
 }
 
+static void fill_pattern(dagdb_pointer p, dagdb_size size, uint64_t seed) {
+	for (dagdb_size i=0; i<size; i+=S) *LOCATE(uint64_t, p+i) = seed + i;
+}
+
+static int check_pattern(dagdb_pointer p, dagdb_size size, uint64_t seed) {
+	for (dagdb_size i=0; i<size; i+=S) if (*LOCATE(uint64_t, p+i) != seed + i) return 0;
+	return 1;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 static void print_info() {
-	MemorySlab a;
-	printf("memory slab: %ld entries, %lub used, %lub bitmap, %ldb wasted\n", BITMAP_SIZE, sizeof(a.data), sizeof(a.bitmap), SLAB_SIZE - sizeof(MemorySlab));
+	dagdb_size bitmap = DAGDB_BITARRAY_ARRAY_SIZE(BITMAP_SIZE)*sizeof(dagdb_bitarray);
+	printf("memory slab: %ld entries, %lub used, %lub bitmap, %ldb wasted\n", BITMAP_SIZE, SLAB_USEABLE_SPACE_SIZE, bitmap, SLAB_SIZE - SLAB_USEABLE_SPACE_SIZE - bitmap - 2*S);
 }
 
 static void test_round_up() {
@@ -125,10 +167,31 @@ static void test_chunk_id() {
 	}
 }
 
+static void test_slab_geometry() {
+	// The computed layout of the default slab size matches the constant one.
+	SlabGeometry g = dagdb_slab_geometry(DEFAULT_SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(g.size, DEFAULT_SLAB_GEOMETRY.size);
+	EX_ASSERT_EQUAL_INT(g.bitmap_size, DEFAULT_SLAB_GEOMETRY.bitmap_size);
+	
+	// For all allowed slab sizes, the data, bitmap, usage count and extent field fit without wasting space.
+	for (dagdb_size size = MIN_SLAB_SIZE; size <= MAX_SLAB_SIZE; size *= 2) {
+		g = dagdb_slab_geometry(size);
+		dagdb_size bitmap = DAGDB_BITARRAY_ARRAY_SIZE(g.bitmap_size)*sizeof(dagdb_bitarray);
+		CU_ASSERT(dagdb_slab_useable(g) + bitmap <= size - 2*S);
+		CU_ASSERT(dagdb_slab_useable(g) + bitmap + S + sizeof(dagdb_bitarray) > size - 2*S);
+		CU_ASSERT(dagdb_slab_useable(g) > MAX_CHUNK_SIZE);
+		CU_ASSERT(dagdb_valid_slab_size(size));
+	}
+	CU_ASSERT(!dagdb_valid_slab_size(MIN_SLAB_SIZE/2));
+	CU_ASSERT(!dagdb_valid_slab_size(MAX_SLAB_SIZE*2));
+	CU_ASSERT(!dagdb_valid_slab_size(3*MIN_SLAB_SIZE));
+}
+
 static CU_TestInfo test_non_io[] = {
   { "print_info", print_info }, 
   { "round_up", test_round_up },
   { "chunk_id", test_chunk_id },
+  { "slab_geometry", test_slab_geometry },
   CU_TEST_INFO_NULL,
 };
 
@@ -226,6 +289,45 @@ static void test_load_checks() {
 	CU_ASSERT(strstr(dagdb_last_error(), "root")!=NULL);
 	dagdb_unload(); // <- again superfluous
 	
+	// slab size corruption
+	unlink(DB_FILENAME);
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR 
+	CU_ASSERT(r == 0); 
+	h = LOCATE(Header,0);
+	h->slab_size=SLAB_SIZE + S; // corrupt header
+	dagdb_unload(); 
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_ERROR(DAGDB_ERROR_INVALID_DB); 
+	CU_ASSERT(r == -1); 
+	CU_ASSERT(strstr(dagdb_last_error(), "slab size")!=NULL);
+	dagdb_unload(); // <- again superfluous
+	
+	// missing slab size, which is not replaced by the default
+	unlink(DB_FILENAME);
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR 
+	CU_ASSERT(r == 0); 
+	h = LOCATE(Header,0);
+	h->slab_size=0; // corrupt header
+	dagdb_unload(); 
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_ERROR(DAGDB_ERROR_INVALID_DB); 
+	CU_ASSERT(r == -1); 
+	CU_ASSERT(strstr(dagdb_last_error(), "slab size")!=NULL);
+	dagdb_unload(); // <- again superfluous
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_ERROR(DAGDB_ERROR_INVALID_DB); 
+	CU_ASSERT(r == -1); 
+	CU_ASSERT(strstr(dagdb_last_error(), "slab size")!=NULL);
+	
+	// root table corruption
+	unlink(DB_FILENAME);
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR 
+	CU_ASSERT(r == 0); 
+	h = LOCATE(Header,0);
+	h->root_nibbles=0; // corrupt header
+	dagdb_unload(); 
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_ERROR(DAGDB_ERROR_INVALID_DB); 
+	CU_ASSERT(r == -1); 
+	CU_ASSERT(strstr(dagdb_last_error(), "root table")!=NULL);
+	dagdb_unload(); // <- again superfluous
+	
 	// size corruption
 	unlink(DB_FILENAME);
 	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR 
@@ -239,12 +341,291 @@ static void test_load_checks() {
 	
 }
 
+static void test_load_large() {
+	// Databases are no longer limited to 1GiB.
+	const dagdb_size large = (3ULL<<30) + SLAB_SIZE;
+	unlink(DB_FILENAME);
+	int r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0); 
+	r = ftruncate(dagdb_database_fd, large);
+	CU_ASSERT(r == 0); 
+	dagdb_unload(); 
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0); 
+	CU_ASSERT(dagdb_mapping_size >= large);
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_file_size, large);
+	// The trailing empty slabs are considered preallocated space.
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_database_size, SLAB_SIZE);
+	// The end of the file must be accessible.
+	EX_ASSERT_EQUAL_LONG_HEX(*LOCATE(dagdb_size, large - S), 0);
+	dagdb_unload();
+	unlink(DB_FILENAME);
+}
+
+static void test_load_growth() {
+	// The file grows with multiple slabs at once, as configured in the options.
+	dagdb_options options = dagdb_default_options;
+	options.growth_min = 4*SLAB_SIZE;
+	options.growth_percent = 0;
+	unlink(DB_FILENAME);
+	int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	dagdb_size count = dagdb_counter.growth_count;
+	dagdb_pointer p = dagdb_malloc(SLAB_SIZE + 1); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(p, SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 3*SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_file_size, 5*SLAB_SIZE);
+	// Using the preallocated space does not grow the file.
+	p = dagdb_malloc(SLAB_SIZE + 1); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 5*SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_file_size, 5*SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_counter.growth_count, count + 1);
+	// Requests larger than growth_min are not limited by it.
+	p = dagdb_malloc(6*SLAB_SIZE); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 12*SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_file_size, 12*SLAB_SIZE);
+	dagdb_free(p, 6*SLAB_SIZE);
+	verify_chunk_table();
+	dagdb_unload();
+	
+	// After reloading, the preallocated space is recognized as such.
+	r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 5*SLAB_SIZE);
+	verify_chunk_table();
+	dagdb_unload();
+	unlink(DB_FILENAME);
+}
+
+static void test_load_retention() {
+	// Unused space at the end of the file is only truncated in batches.
+	dagdb_options options = dagdb_default_options;
+	options.growth_min = SLAB_SIZE;
+	options.growth_percent = 0;
+	options.retention = 2*SLAB_SIZE;
+	unlink(DB_FILENAME);
+	int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	dagdb_pointer p1 = dagdb_malloc(SLAB_SIZE + 1);
+	dagdb_pointer p2 = dagdb_malloc(SLAB_SIZE + 1);
+	dagdb_pointer p3 = dagdb_malloc(SLAB_SIZE + 1); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(dagdb_file_size, 7*SLAB_SIZE);
+	
+	// Freeing the last extent leaves 2 slabs of unused space, which are retained.
+	dagdb_free(p3, SLAB_SIZE + 1);
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 5*SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_file_size, 7*SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_counter.truncations_avoided, 1);
+	EX_ASSERT_EQUAL_INT(dagdb_counter.truncation_count, 0);
+	// The retained slabs are empty and no longer look like free chunks.
+	CU_ASSERT(dagdb_slab_empty(dagdb_slab, 5*SLAB_SIZE));
+	CU_ASSERT(dagdb_slab_empty(dagdb_slab, 6*SLAB_SIZE));
+	EX_ASSERT_EQUAL_INT(LOCATE(FreeMemoryChunk, 5*SLAB_SIZE)->size, 0);
+	EX_ASSERT_EQUAL_INT(*LOCATE(dagdb_size, 6*SLAB_SIZE + SLAB_USEABLE_SPACE_SIZE - S), 0);
+	
+	// Freeing another extent exceeds the retention threshold.
+	dagdb_free(p2, SLAB_SIZE + 1);
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 3*SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_file_size, 3*SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_counter.truncation_count, 1);
+	
+	// Reallocating retained space does not grow the file.
+	p2 = dagdb_malloc(SLAB_SIZE + 1); EX_ASSERT_NO_ERROR
+	dagdb_free(p2, SLAB_SIZE + 1);
+	dagdb_size count = dagdb_counter.growth_count;
+	p2 = dagdb_malloc(SLAB_SIZE + 1); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(dagdb_counter.growth_count, count);
+	dagdb_free(p2, SLAB_SIZE + 1);
+	EX_ASSERT_EQUAL_INT(dagdb_file_size, 5*SLAB_SIZE);
+	
+	// dagdb_trim truncates the retained space.
+	r = dagdb_trim(); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	EX_ASSERT_EQUAL_INT(dagdb_file_size, 3*SLAB_SIZE);
+	dagdb_counters counters;
+	dagdb_get_counters(&counters);
+	EX_ASSERT_EQUAL_INT(counters.truncation_count, 2);
+	EX_ASSERT_EQUAL_INT(counters.truncations_avoided, 3);
+	
+	dagdb_free(p1, SLAB_SIZE + 1);
+	verify_chunk_table();
+	dagdb_unload();
+	unlink(DB_FILENAME);
+}
+
+static void test_load_advice() {
+	// An invalid access pattern is rejected.
+	dagdb_options options = dagdb_default_options;
+	options.access_pattern = DAGDB_ACCESS_SEQUENTIAL + 1;
+	unlink(DB_FILENAME);
+	int r = dagdb_load_options(DB_FILENAME, &options);
+	CU_ASSERT(r == -1);
+	EX_ASSERT_ERROR(DAGDB_ERROR_BAD_ARGUMENT);
+	
+	// Create a database of a few slabs.
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	dagdb_pointer p = dagdb_malloc(4*SLAB_SIZE); EX_ASSERT_NO_ERROR
+	fill_pattern(p, 4*SLAB_SIZE, 7);
+	dagdb_unload();
+	
+	// The advice does not change the contents.
+	options.huge_pages = 1;
+	options.access_pattern = DAGDB_ACCESS_RANDOM;
+	options.populate = -1;
+	r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	CU_ASSERT(check_pattern(p, 4*SLAB_SIZE, 7));
+	dagdb_free(p, 4*SLAB_SIZE);
+	verify_chunk_table();
+	dagdb_unload();
+	unlink(DB_FILENAME);
+}
+
+static void test_load_slab_size() {
+	// Invalid slab sizes are rejected.
+	const dagdb_size invalid[] = {HEADER_SIZE, 3*HEADER_SIZE, MAX_SLAB_SIZE*2};
+	dagdb_options options = dagdb_default_options;
+	unlink(DB_FILENAME);
+	for (int i=0; i<3; i++) {
+		options.slab_size = invalid[i];
+		int r = dagdb_load_options(DB_FILENAME, &options);
+		CU_ASSERT(r == -1);
+		EX_ASSERT_ERROR(DAGDB_ERROR_BAD_ARGUMENT);
+	}
+	
+	const dagdb_size sizes[] = {MIN_SLAB_SIZE, 1<<21};
+	for (int i=0; i<2; i++) {
+		// Create a database with the given slab size.
+		dagdb_size size = sizes[i];
+		options.slab_size = size;
+		unlink(DB_FILENAME);
+		int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+		CU_ASSERT(r == 0);
+		EX_ASSERT_EQUAL_INT(SLAB_SIZE, size);
+		EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->slab_size, size);
+		EX_ASSERT_EQUAL_INT(dagdb_database_size, size);
+		verify_chunk_table();
+		
+		// Fill more than one slab with chunks and add an extent.
+		dagdb_size n = 2 * SLAB_USEABLE_SPACE_SIZE / (64*S);
+		dagdb_pointer p[n];
+		for (dagdb_size j=0; j<n; j++) {
+			p[j] = dagdb_malloc(64*S); EX_ASSERT_NO_ERROR
+			CU_ASSERT((p[j] & (size-1)) + 64*S <= SLAB_USEABLE_SPACE_SIZE);
+			fill_pattern(p[j], 64*S, j);
+		}
+		dagdb_pointer e = dagdb_malloc(size + 1); EX_ASSERT_NO_ERROR
+		EX_ASSERT_EQUAL_INT(e % size, 0);
+		fill_pattern(e, size, n);
+		for (dagdb_size j=0; j<n; j+=2) dagdb_free(p[j], 64*S);
+		verify_chunk_table();
+		dagdb_unload();
+		
+		// The slab size is kept when the database is loaded again, regardless of the options.
+		r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+		CU_ASSERT(r == 0);
+		EX_ASSERT_EQUAL_INT(SLAB_SIZE, size);
+		for (dagdb_size j=1; j<n; j+=2) {
+			CU_ASSERT(check_pattern(p[j], 64*S, j));
+			dagdb_free(p[j], 64*S);
+		}
+		CU_ASSERT(check_pattern(e, size, n));
+		dagdb_free(e, size + 1);
+		verify_chunk_table();
+		EX_ASSERT_EQUAL_INT(dagdb_database_size, size);
+		dagdb_unload();
+	}
+	unlink(DB_FILENAME);
+}
+
+static void test_load_root_table() {
+	// Invalid root table sizes are rejected.
+	const uint32_t invalid[] = {4, 10, DAGDB_MAX_ROOT_TABLE_BITS + 4};
+	dagdb_options options = dagdb_default_options;
+	unlink(DB_FILENAME);
+	for (int i=0; i<3; i++) {
+		options.root_table_bits = invalid[i];
+		int r = dagdb_load_options(DB_FILENAME, &options);
+		CU_ASSERT(r == -1);
+		EX_ASSERT_ERROR(DAGDB_ERROR_BAD_ARGUMENT);
+	}
+	
+	// The root table is chosen when the database is created.
+	options.root_table_bits = 8;
+	int r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->root_nibbles, 2);
+	dagdb_unload();
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->root_nibbles, 2);
+	dagdb_unload();
+	unlink(DB_FILENAME);
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->root_nibbles, 1);
+	dagdb_unload();
+	unlink(DB_FILENAME);
+}
+
+static void test_load_filter() {
+	// Invalid filter sizes are rejected.
+	dagdb_options options = dagdb_default_options;
+	unlink(DB_FILENAME);
+	options.filter_bits_per_key = DAGDB_MAX_FILTER_BITS_PER_KEY + 1;
+	int r = dagdb_load_options(DB_FILENAME, &options);
+	CU_ASSERT(r == -1);
+	EX_ASSERT_ERROR(DAGDB_ERROR_BAD_ARGUMENT);
+	
+	// The number of filter bits per key is chosen when the database is created.
+	options.filter_bits_per_key = 10;
+	r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->filter_bits_per_key, 10);
+	dagdb_unload();
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->filter_bits_per_key, 10);
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->filter, 0);
+	dagdb_unload();
+	unlink(DB_FILENAME);
+}
+
+static void test_load_index() {
+	// Invalid numbers of index threads are rejected.
+	dagdb_options options = dagdb_default_options;
+	unlink(DB_FILENAME);
+	options.index_threads = DAGDB_MAX_INDEX_THREADS + 1;
+	int r = dagdb_load_options(DB_FILENAME, &options);
+	CU_ASSERT(r == -1);
+	EX_ASSERT_ERROR(DAGDB_ERROR_BAD_ARGUMENT);
+	
+	// An empty database gets an empty index.
+	options.index_threads = DAGDB_MAX_INDEX_THREADS;
+	r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	dagdb_statistics stats;
+	dagdb_stats(&stats, 0);
+	CU_ASSERT(stats.index_bytes > 0);
+	dagdb_unload();
+	unlink(DB_FILENAME);
+}
+
 static CU_TestInfo test_loading[] = {
   { "load_init", test_load_init },
   { "load_reload", test_load_reload },
   { "superfluous_unload", test_superfluous_unload },
   { "load_failure", test_load_failure },
   { "load_checks", test_load_checks },
+  { "load_large", test_load_large },
+  { "load_growth", test_load_growth },
+  { "load_retention", test_load_retention },
+  { "load_advice", test_load_advice },
+  { "load_slab_size", test_load_slab_size },
+  { "load_root_table", test_load_root_table },
+  { "load_filter", test_load_filter },
+  { "load_index", test_load_index },
   CU_TEST_INFO_NULL,
 };
 
@@ -262,7 +643,7 @@ static void test_mem_initial() {
 static void test_mem_alloc_too_much() {
 	// Checks if malloc returns a null pointer if the requested
 	// memory size is too large.
-	dagdb_pointer p = dagdb_malloc(MAX_CHUNK_SIZE + 1); 
+	dagdb_pointer p = dagdb_malloc(MAX_EXTENT_SIZE + 1); 
 	EX_ASSERT_EQUAL_INT(p, 0);
 	EX_ASSERT_ERROR(DAGDB_ERROR_BAD_ARGUMENT); 
 }
@@ -293,15 +674,17 @@ static void filler_fill_normal(filler * f) {
 		if (SLAB_USEABLE_SPACE_SIZE - HEADER_SIZE - i*f->alloc_size > 0) {
 			// There is free space left in our slab.
 			// Check if the size of the remaining chunk, as written on disk, is what we would expect.
-			EX_ASSERT_EQUAL_INT(*LOCATE(dagdb_size, SLAB_USEABLE_SPACE_SIZE-S), SLAB_USEABLE_SPACE_SIZE - HEADER_SIZE - i*f->alloc_size);
+			// This size is not written for chunks smaller than a FreeMemoryChunk.
+			if (SLAB_USEABLE_SPACE_SIZE - HEADER_SIZE - i*f->alloc_size >= sizeof(FreeMemoryChunk))
+				EX_ASSERT_EQUAL_INT(*LOCATE(dagdb_size, SLAB_USEABLE_SPACE_SIZE-S), SLAB_USEABLE_SPACE_SIZE - HEADER_SIZE - i*f->alloc_size);
 		} else {
 			// There should be no chunks left, so we cannot check the size of the last chunk. 
 			// So instead, we check if the chunk table is empty.
 			Header* h = LOCATE(Header,0);
 			int j;
 			for (j=0; j<CHUNK_TABLE_SIZE; j++) {
-				EX_ASSERT_EQUAL_INT(h->chunks[j*2  ], CHUNK_TABLE_LOCATION(j));
-				EX_ASSERT_EQUAL_INT(h->chunks[j*2+1], CHUNK_TABLE_LOCATION(j));
+				EX_ASSERT_EQUAL_INT(h->chunks[0][j*2  ], CHUNK_TABLE_LOCATION(0, j));
+				EX_ASSERT_EQUAL_INT(h->chunks[0][j*2+1], CHUNK_TABLE_LOCATION(0, j));
 			}
 		}
 		f->p[i] = dagdb_malloc(f->alloc_size); EX_ASSERT_NO_ERROR
@@ -417,9 +800,452 @@ static CU_TestInfo test_mem[] = {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+static void test_realloc_grow_in_place() {
+	dagdb_pointer p = dagdb_malloc(4*S); EX_ASSERT_NO_ERROR
+	fill_pattern(p, 4*S, 1);
+	// The memory right of p is free, so it can grow in place.
+	dagdb_pointer q = dagdb_realloc(p | DAGDB_TYPE_KVPAIR, 4*S, 9*S); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(q, p | DAGDB_TYPE_KVPAIR);
+	CU_ASSERT(check_bitmap_mark(p, 9*S, 1));
+	CU_ASSERT(check_pattern(p, 4*S, 1));
+	verify_chunk_table();
+	// Growing by S only consumes a part of the free chunk.
+	q = dagdb_realloc(q, 9*S, 10*S); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(q, p | DAGDB_TYPE_KVPAIR);
+	verify_chunk_table();
+	dagdb_free(q, 10*S);
+	verify_chunk_table();
+}
+
+static void test_realloc_move() {
+	dagdb_pointer p1 = dagdb_malloc(4*S);
+	dagdb_pointer p2 = dagdb_malloc(4*S); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(p2, p1 + 4*S);
+	fill_pattern(p1, 4*S, 1);
+	fill_pattern(p2, 4*S, 2);
+	// p1 is followed by p2, so it has to move.
+	dagdb_pointer q = dagdb_realloc(p1 | DAGDB_TYPE_ELEMENT, 4*S, 6*S); EX_ASSERT_NO_ERROR
+	CU_ASSERT(q != (p1 | DAGDB_TYPE_ELEMENT));
+	EX_ASSERT_EQUAL_INT(q & DAGDB_TYPE_MASK, DAGDB_TYPE_ELEMENT);
+	q &= ~DAGDB_TYPE_MASK;
+	CU_ASSERT(check_pattern(q, 4*S, 1));
+	CU_ASSERT(check_pattern(p2, 4*S, 2));
+	CU_ASSERT(check_bitmap_mark(p1, 4*S, 0));
+	verify_chunk_table();
+	dagdb_free(p2, 4*S);
+	dagdb_free(q | DAGDB_TYPE_ELEMENT, 6*S);
+	verify_chunk_table();
+}
+
+static void test_realloc_shrink() {
+	dagdb_pointer p1 = dagdb_malloc(8*S);
+	dagdb_pointer p2 = dagdb_malloc(4*S); EX_ASSERT_NO_ERROR
+	fill_pattern(p1, 8*S, 1);
+	// Releasing S leaves a small unlisted gap.
+	dagdb_pointer q = dagdb_realloc(p1, 8*S, 7*S); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(q, p1);
+	CU_ASSERT(check_bitmap_mark(p1, 7*S, 1));
+	CU_ASSERT(check_bitmap_mark(p1 + 7*S, S, 0));
+	verify_chunk_table();
+	// Releasing more merges the gap into a chunk.
+	q = dagdb_realloc(p1, 7*S, 3*S); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(q, p1);
+	CU_ASSERT(check_pattern(p1, 3*S, 1));
+	CU_ASSERT(check_bitmap_mark(p1 + 3*S, 5*S, 0));
+	verify_chunk_table();
+	// The gap can be reclaimed in place.
+	q = dagdb_realloc(p1, 3*S, 8*S); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(q, p1);
+	verify_chunk_table();
+	dagdb_free(p1, 8*S);
+	dagdb_free(p2, 4*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static void test_realloc_too_much() {
+	dagdb_pointer p = dagdb_malloc(4*S); EX_ASSERT_NO_ERROR
+	dagdb_pointer q = dagdb_realloc(p, 4*S, MAX_EXTENT_SIZE + 1); 
+	EX_ASSERT_EQUAL_INT(q, 0);
+	EX_ASSERT_ERROR(DAGDB_ERROR_BAD_ARGUMENT); 
+	CU_ASSERT(check_bitmap_mark(p, 4*S, 1));
+	dagdb_free(p, 4*S);
+	verify_chunk_table();
+}
+
+static void test_extent_alloc() {
+	dagdb_pointer p1 = dagdb_malloc(4*S);
+	dagdb_size length = 2*SLAB_SIZE + 12345;
+	dagdb_pointer p2 = dagdb_malloc(length); EX_ASSERT_NO_ERROR
+	// The extent is appended as whole slabs.
+	EX_ASSERT_EQUAL_LONG_HEX(p2, SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 4*SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(*dagdb_slab_extent(dagdb_slab, 3*SLAB_SIZE), 3);
+	CU_ASSERT(check_bitmap_mark(3*SLAB_SIZE, SLAB_USEABLE_SPACE_SIZE, 1));
+	fill_pattern(p2, length, 3);
+	// Small allocations do not end up inside the extent.
+	dagdb_pointer p3 = dagdb_malloc(MAX_CHUNK_SIZE); EX_ASSERT_NO_ERROR
+	CU_ASSERT(p3 < SLAB_SIZE || p3 >= 4*SLAB_SIZE);
+	verify_chunk_table();
+	CU_ASSERT(check_pattern(p2, length, 3));
+	dagdb_free(p2, length);
+	verify_chunk_table();
+	dagdb_free(p3, MAX_CHUNK_SIZE);
+	dagdb_free(p1, 4*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static void test_extent_reuse() {
+	dagdb_size length = SLAB_SIZE + 1;
+	dagdb_pointer p1 = dagdb_malloc(length);
+	dagdb_pointer p2 = dagdb_malloc(length); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(p1, SLAB_SIZE);
+	EX_ASSERT_EQUAL_LONG_HEX(p2, 3*SLAB_SIZE);
+	// Freeing an extent in the middle of the file turns it into empty slabs.
+	dagdb_free(p1, length);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 5*SLAB_SIZE);
+	CU_ASSERT(check_bitmap_mark(SLAB_SIZE, SLAB_USEABLE_SPACE_SIZE, 0));
+	EX_ASSERT_EQUAL_INT(*dagdb_slab_extent(dagdb_slab, 2*SLAB_SIZE), 0);
+	// These slabs are then reused for small allocations.
+	dagdb_pointer p3 = dagdb_malloc(MAX_CHUNK_SIZE); EX_ASSERT_NO_ERROR
+	CU_ASSERT(p3 >= SLAB_SIZE && p3 < 3*SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 5*SLAB_SIZE);
+	verify_chunk_table();
+	dagdb_free(p3, MAX_CHUNK_SIZE);
+	dagdb_free(p2, length);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static void test_extent_realloc() {
+	dagdb_pointer p = dagdb_malloc(MAX_CHUNK_SIZE); EX_ASSERT_NO_ERROR
+	fill_pattern(p, MAX_CHUNK_SIZE, 4);
+	// Growing beyond the chunk limit moves the data into an extent.
+	dagdb_pointer q = dagdb_realloc(p | DAGDB_TYPE_DATA, MAX_CHUNK_SIZE, SLAB_SIZE); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(q, SLAB_SIZE | DAGDB_TYPE_DATA);
+	q &= ~DAGDB_TYPE_MASK;
+	CU_ASSERT(check_pattern(q, MAX_CHUNK_SIZE, 4));
+	// Extents are resized in place while their number of slabs does not change.
+	dagdb_pointer r = dagdb_realloc(q, SLAB_SIZE, SLAB_SIZE + 100*S); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(r, q);
+	// Shrinking below the chunk limit moves the data back into a chunk.
+	r = dagdb_realloc(q, SLAB_SIZE + 100*S, 100*S); EX_ASSERT_NO_ERROR
+	CU_ASSERT(check_pattern(r, 100*S, 4));
+	verify_chunk_table();
+	dagdb_free(r, 100*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static void test_slab_release() {
+	// The storage of free slabs in the middle of the file is released.
+	dagdb_size length = 4*SLAB_SIZE;
+	dagdb_pointer p1 = dagdb_malloc(length);
+	dagdb_pointer p2 = dagdb_malloc(SLAB_SIZE + 1); EX_ASSERT_NO_ERROR
+	fill_pattern(p1, length, 5);
+	struct stat before, after;
+	fstat(dagdb_database_fd, &before);
+	dagdb_size released = dagdb_counter.slabs_released;
+	dagdb_free(p1, length);
+	fstat(dagdb_database_fd, &after);
+	EX_ASSERT_EQUAL_INT(dagdb_counter.slabs_released, released + EXTENT_SLABS(length));
+	CU_ASSERT(after.st_blocks < before.st_blocks);
+	verify_chunk_table();
+	// Released slabs can be used again.
+	p1 = dagdb_malloc(length); EX_ASSERT_NO_ERROR
+	fill_pattern(p1, length, 6);
+	CU_ASSERT(check_pattern(p1, length, 6));
+	dagdb_free(p1, length);
+	dagdb_free(p2, SLAB_SIZE + 1);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static void test_memory_stats() {
+	dagdb_statistics before, stats;
+	// Earlier tests may have freed memory with a different type than it was allocated with,
+	// hence only the totals are back at zero.
+	dagdb_memory_stats(&before);
+	EX_ASSERT_EQUAL_INT(before.live_bytes, 0);
+	EX_ASSERT_EQUAL_INT(before.slab_occupancy[occupancy_bucket(dagdb_slab, HEADER_SIZE/S)], 1);
+	dagdb_pointer p1 = dagdb_malloc_typed(3*S, DAGDB_TYPE_TRIE) | DAGDB_TYPE_TRIE;
+	dagdb_pointer p2 = dagdb_malloc(5*S);
+	dagdb_pointer p3 = dagdb_malloc(SLAB_SIZE + 1); EX_ASSERT_NO_ERROR
+	dagdb_memory_stats(&stats);
+	EX_ASSERT_EQUAL_INT(stats.type_bytes[DAGDB_TYPE_TRIE] - before.type_bytes[DAGDB_TYPE_TRIE], 3*S);
+	EX_ASSERT_EQUAL_INT(stats.type_bytes[DAGDB_TYPE_DATA] - before.type_bytes[DAGDB_TYPE_DATA], 5*S + dagdb_round_up(SLAB_SIZE + 1));
+	EX_ASSERT_EQUAL_INT(stats.live_bytes, 8*S + dagdb_round_up(SLAB_SIZE + 1));
+	EX_ASSERT_EQUAL_INT(stats.extent_slabs, 2);
+	EX_ASSERT_EQUAL_INT(stats.database_size, 3*SLAB_SIZE);
+	CU_ASSERT(stats.file_size >= stats.database_size);
+	verify_chunk_table();
+	// Resizing in place and moving are both accounted for.
+	p2 = dagdb_realloc(p2, 5*S, 7*S);
+	p1 = dagdb_realloc(p1, 3*S, MAX_CHUNK_SIZE); EX_ASSERT_NO_ERROR
+	dagdb_memory_stats(&stats);
+	EX_ASSERT_EQUAL_INT(stats.type_bytes[DAGDB_TYPE_TRIE] - before.type_bytes[DAGDB_TYPE_TRIE], MAX_CHUNK_SIZE);
+	EX_ASSERT_EQUAL_INT(stats.type_bytes[DAGDB_TYPE_DATA] - before.type_bytes[DAGDB_TYPE_DATA], 7*S + dagdb_round_up(SLAB_SIZE + 1));
+	verify_chunk_table();
+	dagdb_free(p1, MAX_CHUNK_SIZE);
+	dagdb_free(p2, 7*S);
+	dagdb_free(p3, SLAB_SIZE + 1);
+	dagdb_memory_stats(&stats);
+	EX_ASSERT_EQUAL_INT(stats.live_bytes, 0);
+	EX_ASSERT_EQUAL_INT(stats.extent_slabs, 0);
+	verify_chunk_table();
+}
+
+/** Returns the number of allocations that were placed near their hint since the database was loaded. */
+static uint64_t allocations_near() {
+	dagdb_counters counters;
+	dagdb_get_counters(&counters);
+	return counters.allocations_near;
+}
+
+static void test_malloc_near() {
+	dagdb_pointer p[10];
+	for (int i=0; i<10; i++) {
+		p[i] = dagdb_malloc_typed(16*S, DAGDB_TYPE_TRIE); EX_ASSERT_NO_ERROR
+		EX_ASSERT_EQUAL_LONG_HEX(p[i], HEADER_SIZE + i*16*S);
+	}
+	dagdb_free(p[2] | DAGDB_TYPE_TRIE, 16*S);
+	dagdb_free(p[7] | DAGDB_TYPE_TRIE, 16*S);
+	uint64_t near = allocations_near();
+	
+	// The first free range after the hint is used, rather than the most recently freed chunk.
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_malloc_near(16*S, DAGDB_TYPE_TRIE, p[5] | DAGDB_TYPE_TRIE), p[7]);
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_malloc_near(16*S, DAGDB_TYPE_TRIE, p[5] | DAGDB_TYPE_TRIE), HEADER_SIZE + 10*16*S);
+	// Free ranges before the hint are used if there are none after it. The remainder remains available.
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_malloc_near(4*S, DAGDB_TYPE_KVPAIR, p[9] | DAGDB_TYPE_TRIE), HEADER_SIZE + 11*16*S);
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_malloc_near(4*S, DAGDB_TYPE_KVPAIR, p[1] | DAGDB_TYPE_TRIE), p[2]);
+	EX_ASSERT_EQUAL_INT(allocations_near() - near, 4);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_malloc_near(12*S, DAGDB_TYPE_KVPAIR, p[1] | DAGDB_TYPE_TRIE), p[2] + 4*S);
+	verify_chunk_table();
+	
+	// Without a hint, or with a hint to data, this is a normal allocation.
+	dagdb_pointer q = dagdb_malloc_near(16*S, DAGDB_TYPE_TRIE, 0);
+	dagdb_pointer r = dagdb_malloc_near(16*S, DAGDB_TYPE_TRIE, p[0] | DAGDB_TYPE_DATA); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(allocations_near() - near, 5);
+	verify_chunk_table();
+	
+	for (int i=0; i<10; i++) if (i != 2) dagdb_free(p[i] | DAGDB_TYPE_TRIE, 16*S);
+	dagdb_free((HEADER_SIZE + 10*16*S) | DAGDB_TYPE_TRIE, 16*S);
+	dagdb_free((HEADER_SIZE + 11*16*S) | DAGDB_TYPE_KVPAIR, 4*S);
+	dagdb_free(p[2] | DAGDB_TYPE_KVPAIR, 4*S);
+	dagdb_free((p[2] + 4*S) | DAGDB_TYPE_KVPAIR, 12*S);
+	dagdb_free(q | DAGDB_TYPE_TRIE, 16*S);
+	dagdb_free(r | DAGDB_TYPE_TRIE, 16*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static void test_malloc_near_slabs() {
+	// Create a free range in the first slab, followed by an extent and a slab without sufficient free space.
+	dagdb_pointer x = dagdb_malloc(700*S);
+	dagdb_pointer e = dagdb_malloc(MAX_CHUNK_SIZE + S);
+	dagdb_pointer p[16];
+	int n = 0;
+	do {
+		p[n] = dagdb_malloc(512*S); EX_ASSERT_NO_ERROR
+	} while (p[n++] < 3*SLAB_SIZE);
+	EX_ASSERT_EQUAL_LONG_HEX(x, HEADER_SIZE);
+	EX_ASSERT_EQUAL_LONG_HEX(e, SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 4*SLAB_SIZE);
+	dagdb_free(x, 700*S);
+	uint64_t near = allocations_near();
+	
+	// The extent is skipped while looking for room in the slabs before that of the hint.
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_malloc_near(700*S, DAGDB_TYPE_TRIE, p[n-2] | DAGDB_TYPE_TRIE), HEADER_SIZE);
+	EX_ASSERT_EQUAL_INT(allocations_near() - near, 1);
+	verify_chunk_table();
+	
+	for (int i=0; i<n; i++) dagdb_free(p[i], 512*S);
+	dagdb_free(e, MAX_CHUNK_SIZE + S);
+	dagdb_free(HEADER_SIZE | DAGDB_TYPE_TRIE, 700*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static CU_TestInfo test_realloc[] = {
+  { "realloc_grow_in_place", test_realloc_grow_in_place },
+  { "realloc_move", test_realloc_move },
+  { "realloc_shrink", test_realloc_shrink },
+  { "realloc_too_much", test_realloc_too_much },
+  { "extent_alloc", test_extent_alloc },
+  { "extent_reuse", test_extent_reuse },
+  { "extent_realloc", test_extent_realloc },
+  { "slab_release", test_slab_release },
+  { "memory_stats", test_memory_stats },
+  { "malloc_near", test_malloc_near },
+  { "malloc_near_slabs", test_malloc_near_slabs },
+  CU_TEST_INFO_NULL,
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+static int open_segregated_db() {
+	dagdb_options options = dagdb_default_options;
+	options.segregate_types = 1;
+	unlink(DB_FILENAME);
+	return dagdb_load_options(DB_FILENAME, &options);
+}
+
+static void test_segregated_alloc() {
+	// Each type gets its own slab.
+	dagdb_pointer d = dagdb_malloc(6*S);
+	dagdb_pointer e1 = dagdb_malloc_typed(6*S, DAGDB_TYPE_ELEMENT);
+	dagdb_pointer t = dagdb_malloc_typed(16*S, DAGDB_TYPE_TRIE);
+	dagdb_pointer e2 = dagdb_malloc_typed(6*S, DAGDB_TYPE_ELEMENT); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(d, HEADER_SIZE);
+	EX_ASSERT_EQUAL_LONG_HEX(e1, SLAB_SIZE);
+	EX_ASSERT_EQUAL_LONG_HEX(t, 2*SLAB_SIZE);
+	EX_ASSERT_EQUAL_LONG_HEX(e2, e1 + 6*S);
+	CU_ASSERT(LOCATE(Header, 0)->chunk_mask[DAGDB_TYPE_ELEMENT] != 0);
+	CU_ASSERT(LOCATE(Header, 0)->chunk_mask[DAGDB_TYPE_KVPAIR] == 0);
+	verify_chunk_table();
+	
+	// Freed memory returns to the table of its type.
+	dagdb_free(e1 | DAGDB_TYPE_ELEMENT, 6*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_malloc_typed(6*S, DAGDB_TYPE_ELEMENT), e1);
+	
+	// A slab that becomes completely free can be used by other types.
+	dagdb_free(e1 | DAGDB_TYPE_ELEMENT, 6*S);
+	dagdb_free(e2 | DAGDB_TYPE_ELEMENT, 6*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(LOCATE(Header, 0)->chunk_mask[DAGDB_TYPE_ELEMENT], 0);
+	dagdb_pointer k = dagdb_malloc_typed(2*S, DAGDB_TYPE_KVPAIR); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(k, SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 3*SLAB_SIZE);
+	verify_chunk_table();
+	
+	dagdb_free(t | DAGDB_TYPE_TRIE, 16*S);
+	dagdb_free(k | DAGDB_TYPE_KVPAIR, 2*S);
+	dagdb_free(d, 6*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static void test_segregated_free_slab() {
+	dagdb_pointer d = dagdb_malloc(6*S);
+	dagdb_pointer e = dagdb_malloc_typed(6*S, DAGDB_TYPE_ELEMENT);
+	dagdb_pointer t = dagdb_malloc_typed(16*S, DAGDB_TYPE_TRIE); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(d, HEADER_SIZE);
+	EX_ASSERT_EQUAL_LONG_HEX(e, SLAB_SIZE);
+	dagdb_free(e | DAGDB_TYPE_ELEMENT, 6*S);
+	// Freeing the data puts the rest of the first slab in front of the free slab.
+	dagdb_free(d, 6*S);
+	dagdb_pointer list = CHUNK_TABLE_LOCATION(0, CHUNK_TABLE_SIZE-1);
+	EX_ASSERT_EQUAL_LONG_HEX(LOCATE(FreeMemoryChunk, list)->next, HEADER_SIZE);
+	EX_ASSERT_EQUAL_LONG_HEX(LOCATE(FreeMemoryChunk, HEADER_SIZE)->next, SLAB_SIZE);
+	// Still, the free slab is used before the file grows.
+	dagdb_pointer k = dagdb_malloc_typed(2*S, DAGDB_TYPE_KVPAIR); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(k, SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, 3*SLAB_SIZE);
+	verify_chunk_table();
+	dagdb_free(t | DAGDB_TYPE_TRIE, 16*S);
+	dagdb_free(k | DAGDB_TYPE_KVPAIR, 2*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static void test_segregated_realloc() {
+	dagdb_pointer t = dagdb_malloc_typed(4*S, DAGDB_TYPE_TRIE);
+	dagdb_pointer u = dagdb_malloc_typed(4*S, DAGDB_TYPE_TRIE); EX_ASSERT_NO_ERROR
+	// Moving memory keeps it in the slabs of its type.
+	dagdb_pointer q = dagdb_realloc(t | DAGDB_TYPE_TRIE, 4*S, 8*S); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_INT(q & DAGDB_TYPE_MASK, DAGDB_TYPE_TRIE);
+	EX_ASSERT_EQUAL_INT(q / SLAB_SIZE, t / SLAB_SIZE);
+	verify_chunk_table();
+	// The released memory is reused for this type.
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_malloc_typed(4*S, DAGDB_TYPE_TRIE), t);
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_malloc(4*S), HEADER_SIZE);
+	verify_chunk_table();
+	dagdb_free(t | DAGDB_TYPE_TRIE, 4*S);
+	dagdb_free(u | DAGDB_TYPE_TRIE, 4*S);
+	dagdb_free(q, 8*S);
+	dagdb_free(HEADER_SIZE, 4*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static void test_segregated_near() {
+	dagdb_pointer t = dagdb_malloc_typed(16*S, DAGDB_TYPE_TRIE);
+	dagdb_pointer u = dagdb_malloc_typed(16*S, DAGDB_TYPE_TRIE); EX_ASSERT_NO_ERROR
+	uint64_t near = allocations_near();
+	// Hints of another type are ignored, such that the slabs stay segregated.
+	dagdb_pointer k = dagdb_malloc_near(2*S, DAGDB_TYPE_KVPAIR, t | DAGDB_TYPE_TRIE); EX_ASSERT_NO_ERROR
+	CU_ASSERT(k / SLAB_SIZE != t / SLAB_SIZE);
+	EX_ASSERT_EQUAL_INT(allocations_near() - near, 0);
+	// Hints of the same type are used.
+	dagdb_free(t | DAGDB_TYPE_TRIE, 16*S);
+	EX_ASSERT_EQUAL_LONG_HEX(dagdb_malloc_near(16*S, DAGDB_TYPE_TRIE, u | DAGDB_TYPE_TRIE), u + 16*S);
+	EX_ASSERT_EQUAL_INT(allocations_near() - near, 1);
+	verify_chunk_table();
+	dagdb_free(u | DAGDB_TYPE_TRIE, 16*S);
+	dagdb_free((u + 16*S) | DAGDB_TYPE_TRIE, 16*S);
+	dagdb_free(k | DAGDB_TYPE_KVPAIR, 2*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+}
+
+static void test_segregated_reload() {
+	dagdb_pointer e = dagdb_malloc_typed(6*S, DAGDB_TYPE_ELEMENT); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(e, SLAB_SIZE);
+	dagdb_unload();
+	
+	// The database stays segregated when it is loaded without the option.
+	int r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	CU_ASSERT(dagdb_current_options.segregate_types);
+	dagdb_pointer k = dagdb_malloc_typed(2*S, DAGDB_TYPE_KVPAIR); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(k, 2*SLAB_SIZE);
+	verify_chunk_table();
+	dagdb_free(e | DAGDB_TYPE_ELEMENT, 6*S);
+	dagdb_free(k | DAGDB_TYPE_KVPAIR, 2*S);
+	verify_chunk_table();
+	EX_ASSERT_EQUAL_INT(dagdb_database_size, SLAB_SIZE);
+	dagdb_unload();
+	
+	// And a database that is not segregated stays so when it is loaded with the option.
+	unlink(DB_FILENAME);
+	r = dagdb_load(DB_FILENAME); EX_ASSERT_NO_ERROR
+	dagdb_unload();
+	dagdb_options options = dagdb_default_options;
+	options.segregate_types = 1;
+	r = dagdb_load_options(DB_FILENAME, &options); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+	CU_ASSERT(!dagdb_current_options.segregate_types);
+	k = dagdb_malloc_typed(2*S, DAGDB_TYPE_KVPAIR); EX_ASSERT_NO_ERROR
+	EX_ASSERT_EQUAL_LONG_HEX(k, HEADER_SIZE);
+	dagdb_free(k | DAGDB_TYPE_KVPAIR, 2*S);
+	verify_chunk_table();
+	dagdb_unload();
+	
+	// Leave a new segregated database for the remaining tests.
+	r = open_segregated_db(); EX_ASSERT_NO_ERROR
+	CU_ASSERT(r == 0);
+}
+
+static CU_TestInfo test_segregated[] = {
+  { "segregated_alloc", test_segregated_alloc },
+  { "segregated_free_slab", test_segregated_free_slab },
+  { "segregated_realloc", test_segregated_realloc },
+  { "segregated_near", test_segregated_near },
+  { "segregated_reload", test_segregated_reload },
+  CU_TEST_INFO_NULL,
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
 CU_SuiteInfo mem_suites[] = {
 	{ "mem-non-io",   NULL,        NULL,     test_non_io },
 	{ "mem-loading",  NULL,        NULL,     test_loading },
 	{ "mem-memory",   open_new_db, close_db, test_mem },
+	{ "mem-realloc",  open_new_db, close_db, test_realloc },
+	{ "mem-segregated", open_segregated_db, close_db, test_segregated },
 	CU_SUITE_INFO_NULL,
 };
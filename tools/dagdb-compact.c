@@ -0,0 +1,56 @@
+/*
+    DagDB - A lightweight structured database system.
+    Copyright (C) 2012  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "../src/api.h"
+#include "../src/error.h"
+
+/** @file
+ * @brief Rewrites a database into a new file in locality order.
+ * 
+ * Usage: dagdb_compact source destination
+ * The destination must not yet exist.
+ */
+
+int main(int argc, char ** argv) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s source destination\n", argv[0]);
+		return 2;
+	}
+	dagdb_statistics before, after;
+	if (dagdb_load(argv[1])) {
+		fprintf(stderr, "%s\n", dagdb_last_error());
+		return 1;
+	}
+	dagdb_stats(&before, 0);
+	if (dagdb_compact(argv[1], argv[2])) {
+		fprintf(stderr, "%s\n", dagdb_last_error());
+		return 1;
+	}
+	if (dagdb_load(argv[2])) {
+		fprintf(stderr, "%s\n", dagdb_last_error());
+		return 1;
+	}
+	dagdb_stats(&after, 0);
+	dagdb_unload();
+	printf("file size:  %" PRIu64 " -> %" PRIu64 "\n", before.file_size, after.file_size);
+	printf("live bytes: %" PRIu64 " -> %" PRIu64 "\n", before.live_bytes, after.live_bytes);
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+    DagDB - A lightweight structured database system.
+    Copyright (C) 2012  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "../src/api.h"
+#include "../src/error.h"
+
+/** @file
+ * @brief Rebuilds the filter of the keys in the root trie of a database.
+ * 
+ * Usage: dagdb_filter database bits_per_key
+ * A number of bits per key of 0 removes the filter.
+ */
+
+int main(int argc, char ** argv) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s database bits_per_key\n", argv[0]);
+		return 2;
+	}
+	// Loading a database that does not exist would create it.
+	if (access(argv[1], R_OK | W_OK)) {
+		perror(argv[1]);
+		return 1;
+	}
+	uint32_t bits = strtoul(argv[2], NULL, 10);
+	dagdb_statistics before, after;
+	if (dagdb_load(argv[1])) {
+		fprintf(stderr, "%s\n", dagdb_last_error());
+		return 1;
+	}
+	dagdb_stats(&before, 0);
+	if (dagdb_filter_rebuild(bits)) {
+		fprintf(stderr, "%s\n", dagdb_last_error());
+		dagdb_unload();
+		return 1;
+	}
+	dagdb_stats(&after, 0);
+	dagdb_unload();
+	printf("filter bytes:    %" PRIu64 " -> %" PRIu64 "\n", before.filter_bytes, after.filter_bytes);
+	printf("false positives: %.3f%% -> %.3f%%\n", 100 * before.filter_false_positive_rate, 100 * after.filter_false_positive_rate);
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+    DagDB - A lightweight structured database system.
+    Copyright (C) 2012  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "../src/api.h"
+#include "../src/error.h"
+
+/** @file
+ * @brief Prints the storage statistics of a database.
+ * 
+ * Usage: dagdb_stats database [samples]
+ * The trie depth distribution is estimated by looking up the given number of random keys (default 10000).
+ */
+
+static const char * type_names[4] = {"data", "element", "trie", "kvpair"};
+
+int main(int argc, char ** argv) {
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s database [samples]\n", argv[0]);
+		return 2;
+	}
+	// Loading a database that does not exist would create it.
+	if (access(argv[1], R_OK | W_OK)) {
+		perror(argv[1]);
+		return 1;
+	}
+	uint_fast32_t samples = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+	if (dagdb_load(argv[1])) {
+		fprintf(stderr, "%s\n", dagdb_last_error());
+		return 1;
+	}
+	dagdb_statistics stats;
+	dagdb_stats(&stats, samples);
+	dagdb_unload();
+	
+	printf("file size:     %" PRIu64 "\n", stats.file_size);
+	printf("database size: %" PRIu64 "\n", stats.database_size);
+	printf("slab size:     %" PRIu64 "\n", stats.slab_size);
+	if (stats.root_table_bits) printf("root table:    %" PRIu64 " bits\n", stats.root_table_bits);
+	if (stats.filter_bits_per_key) {
+		printf("filter:        %" PRIu64 " bits per key, %" PRIu64 " bytes, %" PRIu64 " keys, %.3f%% false positives\n", 
+			stats.filter_bits_per_key, stats.filter_bytes, stats.filter_keys, 100 * stats.filter_false_positive_rate);
+	}
+	printf("live bytes:    %" PRIu64 " (%.1f%% of file)\n", stats.live_bytes, 
+		stats.file_size ? 100.0 * stats.live_bytes / stats.file_size : 0.0);
+	for (int i = 0; i < 4; i++) {
+		printf("  %-8s %" PRIu64 "\n", type_names[i], stats.type_bytes[i]);
+	}
+	printf("free bytes per size class:\n");
+	for (int i = 0; i < DAGDB_STATS_SIZE_CLASSES; i++) {
+		if (stats.free_bytes[i]) printf("  %2d %" PRIu64 "\n", i, stats.free_bytes[i]);
+	}
+	printf("slab occupancy:\n");
+	printf("  empty     %" PRIu64 "\n", stats.slab_occupancy[0]);
+	for (int i = 1; i < DAGDB_STATS_OCCUPANCY_BUCKETS; i++) {
+		printf("  %3d-%3d%%  %" PRIu64 "\n", (i-1)*10, i*10, stats.slab_occupancy[i]);
+	}
+	printf("  extents   %" PRIu64 "\n", stats.extent_slabs);
+	if (samples) {
+		printf("trie depth of %" PRIuFAST32 " random lookups:\n", samples);
+		for (int i = 0; i < DAGDB_STATS_DEPTH_BUCKETS; i++) {
+			if (stats.trie_depth[i]) printf("  %2d %" PRIu64 "\n", i, stats.trie_depth[i]);
+		}
+	}
+	return 0;
+}